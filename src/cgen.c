@@ -37,8 +37,10 @@ static FILE *open_source_file(const char *prefix, const char *suffix);
    -n : Select name prefix. If no option is given, then the empty string will be
    used as a name prefix.
    -p : Select protocol. Possible protocols, at this time, are `buffer`, 
-   `file`, and `fd`. You must select at least one protocol.
-   -O : Select optimization. Optimizations have not yet been implemented.
+   `file`, `fd`, and `mmap`. You must select at least one protocol.
+   -O : Select optimization. Possible optimizations, at this time, are
+   `specialize`, `compact-types`, and `pools`. Any number of optimizations
+   may be selected.
 */
 CJobStatus cgen_main(int argc, char **argv)
 {
@@ -79,6 +81,7 @@ language %s.\n", argv[i+1]);
       if (i + 1 >= argc) goto ArgumentError;
       if ((result = register_optimization(job, argv, i)) != CJOB_SUCCESS)
         goto Finish;
+      i++;
     } else { /* Strings that aren't command line options are files that we
                 are meant to parse and compile */
       if ((result = register_file_to_parse(argv, i, parser)) != CJOB_SUCCESS)
@@ -148,12 +151,75 @@ char *strformat(const char *fmt, ...)
   return ret;
 }
 
+char *strappend(char *s, const char *fmt, ...)
+{
+  char *suffix, *ret;
+  va_list ap;
+  if (!s) return NULL;
+  va_start(ap, fmt);
+  if (util_vasprintf(&suffix, fmt, ap) < 0) {
+    va_end(ap);
+    free(s);
+    return NULL;
+  }
+  va_end(ap);
+  ret = (char*)realloc(s, strlen(s) + strlen(suffix) + 1);
+  if (!ret) {
+    free(s);
+    free(suffix);
+    return NULL;
+  }
+  strcat(ret, suffix);
+  free(suffix);
+  return ret;
+}
+
 int child_is_embeddable(const ChildField *child)
 {
   return child->tag == CHILD_STRUCT && 
          child->meta.embeddable;
 }
 
+/* A structure owns heap memory if any of its children live outside of it.
+   Embedded structures can't be recursive, so the recursion terminates. */
+int struct_owns_memory(const ParsedStruct *strct)
+{
+  int i;
+  for (i = 0; i < strct->num_children; i ++) {
+    if (!child_is_embeddable(&strct->children[i]) ||
+        struct_owns_memory(strct->children[i].type.strct))
+      return 1;
+  }
+  return 0;
+}
+
+int schema_has_struct_lists(const ParsedSchema *schema)
+{
+  int i, j;
+  for (i = 0; i < schema->num_structs; i ++) {
+    for (j = 0; j < schema->structs[i].num_children; j ++) {
+      if (schema->structs[i].children[j].tag == CHILD_STRUCT_LIST)
+        return 1;
+    }
+  }
+  return 0;
+}
+
+/* max_size is only an upper bound; the encoded size is fixed only if none
+   of the structures that contribute to it are nullable. A structure with
+   a nonzero max_size has no lists and no recursive children. */
+size_t struct_fixed_size(const ParsedStruct *strct)
+{
+  int i;
+  if (strct->meta.max_size == 0) return 0;
+  for (i = 0; i < strct->num_children; i ++) {
+    if (strct->children[i].nullable ||
+        struct_fixed_size(strct->children[i].type.strct) == 0)
+      return 0;
+  }
+  return strct->meta.max_size;
+}
+
 const char *scalar_type_name(ScalarTag type)
 {
   switch (type) {
@@ -184,6 +250,36 @@ const char *scalar_type_name(ScalarTag type)
   }
 }
 
+const char *scalar_function_suffix(ScalarTag type)
+{
+  switch (type) {
+  case SCALAR_UINT8:
+  case SCALAR_ENUM:
+  case SCALAR_BOOL:
+    return "uint8";
+  case SCALAR_INT8:
+    return "int8";
+  case SCALAR_UINT16:
+    return "uint16";
+  case SCALAR_INT16:
+    return "int16";
+  case SCALAR_UINT32:
+    return "uint32";
+  case SCALAR_INT32:
+    return "int32";
+  case SCALAR_UINT64:
+    return "uint64";
+  case SCALAR_INT64:
+    return "int64";
+  case SCALAR_FLOAT32:
+    return "float32";
+  case SCALAR_FLOAT64:
+    return "float64";
+  default:
+    return NULL;
+  }
+}
+
 int scalar_bit_pattern(ScalarTag type)
 {
   switch (type) {
@@ -282,6 +378,11 @@ static CJob *new_cjob(void)
   ret->output = NULL;
   ret->protocols.buffer = 0;
   ret->protocols.file = 0;
+  ret->protocols.fd = 0;
+  ret->protocols.mmap = 0;
+  ret->optimizations.specialize = 0;
+  ret->optimizations.compact_types = 0;
+  ret->optimizations.pools = 0;
   if (!init_string_stack(&ret->strings.header_strings) ||
       !init_string_stack(&ret->strings.source_strings) ||
       !init_string_stack(&ret->strings.public_functions) ||
@@ -340,13 +441,19 @@ follows:\n\
   -O : Use an optimization. Optimizations can decrease the size and speed of\n\
        the output code at the risk of no longer being standard-conforming.\n\
        By default, the compiler chooses to generate code that is slower but\n\
-       well-defined under the standard. (No optimizations are currently\n\
-       supported; when they are, this space will include a list of\n\
-       optimizations.\n\
+       well-defined under the standard. Acceptable optimizations at this\n\
+       time are\n\
+         specialize (generate a dedicated encoder and decoder for every\n\
+                     structure; faster, but a larger source file)\n\
+         compact-types (store integers in the smallest types that can hold\n\
+                        them, rather than the fastest)\n\
+         pools (keep destroyed structures on per-type free lists, and\n\
+                create new ones from them)\n\
   -p : Choose a protocol. Acceptable protocols at this time are\n\
          file\n\
          buffer\n\
          fd\n\
+         mmap\n\
        You must choose at least one protocol.\n\
 In addition to these options, you must provide at least one <ARGUMENT_FILE>, \
 which is the name of a .haris schema file to compile.\n");
@@ -362,6 +469,8 @@ static CJobStatus register_protocol(CJob *job, char **argv, int i)
     job->protocols.file = 1;
   else if (!strcmp(argv[i+1], "fd"))
     job->protocols.fd = 1;
+  else if (!strcmp(argv[i+1], "mmap"))
+    job->protocols.mmap = 1;
   else {
     fprintf(stderr, "Unrecognized protocol %s.\n", argv[i+1]);
     return CJOB_JOB_ERROR;
@@ -373,11 +482,17 @@ static CJobStatus register_protocol(CJob *job, char **argv, int i)
    what optimization the user would like to use. */
 static CJobStatus register_optimization(CJob *job, char **argv, int i)
 {
-  (void)job;
-  (void)argv;
-  (void)i;
-  fprintf(stderr, "Optimizations are as of yet unimplemented.\n");
-  return CJOB_JOB_ERROR;
+  if (!strcmp(argv[i+1], "specialize"))
+    job->optimizations.specialize = 1;
+  else if (!strcmp(argv[i+1], "compact-types"))
+    job->optimizations.compact_types = 1;
+  else if (!strcmp(argv[i+1], "pools"))
+    job->optimizations.pools = 1;
+  else {
+    fprintf(stderr, "Unrecognized optimization %s.\n", argv[i+1]);
+    return CJOB_JOB_ERROR;
+  }
+  return CJOB_SUCCESS;
 }
 
 /* At argv[i] is the name of a file to open and parse. Run the given
@@ -416,7 +531,8 @@ static CJobStatus check_job(CJob *job)
   const ParsedStruct *strct;
   if (!job->schema || !job->prefix || !job->output)
     return CJOB_JOB_ERROR;
-  else if (!job->protocols.buffer && !job->protocols.file) {
+  else if (!job->protocols.buffer && !job->protocols.file &&
+             !job->protocols.fd && !job->protocols.mmap) {
     fprintf(stderr, "No protocol selected.\n\
 Run `haris -l c -h` for help.\n");
     return CJOB_JOB_ERROR;
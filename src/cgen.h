@@ -108,13 +108,25 @@ typedef struct {
   int buffer;
   int file;
   int fd;
+  int mmap;
 } CJobProtocols;
 
+typedef struct {
+  int specialize; /* Emit straight-line encoders and decoders for every
+                     structure rather than interpreting the reflective
+                     structure information at runtime */
+  int compact_types; /* Use the smallest integer types with the required
+                        widths in memory, rather than the fastest ones */
+  int pools; /* Recycle the memory of destroyed structures through per-type
+                free lists rather than giving it back to the allocator */
+} CJobOptimizations;
+
 typedef struct {
   ParsedSchema *schema; /* The schema to be compiled */
   const char *prefix;   /* Prefix all global names with this string */
   const char *output;   /* Write the output code to a file with this name */
   CJobProtocols protocols;
+  CJobOptimizations optimizations;
   CJobStrings strings; /* The strings that we will copy into the result source
                           and header files; this is built up dynamically at
                           compile time */
@@ -138,9 +150,21 @@ CJobStatus add_private_function(CJob *, char *);
    error. */
 char *strformat(const char *, ...);
 
+/* Consumes a dynamically allocated string and a format string, and returns
+   a new dynamically allocated string which is the concatenation of the
+   old string and the formatted parameters. The old string is invalidated.
+   If the old string is NULL, or if there is a memory or format error, NULL
+   is returned; this means a function body can be built up by a chain of
+   calls to strappend with only a single check for NULL at the very end. */
+char *strappend(char *, const char *, ...);
+
 int child_is_embeddable(const ChildField *);
+int struct_owns_memory(const ParsedStruct *);
+int schema_has_struct_lists(const ParsedSchema *);
+size_t struct_fixed_size(const ParsedStruct *);
 int scalar_bit_pattern(ScalarTag type);
 int sizeof_scalar(ScalarTag type);
 const char *scalar_type_name(ScalarTag);
+const char *scalar_function_suffix(ScalarTag);
 
 #endif
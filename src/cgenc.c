@@ -3,6 +3,12 @@
 #include "cgenc_file.h"
 #include "cgenc_buffer.h"
 #include "cgenc_fd.h"
+#include "cgenc_mmap.h"
+#include "cgenc_view.h"
+#include "cgenc_validate.h"
+#include "cgenc_visit.h"
+#include "cgenc_decoder.h"
+#include "cgenc_encoder.h"
 
 static CJobStatus write_source_protocol_funcs(CJob *job);
 
@@ -13,6 +19,8 @@ CJobStatus write_source_file(CJob *job)
   CJobStatus result;
   if ((result = write_source_public_funcs(job)) != CJOB_SUCCESS ||
       (result = write_source_core_funcs(job)) != CJOB_SUCCESS ||
+      (result = write_decoder_funcs(job)) != CJOB_SUCCESS ||
+      (result = write_encoder_funcs(job)) != CJOB_SUCCESS ||
       (result = write_source_protocol_funcs(job)) != CJOB_SUCCESS)
     return result;
   return CJOB_SUCCESS;
@@ -24,7 +32,10 @@ static CJobStatus write_source_protocol_funcs(CJob *job)
 {
   CJobStatus result;
   if (job->protocols.buffer)
-    if ((result = write_buffer_protocol_funcs(job)) != CJOB_SUCCESS)
+    if ((result = write_buffer_protocol_funcs(job)) != CJOB_SUCCESS ||
+        (result = write_view_funcs(job)) != CJOB_SUCCESS ||
+        (result = write_validate_funcs(job)) != CJOB_SUCCESS ||
+        (result = write_visit_funcs(job)) != CJOB_SUCCESS)
       return result;
   if (job->protocols.file)
     if ((result = write_file_protocol_funcs(job)) != CJOB_SUCCESS)
@@ -32,5 +43,8 @@ static CJobStatus write_source_protocol_funcs(CJob *job)
   if (job->protocols.fd)
     if ((result = write_fd_protocol_funcs(job)) != CJOB_SUCCESS)
       return result;
+  if (job->protocols.mmap)
+    if ((result = write_mmap_protocol_funcs(job)) != CJOB_SUCCESS)
+      return result;
   return CJOB_SUCCESS;
 }
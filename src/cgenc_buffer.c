@@ -3,6 +3,7 @@
 static CJobStatus write_buffer_structures(CJob *);
 static CJobStatus write_public_buffer_funcs(CJob *, ParsedStruct *);
 static CJobStatus write_static_buffer_funcs(CJob *);
+static int has_bounded_struct(CJob *);
 
 /* =============================PUBLIC INTERFACE============================= */
 
@@ -24,6 +25,15 @@ CJobStatus write_buffer_protocol_funcs(CJob *job)
 
 /* =============================STATIC FUNCTIONS============================= */
 
+static int has_bounded_struct(CJob *job)
+{
+  int i;
+  for (i = 0; i < job->schema->num_structs; i ++)
+    if (job->schema->structs[i].meta.max_size != 0)
+      return 1;
+  return 0;
+}
+
 static CJobStatus write_buffer_structures(CJob *job)
 {
   CJOB_FMT_HEADER_STRING(job,
@@ -39,14 +49,21 @@ static CJobStatus write_static_buffer_funcs(CJob *job)
 {
   CJOB_FMT_PRIV_FUNCTION(job,
 "static HarisStatus read_from_buffer_stream(void *_stream, \n\
+                                           haris_uint32_t unit,\n\
                                            haris_uint32_t count,\n\
-                                           const unsigned char **dest)\n\
+                                           const unsigned char **dest,\n\
+                                           haris_uint32_t *got)\n\
 {\n\
   HarisBufferStream *stream = (HarisBufferStream*)_stream;\n\
-  HARIS_ASSERT(count + stream->curr <= stream->sz, INPUT);\n\
-  HARIS_ASSERT(count + stream->curr <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
-  *dest = stream->buffer + stream->curr;\n\
-  stream->curr += count;\n\
+  haris_uint32_t avail = stream->sz - stream->curr;\n\
+  HARIS_ASSERT(unit <= avail, INPUT);\n\
+  HARIS_ASSERT(unit + stream->curr <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
+  if (avail > HARIS_MESSAGE_SIZE_LIMIT - stream->curr)\n\
+    avail = HARIS_MESSAGE_SIZE_LIMIT - stream->curr;\n\
+  if (count > avail / unit) count = avail / unit;\n\
+  if (dest) *dest = stream->buffer + stream->curr;\n\
+  *got = count;\n\
+  stream->curr += count * unit;\n\
   return HARIS_SUCCESS;\n\
 }\n\n");
   CJOB_FMT_PRIV_FUNCTION(job,
@@ -56,7 +73,33 @@ static CJobStatus write_static_buffer_funcs(CJob *job)
 {\n\
   HarisBufferStream *stream = (HarisBufferStream*)_stream;\n\
   /* No error checking necessary; the size of the structure is verified\n\
-     before serialization begins */\n\
+     before serialization begins, or is bounded by S_MAX_ENCODED_SIZE */\n\
+  memcpy(stream->buffer + stream->curr, src, count);\n\
+  stream->curr += count;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  /* The S_to_buffer_a functions encode in a single pass into a buffer that
+     doubles in size whenever it fills. The encoder itself reports structural
+     errors, and the size limit is checked here as the message grows. */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus write_to_growing_buffer_stream(void *_stream,\n\
+                                                  const unsigned char *src,\n\
+                                                  haris_uint32_t count)\n\
+{\n\
+  HarisBufferStream *stream = (HarisBufferStream*)_stream;\n\
+  haris_uint32_t new_sz;\n\
+  unsigned char *new_buffer;\n\
+  HARIS_ASSERT(count <= HARIS_MESSAGE_SIZE_LIMIT - stream->curr, SIZE);\n\
+  if (count > stream->sz - stream->curr) {\n\
+    new_sz = stream->sz;\n\
+    while (count > new_sz - stream->curr)\n\
+      new_sz = (new_sz > HARIS_MESSAGE_SIZE_LIMIT / 2 ?\n\
+                HARIS_MESSAGE_SIZE_LIMIT : new_sz * 2);\n\
+    new_buffer = (unsigned char *)realloc(stream->buffer, new_sz);\n\
+    HARIS_ASSERT(new_buffer, MEM);\n\
+    stream->buffer = new_buffer;\n\
+    stream->sz = new_sz;\n\
+  }\n\
   memcpy(stream->buffer + stream->curr, src, count);\n\
   stream->curr += count;\n\
   return HARIS_SUCCESS;\n\
@@ -69,16 +112,18 @@ static CJobStatus write_static_buffer_funcs(CJob *job)
 {\n\
   HarisStatus result;\n\
   HarisBufferStream buffer_stream;\n\
-  haris_uint32_t encoded_size = haris_lib_size(ptr, info, 0, &result);\n\
-  if (encoded_size == 0) return result;\n\
-  HARIS_ASSERT(encoded_size <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
-  buffer_stream.buffer = (unsigned char *)malloc(encoded_size);\n\
+  buffer_stream.sz = (haris_uint32_t)info->body_size + 2 + \n\
+    6 * (haris_uint32_t)info->num_children;\n\
+  buffer_stream.buffer = (unsigned char *)malloc(buffer_stream.sz);\n\
   HARIS_ASSERT(buffer_stream.buffer, MEM);\n\
   buffer_stream.curr = 0;\n\
   if ((result = _haris_to_stream(ptr, info, &buffer_stream, \n\
-                                 write_to_buffer_stream)) != HARIS_SUCCESS)\n\
+                                 write_to_growing_buffer_stream, 0))\n\
+      != HARIS_SUCCESS) {\n\
+    free(buffer_stream.buffer);\n\
     return result;\n\
-  *out_sz = encoded_size;\n\
+  }\n\
+  *out_sz = buffer_stream.curr;\n\
   *out_buf = buffer_stream.buffer;\n\
   return HARIS_SUCCESS;\n\
 }\n\n");
@@ -98,7 +143,26 @@ static CJobStatus write_static_buffer_funcs(CJob *job)
   buffer_stream.buffer = buf;\n\
   buffer_stream.curr = 0;\n\
   if ((result = _haris_to_stream(ptr, info, &buffer_stream,\n\
-                                 write_to_buffer_stream)) != HARIS_SUCCESS)\n\
+                                 write_to_buffer_stream, 0))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n\
+  if (out_addr) *out_addr = buf + buffer_stream.curr;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  if (has_bounded_struct(job))
+    CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus _public_to_buffer_fixed(void *ptr,\n\
+                                            const HarisStructureInfo *info,\n\
+                                            unsigned char *buf,\n\
+                                            unsigned char **out_addr)\n\
+{\n\
+  HarisStatus result;\n\
+  HarisBufferStream buffer_stream;\n\
+  buffer_stream.buffer = buf;\n\
+  buffer_stream.curr = 0;\n\
+  if ((result = _haris_to_stream(ptr, info, &buffer_stream,\n\
+                                 write_to_buffer_stream, 0))\n\
+      != HARIS_SUCCESS)\n\
     return result;\n\
   if (out_addr) *out_addr = buf + buffer_stream.curr;\n\
   return HARIS_SUCCESS;\n\
@@ -106,6 +170,7 @@ static CJobStatus write_static_buffer_funcs(CJob *job)
   CJOB_FMT_PRIV_FUNCTION(job,
 "static HarisStatus _public_from_buffer(void *ptr,\n\
                                        const HarisStructureInfo *info,\n\
+                                       haris_uint64_t fields,\n\
                                        unsigned char *buf,\n\
                                        haris_uint32_t sz,\n\
                                        unsigned char **out_addr)\n\
@@ -115,11 +180,85 @@ static CJobStatus write_static_buffer_funcs(CJob *job)
   buffer_stream.buffer = buf;\n\
   buffer_stream.sz = sz;\n\
   buffer_stream.curr = 0;\n\
+  if ((result = _haris_from_stream_projected(ptr, info, &buffer_stream, \n\
+                                             read_from_buffer_stream, NULL,\n\
+                                             0, fields))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n\
+  if (out_addr) *out_addr = buf + buffer_stream.curr;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  /* The structure itself comes out of the arena along with everything it
+     points to. If the message can't be decoded, the arena is wound back
+     to where it was. */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus _public_from_buffer_arena(void **out,\n\
+                                             const HarisStructureInfo *info,\n\
+                                             HarisArena *arena,\n\
+                                             unsigned char *buf,\n\
+                                             haris_uint32_t sz,\n\
+                                             unsigned char **out_addr)\n\
+{\n\
+  HarisStatus result;\n\
+  HarisBufferStream buffer_stream;\n\
+  size_t mark = arena->used;\n\
+  void *ptr = haris_arena_alloc(arena, info->size_of);\n\
+  HARIS_ASSERT(ptr, MEM);\n\
+  memset(ptr, 0, info->size_of);\n\
+  buffer_stream.buffer = buf;\n\
+  buffer_stream.sz = sz;\n\
+  buffer_stream.curr = 0;\n\
   if ((result = _haris_from_stream(ptr, info, &buffer_stream, \n\
-                                   read_from_buffer_stream, 0)) != HARIS_SUCCESS)\n\
+                                   read_from_buffer_stream, arena, 0))\n\
+      != HARIS_SUCCESS) {\n\
+    arena->used = mark;\n\
     return result;\n\
+  }\n\
+  *out = ptr;\n\
   if (out_addr) *out_addr = buf + buffer_stream.curr;\n\
   return HARIS_SUCCESS;\n\
+}\n\n");
+  /* When a buffer is read as a sequence of messages, the stream moves its
+     `buffer` up to the start of each message before decoding it, so that
+     `curr` only ever counts the bytes of a single message. If a message
+     can't be decoded, the stream stays at its first byte. */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus next_from_buffer_stream(void *ptr,\n\
+                                           const HarisStructureInfo *info,\n\
+                                           void *_stream,\n\
+                                           haris_uint32_t *out_sz)\n\
+{\n\
+  HarisBufferStream *stream = (HarisBufferStream*)_stream;\n\
+  HarisStatus result;\n\
+  stream->buffer += stream->curr;\n\
+  stream->sz -= stream->curr;\n\
+  stream->curr = 0;\n\
+  if ((result = _haris_from_stream(ptr, info, stream, \n\
+                                   read_from_buffer_stream, NULL, 0))\n\
+      != HARIS_SUCCESS) {\n\
+    stream->curr = 0;\n\
+    return result;\n\
+  }\n\
+  if (out_sz) *out_sz = stream->curr;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static int buffer_stream_at_end(void *_stream)\n\
+{\n\
+  HarisBufferStream *stream = (HarisBufferStream*)_stream;\n\
+  return stream->curr == stream->sz;\n\
+}\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"void haris_stream_open_buffer(HarisMessageStream *message_stream,\n\
+                              HarisBufferStream *stream,\n\
+                              unsigned char *buf, haris_uint32_t sz)\n\
+{\n\
+  stream->buffer = buf;\n\
+  stream->sz = sz;\n\
+  stream->curr = 0;\n\
+  message_stream->stream = stream;\n\
+  message_stream->next = next_from_buffer_stream;\n\
+  message_stream->at_end = buffer_stream_at_end;\n\
 }\n\n");
   return CJOB_SUCCESS;
 }
@@ -133,8 +272,32 @@ static CJobStatus write_public_buffer_funcs(CJob *job, ParsedStruct *strct)
                               unsigned char **out_addr)\n\
 {\n\
   return _public_from_buffer(strct, &haris_lib_structures[%d],\n\
-                             buf, sz, out_addr);\n}\n\n", 
+                             HARIS_ALL_FIELDS, buf, sz, out_addr);\n}\n\n", 
                         prefix, name, prefix, name, strct->schema_index);
+  /* Children left out of `fields` are skipped, and come back absent */
+  CJOB_FMT_PUB_FUNCTION(job, 
+"HarisStatus %s%s_from_buffer_projected(%s%s *strct, haris_uint64_t fields,\n\
+                                        unsigned char *buf, haris_uint32_t sz,\n\
+                                        unsigned char **out_addr)\n\
+{\n\
+  return _public_from_buffer(strct, &haris_lib_structures[%d],\n\
+                             fields, buf, sz, out_addr);\n}\n\n", 
+                        prefix, name, prefix, name, strct->schema_index);
+  /* The structure that S_from_buffer_arena decodes belongs to the arena, 
+     and is freed by resetting the arena, not with S_destroy. */
+  CJOB_FMT_PUB_FUNCTION(job, 
+"HarisStatus %s%s_from_buffer_arena(HarisArena *arena, %s%s **out,\n\
+                                    unsigned char *buf, haris_uint32_t sz,\n\
+                                    unsigned char **out_addr)\n\
+{\n\
+  void *ptr;\n\
+  HarisStatus result = _public_from_buffer_arena(&ptr,\n\
+                                                 &haris_lib_structures[%d],\n\
+                                                 arena, buf, sz, out_addr);\n\
+  if (result == HARIS_SUCCESS) *out = (%s%s*)ptr;\n\
+  return result;\n}\n\n", 
+                        prefix, name, prefix, name, strct->schema_index,
+                        prefix, name);
   CJOB_FMT_PUB_FUNCTION(job, 
 "HarisStatus %s%s_to_buffer_a(%s%s *strct, unsigned char **out_buf, \n\
                               haris_uint32_t *out_sz)\n\
@@ -150,5 +313,18 @@ static CJobStatus write_public_buffer_funcs(CJob *job, ParsedStruct *strct)
   return _public_to_buffer(strct, &haris_lib_structures[%d],\n\
                            buf, sz, out_addr);\n}\n\n",
                         prefix, name, prefix, name, strct->schema_index);
+  /* A structure with a bounded encoding always fits in a buffer of
+     S_MAX_ENCODED_SIZE bytes, so it needs neither the size pass nor any 
+     bounds checks while encoding. */
+  if (strct->meta.max_size != 0)
+    CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_to_buffer_fixed(%s%s *strct,\n\
+                                  unsigned char buf[%s%s_MAX_ENCODED_SIZE],\n\
+                                  unsigned char **out_addr)\n\
+{\n\
+  return _public_to_buffer_fixed(strct, &haris_lib_structures[%d],\n\
+                                 buf, out_addr);\n}\n\n",
+                          prefix, name, prefix, name, prefix, name,
+                          strct->schema_index);
   return CJOB_SUCCESS;
 }
@@ -15,10 +15,13 @@
 
 static CJobStatus write_public_constructor(CJob *, ParsedStruct *);
 static CJobStatus write_general_constructor(CJob *);
+static CJobStatus write_pool_funcs(CJob *);
 
 static CJobStatus write_public_destructor(CJob *, ParsedStruct *);
 static CJobStatus write_general_destructor(CJob *);
 
+static CJobStatus write_arena_funcs(CJob *);
+
 static CJobStatus write_public_initializers(CJob *, ParsedStruct *);
 static CJobStatus write_init_list(CJob *, ParsedStruct *, int);
 static CJobStatus write_general_init_list_member(CJob *);
@@ -36,24 +39,41 @@ static CJobStatus write_reflective_nonembedded_child(CJob *, ParsedStruct *,
 static CJobStatus write_in_memory_scalar_sizes(CJob *);
 static CJobStatus write_message_scalar_sizes(CJob *);
 static CJobStatus write_message_bit_patterns(CJob *);
+static CJobStatus write_bulk_scalar_flags(CJob *);
 
 static CJobStatus write_core_wfuncs(CJob *);
 static CJobStatus write_core_rfuncs(CJob *);
+static CJobStatus write_core_walk_funcs(CJob *);
 static CJobStatus write_core_size(CJob *);
+static CJobStatus write_core_bulk_funcs(CJob *);
 
 static CJobStatus write_general_child_handler(CJob *);
 static CJobStatus write_from_stream_funcs(CJob *);
 static CJobStatus write_to_stream_funcs(CJob *);
 
+static CJobStatus write_message_stream_funcs(CJob *);
+
+static CJobStatus write_producer_funcs(CJob *);
+static CJobStatus write_producer(CJob *, ParsedStruct *, int);
+
+static CJobStatus write_specialized_funcs(CJob *);
+static CJobStatus write_specialized_decoder(CJob *, ParsedStruct *);
+static char *append_specialized_child_decoder(char *, CJob *, ParsedStruct *,
+                                              int);
+static CJobStatus write_specialized_encoder(CJob *, ParsedStruct *);
+static char *append_specialized_child_encoder(char *, CJob *, ParsedStruct *,
+                                              int);
+
 static CJobStatus (* const general_core_writer_functions[])(CJob *) = {
   write_in_memory_scalar_sizes, write_message_scalar_sizes, 
-  write_message_bit_patterns,
+  write_message_bit_patterns, write_bulk_scalar_flags,
 
-  write_general_constructor, write_general_destructor, 
+  write_general_constructor, write_general_destructor, write_arena_funcs,
 
   write_general_init_list_member, write_general_init_struct_member,
 
-  write_core_wfuncs, write_core_rfuncs, write_core_size,
+  write_core_wfuncs, write_core_rfuncs, write_core_walk_funcs,
+  write_core_size, write_core_bulk_funcs,
 
   write_general_child_handler, write_from_stream_funcs,
   write_to_stream_funcs
@@ -101,6 +121,14 @@ CJobStatus write_source_core_funcs(CJob *job)
     if ((result = general_core_writer_functions[i](job)) != CJOB_SUCCESS)
       return result;
   }
+  if (job->protocols.buffer || job->protocols.file || job->protocols.fd)
+    if ((result = write_message_stream_funcs(job)) != CJOB_SUCCESS)
+      return result;
+  if (job->protocols.file || job->protocols.fd)
+    if ((result = write_producer_funcs(job)) != CJOB_SUCCESS)
+      return result;
+  if (job->optimizations.specialize)
+    return write_specialized_funcs(job);
   return CJOB_SUCCESS;
 }
 
@@ -293,8 +321,15 @@ static CJobStatus write_reflective_arrays(CJob *job)
       CJOB_FMT_SOURCE_STRING(job, "%d, %s%s_lib_children, ", 
                              strct->num_children, prefix, strct_name);
     }
-    CJOB_FMT_SOURCE_STRING(job, "%d, sizeof(%s%s) }%s\n", 
-                           strct->offset, prefix, strct_name, 
+    CJOB_FMT_SOURCE_STRING(job, "%d, sizeof(%s%s), %d, %lu", 
+                           strct->offset, prefix, strct_name,
+                           struct_owns_memory(strct),
+                           (unsigned long)struct_fixed_size(strct));
+    if (job->optimizations.specialize) {
+      CJOB_FMT_SOURCE_STRING(job, ",\n    %s%s_decode_body, %s%s_encode_body",
+                             prefix, strct_name, prefix, strct_name);
+    }
+    CJOB_FMT_SOURCE_STRING(job, " }%s\n",
                            (i + 1 >= job->schema->num_structs ? "" : ","));
   }
   CJOB_FMT_SOURCE_STRING(job, "};\n\n");
@@ -340,6 +375,30 @@ static CJobStatus write_message_bit_patterns(CJob *job)
   return CJOB_SUCCESS;
 }
 
+/* Write the array of flags that tell us whether a list of scalars of the
+   given type can be moved between memory and a message with a plain memcpy;
+   that is, whether the in-memory representation of the scalar is exactly
+   its message representation. Keyed by HarisScalarType. Single bytes always
+   qualify; wider integers need a little-endian host, and floating-point
+   numbers additionally need an IEEE 754 host.
+*/
+static CJobStatus write_bulk_scalar_flags(CJob *job)
+{
+  CJOB_FMT_SOURCE_STRING(job,
+"static const int haris_lib_bulk_scalars[] = {\n\
+  sizeof(haris_uint8_t) == 1, sizeof(haris_int8_t) == 1,\n\
+  HARIS_LITTLE_ENDIAN && sizeof(haris_uint16_t) == 2,\n\
+  HARIS_LITTLE_ENDIAN && sizeof(haris_int16_t) == 2,\n\
+  HARIS_LITTLE_ENDIAN && sizeof(haris_uint32_t) == 4,\n\
+  HARIS_LITTLE_ENDIAN && sizeof(haris_int32_t) == 4,\n\
+  HARIS_LITTLE_ENDIAN && sizeof(haris_uint64_t) == 8,\n\
+  HARIS_LITTLE_ENDIAN && sizeof(haris_int64_t) == 8,\n\
+  HARIS_LITTLE_ENDIAN && HARIS_IEEE_754 && sizeof(haris_float32) == 4,\n\
+  HARIS_LITTLE_ENDIAN && HARIS_IEEE_754 && sizeof(haris_float64) == 8\n\
+};\n\n");
+  return CJOB_SUCCESS;
+}
+
 /* ********* CONSTRUCTOR ********* */
 
 /* Write the public constructor for the given structure to the given file. */
@@ -362,6 +421,26 @@ static CJobStatus write_public_constructor(CJob *job, ParsedStruct *strct)
 */
 static CJobStatus write_general_constructor(CJob *job)
 {
+  if (job->optimizations.pools) {
+    CJOB_FMT_PRIV_FUNCTION(job, 
+"static void *_haris_lib_create(const HarisStructureInfo *info)\n\
+{\n\
+  void *strct;\n\
+  HarisPool *pool = &haris_lib_pools[info - haris_lib_structures];\n\
+  if (pool->head) {\n\
+    strct = pool->head;\n\
+    pool->head = *(void**)strct;\n\
+    pool->count --;\n\
+    pool->stats.hits ++;\n\
+  } else {\n\
+    strct = HARIS_MALLOC(info->size_of < sizeof(void*) ? \n\
+                         sizeof(void*) : info->size_of);\n\
+    if (!strct) return NULL;\n\
+    pool->stats.misses ++;\n\
+  }\n\
+  return memset(strct, 0, info->size_of);\n}\n\n");
+    return write_pool_funcs(job);
+  }
   CJOB_FMT_PRIV_FUNCTION(job, 
 "static void *_haris_lib_create(const HarisStructureInfo *info)\n\
 {\n\
@@ -371,6 +450,145 @@ static CJobStatus write_general_constructor(CJob *job)
   return CJOB_SUCCESS;
 }
 
+/* ********* POOLS ********* */
+
+/* With `-O pools`, every structure type has a free list of blocks that
+   S_destroy puts structures on and S_create takes them back off, so that
+   programs that create and destroy a lot of structures of the same few 
+   types rarely have to call HARIS_MALLOC or HARIS_FREE. The free list is
+   threaded through the first bytes of the blocks themselves, which is why
+   no block is smaller than a pointer.
+
+   The pools are kept in haris_lib_pools, which is keyed in the same way
+   as haris_lib_structures, and which is thread-local where the compiler
+   makes that possible (see HARIS_THREAD_LOCAL), in which case the limits,
+   the statistics and the duty to drain are all per thread. Each pool holds
+   at most `high_water` blocks; anything destroyed past that goes back to
+   HARIS_FREE. Only structures that are created one at a time are pooled:
+   the elements of structure lists live in the list's own array.
+*/
+static CJobStatus write_pool_funcs(CJob *job)
+{
+  int i;
+  const char *prefix = job->prefix, *name;
+  CJOB_FMT_HEADER_STRING(job,
+"/* The number of destroyed structures of each type that are kept around\n\
+   to be reused, and the storage class of the pools. If the pools can't\n\
+   be made thread-local, each thread must use its own structure types, or\n\
+   the calls must be serialized.\n\
+\n\
+   Thread-local pools belong to the thread that filled them. A thread has\n\
+   to call haris_pool_drain() before it exits, or every block it has\n\
+   pooled leaks. S_pool_set_high_water and S_pool_stats likewise only see\n\
+   the calling thread's pool of S; HARIS_POOL_HIGH_WATER is the limit for\n\
+   every thread that hasn't set its own.\n\
+*/\n\n\
+#ifndef HARIS_POOL_HIGH_WATER\n\
+#define HARIS_POOL_HIGH_WATER 256\n\
+#endif\n\n\
+#ifndef HARIS_THREAD_LOCAL\n\
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \\\n\
+    !defined(__STDC_NO_THREADS__)\n\
+#define HARIS_THREAD_LOCAL _Thread_local\n\
+#elif defined(__GNUC__)\n\
+#define HARIS_THREAD_LOCAL __thread\n\
+#else\n\
+#define HARIS_THREAD_LOCAL\n\
+#endif\n\
+#endif\n\n\
+typedef struct {\n\
+  haris_uint64_t hits;       /* Structures created from the pool */\n\
+  haris_uint64_t misses;     /* Structures created with HARIS_MALLOC */\n\
+  haris_uint64_t returns;    /* Structures destroyed into the pool */\n\
+  haris_uint64_t overflows;  /* Structures freed because the pool was full */\n\
+} HarisPoolStats;\n\n\
+typedef struct {\n\
+  void *head;\n\
+  haris_uint32_t count;\n\
+  haris_uint32_t high_water;\n\
+  HarisPoolStats stats;\n\
+} HarisPool;\n\n");
+  CJOB_FMT_SOURCE_STRING(job,
+"static HARIS_THREAD_LOCAL HarisPool haris_lib_pools[%d] = {\n",
+                         job->schema->num_structs);
+  for (i = 0; i < job->schema->num_structs; i ++)
+    CJOB_FMT_SOURCE_STRING(job, 
+"  { NULL, 0, HARIS_POOL_HIGH_WATER, { 0, 0, 0, 0 } }%s\n",
+                           (i + 1 >= job->schema->num_structs ? "" : ","));
+  CJOB_FMT_SOURCE_STRING(job, "};\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static void haris_lib_pool_trim(HarisPool *pool, haris_uint32_t high_water)\n\
+{\n\
+  void *block;\n\
+  while (pool->count > high_water) {\n\
+    block = pool->head;\n\
+    pool->head = *(void**)block;\n\
+    pool->count --;\n\
+    HARIS_FREE(block);\n\
+  }\n\
+}\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"void haris_pool_drain(void)\n\
+{\n\
+  int i;\n\
+  for (i = 0; i < %d; i ++)\n\
+    haris_lib_pool_trim(&haris_lib_pools[i], 0);\n\
+}\n\n", job->schema->num_structs);
+  for (i = 0; i < job->schema->num_structs; i ++) {
+    name = job->schema->structs[i].name;
+    CJOB_FMT_PUB_FUNCTION(job,
+"void %s%s_pool_set_high_water(haris_uint32_t high_water)\n\
+{\n\
+  HarisPool *pool = &haris_lib_pools[%d];\n\
+  pool->high_water = high_water;\n\
+  haris_lib_pool_trim(pool, high_water);\n\
+}\n\n", prefix, name, job->schema->structs[i].schema_index);
+    CJOB_FMT_PUB_FUNCTION(job,
+"void %s%s_pool_stats(HarisPoolStats *stats)\n\
+{\n\
+  *stats = haris_lib_pools[%d].stats;\n\
+}\n\n", prefix, name, job->schema->structs[i].schema_index);
+  }
+  return CJOB_SUCCESS;
+}
+
+/* ********* ARENAS ********* */
+
+/* An arena is a block of memory that the caller owns, which the decoders
+   can take memory from instead of calling HARIS_MALLOC and HARIS_REALLOC.
+   Memory is handed out from the front of the block in order, and none of
+   it is given back until the whole arena is reset; a structure decoded 
+   into an arena is therefore thrown away with haris_arena_reset rather 
+   than S_destroy. Every allocation is aligned to the size of 
+   HarisArenaAlign, so the block itself should be aligned as strictly as
+   malloc would align it.
+*/
+static CJobStatus write_arena_funcs(CJob *job)
+{
+  CJOB_FMT_PUB_FUNCTION(job,
+"void haris_arena_init(HarisArena *arena, void *buffer, size_t sz)\n\
+{\n\
+  arena->buffer = (unsigned char *)buffer;\n\
+  arena->sz = sz;\n\
+  arena->used = 0;\n\
+}\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"void haris_arena_reset(HarisArena *arena)\n\
+{\n\
+  arena->used = 0;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static void *haris_arena_alloc(HarisArena *arena, size_t n)\n\
+{\n\
+  size_t start = (arena->used + sizeof(HarisArenaAlign) - 1) /\n\
+                 sizeof(HarisArenaAlign) * sizeof(HarisArenaAlign);\n\
+  if (start > arena->sz || n > arena->sz - start) return NULL;\n\
+  arena->used = start + n;\n\
+  return arena->buffer + start;\n\
+}\n\n");
+  return CJOB_SUCCESS;
+}
+
 /* ********* DESTRUCTOR ********* */
 
 /* Writes the destructor for the given structure to the output file. */
@@ -414,16 +632,18 @@ static CJobStatus write_general_destructor(CJob *job)
     case HARIS_CHILD_STRUCT_LIST:\n\
       alloced = ((HarisListInfo*)((char*)ptr + child->offset))->alloc;\n\
       child_structure = child->struct_element;\n\
-      for (j = 0; j < alloced; j++)\n\
-        haris_lib_destroy_contents((char*)list_info->ptr +\n\
-                                     j * child_structure->size_of,\n\
-                                   child_structure);\n\
+      if (child_structure->owns_memory)\n\
+        for (j = 0; j < alloced; j++)\n\
+          haris_lib_destroy_contents((char*)list_info->ptr +\n\
+                                       j * child_structure->size_of,\n\
+                                     child_structure);\n\
       HARIS_FREE(list_info->ptr);\n\
       break;\n\
     case HARIS_CHILD_STRUCT:\n\
       child_structure = child->struct_element;\n\
-      _haris_lib_destroy(((HarisSubstructInfo*)list_info)->ptr, \n\
-                         child_structure);\n\
+      if (((HarisSubstructInfo*)list_info)->ptr)\n\
+        _haris_lib_destroy(((HarisSubstructInfo*)list_info)->ptr, \n\
+                           child_structure);\n\
       break;\n\
     case HARIS_CHILD_EMBEDDED_STRUCT:\n\
       child_structure = child->struct_element;\n\
@@ -432,6 +652,23 @@ static CJobStatus write_general_destructor(CJob *job)
     }\n\
   }\n\
 }\n\n");
+  if (job->optimizations.pools) {
+    CJOB_FMT_PRIV_FUNCTION(job, 
+"static void _haris_lib_destroy(void *ptr, const HarisStructureInfo *info)\n\
+{\n\
+  HarisPool *pool = &haris_lib_pools[info - haris_lib_structures];\n\
+  haris_lib_destroy_contents(ptr, info);\n\
+  if (pool->count < pool->high_water) {\n\
+    *(void**)ptr = pool->head;\n\
+    pool->head = ptr;\n\
+    pool->count ++;\n\
+    pool->stats.returns ++;\n\
+  } else {\n\
+    HARIS_FREE(ptr);\n\
+    pool->stats.overflows ++;\n\
+  }\n}\n\n");
+    return CJOB_SUCCESS;
+  }
   CJOB_FMT_PRIV_FUNCTION(job, 
 "static void _haris_lib_destroy(void *ptr, const HarisStructureInfo *info)\n\
 {\n\
@@ -513,43 +750,118 @@ static CJobStatus write_init_struct(CJob *job, ParsedStruct *strct,
    a HarisStructureInfo describing its makeup, a field number (this should
    be the 0-indexed number of the list field in question), and a size
    parameter (which shall be the length of the list to allocate).
+
+   The decoders use haris_lib_reserve_list_mem instead, which takes the
+   same arguments but never gives memory back, so that decoding message
+   after message into the same structure stops allocating once the lists
+   are as long as they need to be. Either way, the elements of a structure
+   list between `len` and `alloc` keep their own lists and substructures
+   around, so that they can be reused as well. If the decoder was given an
+   arena, haris_lib_reserve_list_mem takes new lists from the arena.
+   Only the public S_init_L functions use _haris_lib_init_list_mem, so it
+   is left out of schemas without lists.
 */
 static CJobStatus write_general_init_list_member(CJob *job)
 {
+  int i, j, has_list = 0;
+  ParsedSchema *schema = job->schema;
+  for (i = 0; i < schema->num_structs; i ++) {
+    for (j = 0; j < schema->structs[i].num_children; j ++) {
+      if (schema->structs[i].children[j].tag != CHILD_STRUCT)
+        has_list = 1;
+    }
+  }
   CJOB_FMT_PRIV_FUNCTION(job, 
-"static HarisStatus _haris_lib_init_list_mem(void *ptr,\
-const HarisStructureInfo *info, int field, haris_uint32_t sz)\n\
+"static size_t haris_lib_list_element_size(const HarisChild *child)\n\
 {\n\
-  void *testptr;\n\
-  const HarisChild *child = &info->children[field];\n\
-  HarisListInfo *list_info = (HarisListInfo*)((char*)ptr + child->offset);\n\
-  size_t element_size;\n\
-  if (sz == 0 || \n\
-      (list_info->alloc >= sz &&\n\
-       (double)sz / (double)list_info->alloc >= HARIS_DEALLOC_FACTOR))\n\
-    goto Success;\n\
   switch (child->child_type) {\n\
   case HARIS_CHILD_TEXT:\n\
   case HARIS_CHILD_SCALAR_LIST:\n\
-    element_size = haris_lib_in_memory_scalar_sizes[child->scalar_element];\n\
-    break;\n\
+    return haris_lib_in_memory_scalar_sizes[child->scalar_element];\n\
   case HARIS_CHILD_STRUCT_LIST:\n\
-    element_size = child->struct_element->size_of;\n\
-    break;\n\
+    return child->struct_element->size_of;\n\
   default:\n\
-    return HARIS_STRUCTURE_ERROR;\n\
+    return 0;\n\
   }\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job, 
+"static HarisStatus haris_lib_resize_list_mem(const HarisChild *child,\n\
+                                             HarisListInfo *list_info,\n\
+                                             haris_uint32_t sz)\n\
+{\n\
+  void *testptr;\n\
+  size_t element_size = haris_lib_list_element_size(child);\n\
+  haris_uint32_t j;\n\
+  HARIS_ASSERT(element_size > 0, STRUCTURE);\n\
+  /* Elements that are about to be cut off have to let go of their own\n\
+     memory first */\n\
+  if (child->child_type == HARIS_CHILD_STRUCT_LIST &&\n\
+      child->struct_element->owns_memory)\n\
+    for (j = sz; j < list_info->alloc; j ++) {\n\
+      haris_lib_destroy_contents((char*)list_info->ptr + j * element_size,\n\
+                                 child->struct_element);\n\
+      memset((char*)list_info->ptr + j * element_size, 0, element_size);\n\
+    }\n\
   testptr = HARIS_REALLOC(list_info->ptr, sz * element_size);\n\
   if (!testptr) return HARIS_MEM_ERROR;\n\
   list_info->ptr = testptr;\n\
-  if (child->child_type == HARIS_CHILD_STRUCT_LIST) {\n\
-    memset(testptr, 0, sz * element_size);\n\
-  }\n\
+  if (child->child_type == HARIS_CHILD_STRUCT_LIST && sz > list_info->alloc)\n\
+    memset((char*)testptr + list_info->alloc * element_size, 0,\n\
+           (sz - list_info->alloc) * element_size);\n\
   list_info->alloc = sz;\n\
-  Success:\n\
-    list_info->has = 1;\n\
-    list_info->len = sz;\n\
-    return HARIS_SUCCESS;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  if (has_list)
+    CJOB_FMT_PRIV_FUNCTION(job, 
+"static HarisStatus _haris_lib_init_list_mem(void *ptr,\
+const HarisStructureInfo *info, int field, haris_uint32_t sz)\n\
+{\n\
+  HarisStatus result;\n\
+  const HarisChild *child = &info->children[field];\n\
+  HarisListInfo *list_info = (HarisListInfo*)((char*)ptr + child->offset);\n\
+  if (sz != 0 && \n\
+      (list_info->alloc < sz ||\n\
+       (double)sz / (double)list_info->alloc < HARIS_DEALLOC_FACTOR))\n\
+    if ((result = haris_lib_resize_list_mem(child, list_info, sz))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+  list_info->has = 1;\n\
+  list_info->len = sz;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job, 
+"static HarisStatus haris_lib_reserve_list_mem(void *ptr,\n\
+                                              const HarisStructureInfo *info,\n\
+                                              int field, haris_uint32_t sz,\n\
+                                              HarisArena *arena)\n\
+{\n\
+  HarisStatus result;\n\
+  const HarisChild *child = &info->children[field];\n\
+  HarisListInfo *list_info = (HarisListInfo*)((char*)ptr + child->offset);\n\
+  size_t element_size;\n\
+  void *testptr;\n\
+  if (list_info->alloc < sz) {\n\
+    if (!arena) {\n\
+      if ((result = haris_lib_resize_list_mem(child, list_info, sz))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+    } else {\n\
+      element_size = haris_lib_list_element_size(child);\n\
+      HARIS_ASSERT(element_size > 0, STRUCTURE);\n\
+      if ((testptr = haris_arena_alloc(arena, sz * element_size)) == NULL)\n\
+        return HARIS_MEM_ERROR;\n\
+      if (list_info->alloc > 0)\n\
+        memcpy(testptr, list_info->ptr, list_info->alloc * element_size);\n\
+      if (child->child_type == HARIS_CHILD_STRUCT_LIST)\n\
+        memset((char*)testptr + list_info->alloc * element_size, 0,\n\
+               (sz - list_info->alloc) * element_size);\n\
+      list_info->ptr = testptr;\n\
+      list_info->alloc = sz;\n\
+    }\n\
+  }\n\
+  list_info->has = 1;\n\
+  list_info->len = sz;\n\
+  return HARIS_SUCCESS;\n\
 }\n\n");
   return CJOB_SUCCESS;
 }
@@ -576,6 +888,27 @@ HarisStatus _haris_lib_init_struct_mem(void *ptr,\n\
   Success:\n\
   substruct->has = 1;\n\
   return HARIS_SUCCESS;\n}\n\n");
+  /* The decoders' version, which takes new substructures from the arena
+     if they were given one */
+  CJOB_FMT_PRIV_FUNCTION(job, 
+"static HarisStatus haris_lib_reserve_struct_mem(void *ptr,\n\
+                                                const HarisStructureInfo *info,\n\
+                                                int field, HarisArena *arena)\n\
+{\n\
+  HarisSubstructInfo *substruct;\n\
+  const HarisStructureInfo *child_info = info->children[field].struct_element;\n\
+  if (!arena)\n\
+    return _haris_lib_init_struct_mem(ptr, info, field);\n\
+  substruct = (HarisSubstructInfo*)((char*)ptr + \n\
+                                    info->children[field].offset);\n\
+  if (!substruct->ptr) {\n\
+    if ((substruct->ptr = haris_arena_alloc(arena, child_info->size_of))\n\
+        == NULL)\n\
+      return HARIS_MEM_ERROR;\n\
+    memset(substruct->ptr, 0, child_info->size_of);\n\
+  }\n\
+  substruct->has = 1;\n\
+  return HARIS_SUCCESS;\n}\n\n");
   return CJOB_SUCCESS;
 }
 
@@ -637,6 +970,119 @@ static CJobStatus write_core_rfuncs(CJob *job)
   return CJOB_SUCCESS;
 }
 
+/* ********* BULK TRANSFER ********* */
+
+/* Writes the functions that move a run of bytes between memory and a stream
+   in as few calls as possible. They're used to transfer whole lists of 
+   scalars whose in-memory and message representations are identical (see
+   haris_lib_bulk_scalars). Reads take spans as large as the stream will
+   give, and writes hand over the whole list at once.
+
+   haris_lib_read reads exactly `count` bytes, which is what most of the
+   decoder wants. haris_lib_skip throws away `count` units of `unit` bytes
+   each without asking the stream to produce them. */
+static CJobStatus write_core_bulk_funcs(CJob *job)
+{
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_read(void *stream, HarisSpanReader reader,\n\
+                                  haris_uint32_t count,\n\
+                                  const unsigned char **dest)\n\
+{\n\
+  haris_uint32_t got;\n\
+  if (count == 0) {\n\
+    *dest = NULL;\n\
+    return HARIS_SUCCESS;\n\
+  }\n\
+  return reader(stream, count, 1, dest, &got);\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_skip(void *stream, HarisSpanReader reader,\n\
+                                  haris_uint32_t unit, haris_uint32_t count)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t got;\n\
+  for (; count > 0; count -= got)\n\
+    if ((result = reader(stream, unit, count, NULL, &got)) != HARIS_SUCCESS)\n\
+      return result;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_read_bulk(void *stream, HarisSpanReader reader,\n\
+                                       void *dest, haris_uint32_t count)\n\
+{\n\
+  HarisStatus result;\n\
+  const unsigned char *read_buffer;\n\
+  unsigned char *out = (unsigned char*)dest;\n\
+  haris_uint32_t got;\n\
+  for (; count > 0; count -= got, out += got) {\n\
+    if ((result = reader(stream, 1, count, &read_buffer, &got))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    memcpy(out, read_buffer, got);\n\
+  }\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_write_bulk(void *stream, HarisStreamWriter writer,\n\
+                                        const void *src, haris_uint32_t count)\n\
+{\n\
+  if (count == 0) return HARIS_SUCCESS;\n\
+  return writer(stream, (const unsigned char*)src, count);\n\
+}\n\n");
+  return CJOB_SUCCESS;
+}
+
+/* ********* TRAVERSAL ********* */
+
+/* None of the functions that walk a whole message or structure recurse;
+   each keeps its own stack of HarisFrames, HARIS_DEPTH_LIMIT + 1 deep, in
+   a local array. haris_lib_push_frame puts the frame for a child structure
+   (or for the first element of a list of them) on top of `*frame`, after
+   checking that the child isn't nested too deeply. `depth` is the depth of
+   the structure at the bottom of the stack. The frame starts out with
+   `child` at -1, meaning that its body comes first.
+
+   haris_lib_mark_absent records that a child is missing from the given
+   structure, without touching any memory the child might own. */
+static CJobStatus write_core_walk_funcs(CJob *job)
+{
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_push_frame(HarisFrame *stack, HarisFrame **frame,\n\
+                                        int depth, void *ptr,\n\
+                                        const HarisStructureInfo *info,\n\
+                                        int num_children, int body_size,\n\
+                                        haris_uint32_t elements_left)\n\
+{\n\
+  HarisFrame *top;\n\
+  HARIS_ASSERT(depth + (int)(*frame - stack) < HARIS_DEPTH_LIMIT, DEPTH);\n\
+  top = ++ *frame;\n\
+  top->ptr = ptr;\n\
+  top->info = info;\n\
+  top->num_children = num_children;\n\
+  top->body_size = body_size;\n\
+  top->child = -1;\n\
+  top->elements_left = elements_left;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static void haris_lib_mark_absent(void *ptr, const HarisChild *child)\n\
+{\n\
+  switch (child->child_type) {\n\
+  case HARIS_CHILD_TEXT:\n\
+  case HARIS_CHILD_SCALAR_LIST:\n\
+  case HARIS_CHILD_STRUCT_LIST:\n\
+    ((HarisListInfo*)((char*)ptr + child->offset))->has = 0;\n\
+    break;\n\
+  case HARIS_CHILD_STRUCT:\n\
+    ((HarisSubstructInfo*)((char*)ptr + child->offset))->has = 0;\n\
+    break;\n\
+  case HARIS_CHILD_EMBEDDED_STRUCT:\n\
+    *((char*)ptr + child->has_offset) = 0;\n\
+  }\n\
+}\n\n");
+  return CJOB_SUCCESS;
+}
+
 /* ********* SIZE ********* */
 
 /* Writes the core size-measuring function to the output file. This function's
@@ -652,77 +1098,96 @@ static CJobStatus write_core_size(CJob *job)
 "haris_uint32_t haris_lib_size(void *ptr, const HarisStructureInfo *info,\n\
                                int depth, HarisStatus *out)\n\
 {\n\
-  int i;\n\
-  haris_uint32_t accum, buf, j;\n\
+  HarisFrame stack[HARIS_DEPTH_LIMIT + 1], *frame = stack;\n\
+  haris_uint64_t accum;\n\
+  haris_uint32_t elements;\n\
   const HarisChild *child;\n\
   HarisListInfo *list_info;\n\
-  HarisSubstructInfo *substruct_info;\n\
+  void *child_ptr;\n\
+  int present;\n\
   if (depth > HARIS_DEPTH_LIMIT) {\n\
     *out = HARIS_DEPTH_ERROR;\n\
     return 0;\n\
   }\n\
-  accum = info->body_size + 2;\n\
-  for (i = 0; i < info->num_children; i ++) {\n\
-    child = &info->children[i];\n\
-    list_info = (HarisListInfo*)((char*)ptr + child->offset);\n\
-    if (!child->nullable) {\n\
-      if ((child->child_type == HARIS_CHILD_STRUCT) ?\n\
-          !((HarisSubstructInfo*)list_info)->has : !list_info->has)\n\
-        goto StructureError;\n\
+  accum = (haris_uint64_t)info->body_size + 2;\n\
+  frame->ptr = ptr;\n\
+  frame->info = info;\n\
+  frame->child = 0;\n\
+  frame->elements_left = 0;\n\
+  for (;;) {\n\
+    if (accum > HARIS_MESSAGE_SIZE_LIMIT) {\n\
+      *out = HARIS_SIZE_ERROR;\n\
+      return 0;\n\
     }\n\
+    if (frame->child == frame->info->num_children) {\n\
+      if (frame->elements_left > 0) { /* on to the next element */\n\
+        frame->elements_left --;\n\
+        frame->ptr = (char*)frame->ptr + frame->info->size_of;\n\
+        frame->child = 0;\n\
+        accum += (haris_uint64_t)frame->info->body_size;\n\
+      } else if (frame == stack) {\n\
+        return (haris_uint32_t)accum;\n\
+      } else {\n\
+        frame --;\n\
+      }\n\
+      continue;\n\
+    }\n\
+    child = &frame->info->children[frame->child ++];\n\
+    list_info = (HarisListInfo*)((char*)frame->ptr + child->offset);\n\
+    switch (child->child_type) {\n\
+    case HARIS_CHILD_STRUCT:\n\
+      present = ((HarisSubstructInfo*)list_info)->has;\n\
+      break;\n\
+    case HARIS_CHILD_EMBEDDED_STRUCT:\n\
+      present = *((char*)frame->ptr + child->has_offset);\n\
+      break;\n\
+    default:\n\
+      present = list_info->has;\n\
+    }\n\
+    if (!present) {\n\
+      if (!child->nullable) {\n\
+        *out = HARIS_STRUCTURE_ERROR;\n\
+        return 0;\n\
+      }\n\
+      accum += 1;\n\
+      continue;\n\
+    }\n\
+    child_ptr = NULL;\n\
+    elements = 1;\n\
     switch (child->child_type) {\n\
     case HARIS_CHILD_TEXT:\n\
     case HARIS_CHILD_SCALAR_LIST:\n\
-      if (!list_info->has)\n\
-        accum += 1;\n\
-      else\n\
-        accum += 4 + \n\
-          list_info->len * haris_lib_message_scalar_sizes[child->scalar_element];\n\
+      accum += 4 + (haris_uint64_t)list_info->len * \n\
+        haris_lib_message_scalar_sizes[child->scalar_element];\n\
       break;\n\
     case HARIS_CHILD_STRUCT_LIST:\n\
-      if (!list_info->has)\n\
-        accum += 1;\n\
-      else {\n\
-        accum += 6;\n\
-        for (j = 0; j < list_info->len; j ++) {\n\
-          buf = haris_lib_size((void*)((char*)list_info->ptr + \n\
-                                j * child->struct_element->size_of),\n\
-                                child->struct_element,\n\
-                                depth + 1, out);\n\
-          if (buf == 0) return 0;\n\
-          else if ((accum += buf - 2) > HARIS_MESSAGE_SIZE_LIMIT) {\n\
-            *out = HARIS_SIZE_ERROR; return 0;\n\
-          }\n\
-        }\n\
+      accum += 6;\n\
+      if (child->struct_element->num_children == 0)\n\
+        /* Childless elements are all the same size and can't be\n\
+           malformed, so there's nothing to walk */\n\
+        accum += (haris_uint64_t)list_info->len *\n\
+                 (child->struct_element->fixed_size - 2);\n\
+      else if (list_info->len > 0) {\n\
+        child_ptr = list_info->ptr;\n\
+        elements = list_info->len;\n\
       }\n\
       break;\n\
     case HARIS_CHILD_STRUCT:\n\
-      substruct_info = (HarisSubstructInfo*)list_info;\n\
-      buf = (!substruct_info->has ? \n\
-             1 :\n\
-             haris_lib_size(substruct_info->ptr, child->struct_element,\n\
-                            depth + 1, out));\n\
-      if (buf == 0) return 0;\n\
-      else if ((accum += buf) > HARIS_MESSAGE_SIZE_LIMIT) {\n\
-        *out = HARIS_SIZE_ERROR;\n\
-        return 0;\n\
-      }\n\
+      accum += 2;\n\
+      child_ptr = ((HarisSubstructInfo*)list_info)->ptr;\n\
+      break;\n\
     case HARIS_CHILD_EMBEDDED_STRUCT:\n\
-      buf = (!*((char*)ptr + child->has_offset) ?\n\
-             1 :\n\
-             haris_lib_size((void*)list_info, child->struct_element,\n\
-                            depth + 1, out));\n\
-      if (buf == 0) return 0;\n\
-      else if ((accum += buf) > HARIS_MESSAGE_SIZE_LIMIT) {\n\
-        *out = HARIS_SIZE_ERROR;\n\
-        return 0;\n\
-      }\n\
+      accum += 2;\n\
+      child_ptr = (void*)list_info;\n\
     }\n\
+    if (!child_ptr) continue;\n\
+    if ((*out = haris_lib_push_frame(stack, &frame, depth, child_ptr,\n\
+                                     child->struct_element, 0, 0,\n\
+                                     elements - 1)) != HARIS_SUCCESS)\n\
+      return 0;\n\
+    frame->child = 0;\n\
+    accum += (haris_uint64_t)frame->info->body_size;\n\
   }\n\
-  return accum;\n\
-  StructureError:\n\
-  *out = HARIS_STRUCTURE_ERROR;\n\
-  return 0;\n\
 }\n\n");
   return CJOB_SUCCESS;
 }
@@ -746,7 +1211,7 @@ static CJobStatus write_core_size(CJob *job)
    defines a HarisBufferStream structure, in addition to a set of functions
    that allow an in-memory buffer to be reasoned about as if it were a stream.)
    As long as you expose this streaming functionality, and the functions
-   you pass in match the HarisStreamReader or HarisStreamWriter prototypes,
+   you pass in match the HarisSpanReader or HarisStreamWriter prototypes,
    your new protocol should snap into the generated codebase without an issue,
    and serialize and deserialize correctly as a matter of course.
 
@@ -761,21 +1226,35 @@ static CJobStatus write_core_size(CJob *job)
    - Next, define the reading and writing functions that the library will
      use to read bytes from and write bytes to the stream. These functions
      are expected to work as follows:
-     HarisStreamReader: Read n bytes from the stream, and copy into the 
-     out parameter a pointer to a buffer (n bytes long) that contains the
-     bytes that were read from the stream. The caller does not need to free
-     the pointer (that is, it is managed by the stream interface). The pointer
-     is assumed to be valid until the next call to the reader function, at 
-     which point the pointer immediately becomes invalid. For this reason,
-     the same buffer can be used for all calls. 1000 is the maximum number of
-     bytes that a stream reader needs to support.
+     HarisSpanReader(stream, unit, count, dest, got): Read between 1 and
+     `count` units of `unit` bytes each from the stream, write the number
+     of units read to the `got` out parameter, and copy into the `dest`
+     out parameter a pointer to a contiguous buffer that holds them. The
+     reader should return as many units as it can cheaply provide; a
+     stream over memory can return all of them at once, without copying. The caller does not need to free the pointer
+     (that is, it is managed by the stream interface). The pointer is 
+     assumed to be valid until the next call to the reader function, at 
+     which point the pointer immediately becomes invalid. `unit` is never
+     0 and never larger than 256 bytes, so a stream with a scratch buffer
+     of that size can always return at least one unit.
+     If `dest` is NULL, the caller is skipping over data it doesn't
+     understand (children added by a newer version of the schema) and
+     will never look at the units. The reader must still consume them
+     and report how many through `got`, but it's free to do so without
+     copying anything: seek past them, or bump a pointer. A reader that
+     doesn't care can read into its scratch buffer as usual, so long as
+     it doesn't write through `dest`.
      HarisStreamWriter: Write n bytes from the given buffer onto the stream.
-     Again, only writes of size 1000 need be supported.
+     Writes of any size must be supported. Writes of more than 255 bytes
+     are always list payloads taken straight from the structure being
+     encoded, so a writer may keep a pointer to them rather than copying
+     them, as long as it's done with them by the time the encoder returns;
+     smaller writes may come from scratch space and must be copied.
 
      Both of these functions should return HARIS_SUCCESS if everything went
      well, and another error code otherwise. A success code should indicate
      the read or write was entirely successful (that is, all n bytes were
-     written or read).  
+     written, or at least one whole unit was read).  
 
      Furthermore, these functions are expected to do error checking. The
      core library does not assure the messages do not get too large; the
@@ -787,229 +1266,286 @@ static CJobStatus write_core_size(CJob *job)
      you'd like to perform. You're all done.
 */
 
+/* Skipping a child we don't know about is the same as decoding it into a
+   structure we know nothing about: the decoder is handed an imaginary
+   parent with an empty body and one child, and a NULL structure info,
+   which makes it read and throw away everything in its path. The general
+   decoder does this on its own stack, so only the specialized decoders
+   need handle_child. */
 static CJobStatus write_general_child_handler(CJob *job)
 {
-  CJOB_FMT_PRIV_FUNCTION(job,
-"static HarisStatus handle_child(void *stream, HarisStreamReader reader,\n\
-                                int depth)\n\
-{\n\
-  HarisStatus result;\n\
-  unsigned char first_byte_of_header;\n\
-  const unsigned char *read_buffer;\n\
-  HARIS_ASSERT(depth <= HARIS_DEPTH_LIMIT, DEPTH);\n\
-  if ((result = reader(stream, 1, &read_buffer)) != HARIS_SUCCESS) \n\
-    return result;\n\
-  first_byte_of_header = *read_buffer;\n\
-  if (!first_byte_of_header) return HARIS_SUCCESS; /* test for null */\n\
-  if ((first_byte_of_header & 0xC0) == 0x40) { /* structure child */\n\
-    int num_children, body_size;\n\
-    if ((result = reader(stream, 1, &read_buffer)) != HARIS_SUCCESS) \n\
-      return result;\n\
-    num_children = first_byte_of_header & 0x3F;\n\
-    body_size = *read_buffer;\n\
-    return handle_child_struct_posthead(stream, reader, depth, \n\
-                                        num_children, body_size);\n\
-  } else if ((first_byte_of_header & 0xC0) == 0x80) { /* scalar list */\n\
-    haris_uint32_t len, msg_size, array_size;\n\
-    if ((result = reader(stream, 3, &read_buffer)) != HARIS_SUCCESS)\n\
-      return result;\n\
-    msg_size = haris_lib_message_size_from_bit_pattern[first_byte_of_header\n\
-                                                       & 0x3];\n\
-    haris_read_uint24(read_buffer, &len);\n\
-    array_size = msg_size * len;\n\
-    while (array_size > 0) { \n\
-      haris_uint32_t read_size = (array_size <= 256 ? array_size : 256);\n\
-      if ((result = reader(stream, read_size, &read_buffer)) != HARIS_SUCCESS)\n\
-        return result;\n\
-      array_size -= read_size;\n\
-    }\n\
-    return HARIS_SUCCESS;\n\
-  } else { /* structure list */\n\
-    haris_uint32_t x, len;\n\
-    int num_children, body_size;\n\
-    if ((result = reader(stream, 5, &read_buffer)) != HARIS_SUCCESS)\n\
-      return result;\n\
-    haris_read_uint24(read_buffer, &len);\n\
-    num_children = read_buffer[3] & 0x3F;\n\
-    body_size = read_buffer[4];\n\
-    for (x = 0; x < len; x++)\n\
-      if ((result = handle_child_struct_posthead(stream, reader, depth,\n\
-                                                 num_children, \n\
-                                                 body_size)) != HARIS_SUCCESS)\n\
-        return result;\n\
-    return HARIS_SUCCESS;\n\
-  }\n}\n\n");
+  if (!job->optimizations.specialize) return CJOB_SUCCESS;
   CJOB_FMT_PRIV_FUNCTION(job, 
-"static HarisStatus handle_child_struct_posthead(void *stream,\n\
-                                                HarisStreamReader reader,\n\
-                                                int depth,\n\
-                                                int num_children,\n\
-                                                int body_size)\n\
+"static HarisStatus handle_child(void *stream, HarisSpanReader reader,\n\
+                                int depth)\n\
 {\n\
-  HarisStatus result;\n\
-  int i;\n\
-  const unsigned char *read_buffer;\n\
-  HARIS_ASSERT(depth <= HARIS_DEPTH_LIMIT, DEPTH);\n\
-  if ((result = reader(stream, (haris_uint32_t)body_size, &read_buffer)) \n\
-      != HARIS_SUCCESS)\n\
-    return result;\n\
-  for (i = 0; i < num_children; i++)\n\
-    if ((result = handle_child(stream, reader, depth + 1)) != HARIS_SUCCESS)\n\
-      return result;\n\
-  return HARIS_SUCCESS;\n\
+  return _haris_from_stream_posthead(NULL, NULL, stream, reader, NULL,\n\
+                                     depth - 1, 1, 0, HARIS_ALL_FIELDS);\n\
 }\n\n");
   return CJOB_SUCCESS;
 }
 
+/* The decoder fills in only those children of the top-level structure
+   whose bits are set in `fields`. The rest are skipped over in the 
+   stream and marked absent, as if they had been null, without touching
+   any memory they might already own. Nested structures are always
+   decoded in full.
+
+   A frame whose `info` is NULL is a structure that is being skipped;
+   so are the children of known structures beyond those in the schema.
+   Lists of unknown scalars or childless structures are skipped in a 
+   single call to haris_lib_skip. */
 static CJobStatus write_from_stream_funcs(CJob *job)
 {
   CJOB_FMT_PRIV_FUNCTION(job, 
 "static HarisStatus _haris_from_stream(void *ptr,\n\
                                      const HarisStructureInfo *info,\n\
                                      void *stream,\n\
-                                     HarisStreamReader reader,\n\
-                                     int depth)\n\
+                                     HarisSpanReader reader,\n\
+                                     HarisArena *arena, int depth)\n\
+{\n\
+  return _haris_from_stream_projected(ptr, info, stream, reader, arena,\n\
+                                      depth, HARIS_ALL_FIELDS);\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job, 
+"static HarisStatus _haris_from_stream_projected(void *ptr,\n\
+                                               const HarisStructureInfo *info,\n\
+                                               void *stream,\n\
+                                               HarisSpanReader reader,\n\
+                                               HarisArena *arena, int depth,\n\
+                                               haris_uint64_t fields)\n\
 {\n\
   HarisStatus result;\n\
   int num_children, body_size;\n\
   const unsigned char *read_buffer;\n\
   unsigned char first_byte_of_header;\n\
   HARIS_ASSERT(depth <= HARIS_DEPTH_LIMIT, DEPTH);\n\
-  if ((result = reader(stream, 1, &read_buffer)) != HARIS_SUCCESS) \n\
+  if ((result = haris_lib_read(stream, reader, 1, &read_buffer))\n\
+      != HARIS_SUCCESS)\n\
     return result;\n\
   first_byte_of_header = *read_buffer;\n\
   HARIS_ASSERT(first_byte_of_header && !(first_byte_of_header & 0x80), \n\
                STRUCTURE); /* check this isn't null and this isn't a list */\n\
-  if ((result = reader(stream, 1, &read_buffer)) != HARIS_SUCCESS) \n\
+  if ((result = haris_lib_read(stream, reader, 1, &read_buffer))\n\
+      != HARIS_SUCCESS)\n\
     return result;\n\
   num_children = first_byte_of_header & 0x3F;\n\
   body_size = *read_buffer;\n\
-  HARIS_ASSERT(body_size >= info->body_size &&\n\
-               num_children >= info->num_children, STRUCTURE);\n\
-  return _haris_from_stream_posthead(ptr, info, stream, reader, depth, \n\
-                                    num_children, body_size);\n\
+  return _haris_from_stream_posthead(ptr, info, stream, reader, arena,\n\
+                                    depth, num_children, body_size,\n\
+                                    fields);\n\
 }\n\n");
-  CJOB_FMT_PRIV_FUNCTION(job, "%s%s",
+  CJOB_FMT_PRIV_FUNCTION(job, "%s%s%s%s%s%s%s%s",
 "static HarisStatus _haris_from_stream_posthead(void *ptr,\n\
                                               const HarisStructureInfo *info,\n\
                                               void *stream, \n\
-                                              HarisStreamReader reader,\n\
+                                              HarisSpanReader reader,\n\
+                                              HarisArena *arena,\n\
                                               int depth, int num_children,\n\
-                                              int body_size)\n\
+                                              int body_size,\n\
+                                              haris_uint64_t fields)\n\
 {\n\
+  HarisFrame stack[HARIS_DEPTH_LIMIT + 1], *frame = stack;\n\
   HarisStatus result;\n\
-  int i;\n\
+  int field;\n\
   const HarisChild *child;\n\
+  const HarisStructureInfo *element;\n\
   HarisListInfo *list_info;\n\
-  const unsigned char *body, *read_buffer;\n\
+  const unsigned char *read_buffer;\n\
   unsigned char first_byte_of_child_header;\n\
-  HARIS_ASSERT(depth <= HARIS_DEPTH_LIMIT, DEPTH);\n\
-  if ((result = reader(stream, (haris_uint32_t)body_size, &body)) \n\
-      != HARIS_SUCCESS)\n\
-    return result;\n\
-  haris_lib_read_body(ptr, info, body);\n\
-  for (i = 0; i < info->num_children; i ++) {\n\
-    child = &info->children[i];\n\
-    list_info = (HarisListInfo*)((char*)ptr + child->offset);\n\
-    if ((result = reader(stream, 1, &read_buffer)) != HARIS_SUCCESS) \n\
+  void *child_ptr;\n\
+  haris_uint32_t len;\n",
+  (job->optimizations.specialize ?
+"  if (info && info->decode_body && fields == HARIS_ALL_FIELDS)\n\
+    return info->decode_body(ptr, stream, reader, arena, depth,\n\
+                             num_children, body_size);\n" : ""),
+"  HARIS_ASSERT(depth <= HARIS_DEPTH_LIMIT, DEPTH);\n\
+  frame->ptr = ptr;\n\
+  frame->info = info;\n\
+  frame->num_children = num_children;\n\
+  frame->body_size = body_size;\n\
+  frame->child = -1;\n\
+  frame->elements_left = 0;\n\
+  for (;;) {\n\
+    if (frame->child < 0) { /* the body comes first */\n\
+      frame->child = 0;\n\
+      if (!frame->info) {\n\
+        if (frame->body_size > 0 &&\n\
+            (result = haris_lib_skip(stream, reader,\n\
+                                     (haris_uint32_t)frame->body_size, 1))\n\
+            != HARIS_SUCCESS)\n\
+          return result;\n\
+        continue;\n\
+      }\n\
+      HARIS_ASSERT(frame->body_size >= frame->info->body_size &&\n\
+                   frame->num_children >= frame->info->num_children,\n\
+                   STRUCTURE);\n\
+      if ((result = haris_lib_read(stream, reader,\n\
+                                   (haris_uint32_t)frame->body_size,\n\
+                                   &read_buffer)) != HARIS_SUCCESS)\n\
+        return result;\n\
+      haris_lib_read_body(frame->ptr, frame->info, read_buffer);\n\
+      continue;\n\
+    }\n\
+    if (frame->child == frame->num_children) {\n\
+      if (frame->elements_left > 0) { /* on to the next element */\n\
+        frame->elements_left --;\n\
+        if (frame->info)\n\
+          frame->ptr = (char*)frame->ptr + frame->info->size_of;\n\
+        frame->child = -1;\n\
+      } else if (frame == stack) {\n\
+        return HARIS_SUCCESS;\n\
+      } else {\n\
+        frame --;\n\
+      }\n\
+      continue;\n\
+    }\n\
+    field = frame->child ++;\n\
+    child = (frame->info && field < frame->info->num_children ?\n\
+             &frame->info->children[field] : NULL);\n\
+    if (child && frame == stack && !((fields >> field) & 1)) {\n\
+      /* not selected: absent, and skipped like an unknown child */\n\
+      haris_lib_mark_absent(frame->ptr, child);\n\
+      child = NULL;\n\
+    }\n\
+    list_info = (child ? \n\
+                 (HarisListInfo*)((char*)frame->ptr + child->offset) : NULL);\n\
+    element = (child ? child->struct_element : NULL);\n\
+    if ((result = haris_lib_read(stream, reader, 1, &read_buffer))\n\
+        != HARIS_SUCCESS)\n\
       return result;\n\
     first_byte_of_child_header = *read_buffer;\n\
-    if (!first_byte_of_child_header) { /* check whether child is null */\n\
-      HARIS_ASSERT(child->nullable, STRUCTURE);\n\
-      switch (child->child_type) {\n\
-      case HARIS_CHILD_TEXT:\n\
-      case HARIS_CHILD_SCALAR_LIST:\n\
-      case HARIS_CHILD_STRUCT_LIST:\n\
-        list_info->has = 0;\n\
-        break;\n\
-      case HARIS_CHILD_STRUCT:\n\
-        ((HarisSubstructInfo*)list_info)->has = 0;\n\
-        break;\n\
-      case HARIS_CHILD_EMBEDDED_STRUCT:\n\
-        *((char*)ptr + child->has_offset) = 0;\n\
+    if (!first_byte_of_child_header) { /* null */\n\
+      if (child) {\n\
+        HARIS_ASSERT(child->nullable, STRUCTURE);\n\
+        haris_lib_mark_absent(frame->ptr, child);\n\
       }\n\
       continue;\n\
-    }\n\
-    switch (child->child_type) {\n\
-    case HARIS_CHILD_TEXT:\n\
-    case HARIS_CHILD_SCALAR_LIST:\n\
-    {\n\
-      haris_uint32_t len, msg_size, mem_size, bit_pattern, j;\n\
+    }\n",
+"    if ((first_byte_of_child_header & 0xC0) == 0x40) { /* structure */\n\
+      int child_children = first_byte_of_child_header & 0x3F, child_body;\n\
+      if ((result = haris_lib_read(stream, reader, 1, &read_buffer))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      child_body = *read_buffer;\n\
+      child_ptr = NULL;\n\
+      if (child && child->child_type == HARIS_CHILD_STRUCT) {\n\
+        if ((result = haris_lib_reserve_struct_mem(frame->ptr, frame->info,\n\
+                                                   field, arena))\n\
+             != HARIS_SUCCESS)\n\
+          return result;\n\
+        child_ptr = ((HarisSubstructInfo*)list_info)->ptr;\n\
+      } else if (child) {\n\
+        HARIS_ASSERT(child->child_type == HARIS_CHILD_EMBEDDED_STRUCT,\n\
+                     STRUCTURE);\n\
+        *((char*)frame->ptr + child->has_offset) = 1;\n\
+        child_ptr = (void*)list_info;\n\
+      }\n",
+  (job->optimizations.specialize ?
+"      if (element && element->decode_body) {\n\
+        if ((result = element->decode_body(child_ptr, stream, reader, arena,\n\
+                                           depth + (int)(frame - stack) + 1,\n\
+                                           child_children, child_body))\n\
+            != HARIS_SUCCESS)\n\
+          return result;\n\
+        continue;\n\
+      }\n" : ""),
+"      if ((result = haris_lib_push_frame(stack, &frame, depth, child_ptr,\n\
+                                         element, child_children,\n\
+                                         child_body, 0)) != HARIS_SUCCESS)\n\
+        return result;\n\
+    } else if ((first_byte_of_child_header & 0xC0) == 0x80) { /* scalars */\n\
+      haris_uint32_t msg_size, mem_size, j, k, got;\n\
       char *in_mem_element_pointer;\n\
-      if ((result = reader(stream, 3, &read_buffer)) != HARIS_SUCCESS)\n\
+      if ((result = haris_lib_read(stream, reader, 3, &read_buffer))\n\
+          != HARIS_SUCCESS)\n\
         return result;\n\
+      haris_read_uint24(read_buffer, &len);\n\
+      if (!child) {\n\
+        msg_size = haris_lib_message_size_from_bit_pattern\n\
+          [first_byte_of_child_header & 0x3];\n\
+        if ((result = haris_lib_skip(stream, reader, msg_size, len))\n\
+            != HARIS_SUCCESS)\n\
+          return result;\n\
+        continue;\n\
+      }\n\
+      HARIS_ASSERT((child->child_type == HARIS_CHILD_TEXT ||\n\
+                    child->child_type == HARIS_CHILD_SCALAR_LIST) &&\n\
+                   first_byte_of_child_header == (0x80 | \n\
+                     haris_lib_scalar_bit_patterns[child->scalar_element]),\n\
+                   STRUCTURE);\n\
       msg_size = haris_lib_message_scalar_sizes[child->scalar_element];\n\
       mem_size = haris_lib_in_memory_scalar_sizes[child->scalar_element];\n\
-      bit_pattern = haris_lib_scalar_bit_patterns[child->scalar_element];\n\
-      HARIS_ASSERT(first_byte_of_child_header == (0x80 | bit_pattern),\n\
-                   STRUCTURE);\n\
-      haris_read_uint24(read_buffer, &len);\n\
-      if ((result = _haris_lib_init_list_mem(ptr, info, i, len))\n\
+      if ((result = haris_lib_reserve_list_mem(frame->ptr, frame->info,\n\
+                                               field, len, arena))\n\
            != HARIS_SUCCESS)\n\
         return result;\n\
-      for (j = 0,  in_mem_element_pointer = (char*)list_info->ptr; \n\
-           j < len; \n\
-           j ++,   in_mem_element_pointer += mem_size) {\n\
-        /* This reads one element from the message at a time into the buffer;\n\
-           in the future, batching reads will be an easy optimization */\n\
-        if ((result = reader(stream, msg_size, &read_buffer)) != HARIS_SUCCESS)\n\
+      if (haris_lib_bulk_scalars[child->scalar_element]) {\n\
+        if ((result = haris_lib_read_bulk(stream, reader, list_info->ptr,\n\
+                                          len * msg_size)) != HARIS_SUCCESS)\n\
           return result;\n\
-        haris_lib_read_scalar(read_buffer, (void*)in_mem_element_pointer,\n\
-                              child->scalar_element);\n\
+        continue;\n\
       }\n\
-      break;\n\
-    }\n",
-"    case HARIS_CHILD_STRUCT_LIST:\n\
-    {\n\
-      haris_uint32_t len, j;\n\
-      char *in_mem_element_pointer;\n\
-      int num_children, body_size;\n\
-      if ((result = reader(stream, 5, &read_buffer)) != HARIS_SUCCESS)\n\
-        return result;\n\
-      HARIS_ASSERT(first_byte_of_child_header == 0xC0, STRUCTURE);\n\
-      haris_read_uint24(read_buffer, &len);\n\
-      if ((result = _haris_lib_init_list_mem(ptr, info, i, len))\n\
-           != HARIS_SUCCESS)\n\
-        return result;\n\
-      HARIS_ASSERT((read_buffer[3] & 0xC0) == 0x40, STRUCTURE);\n\
-      num_children = read_buffer[3] & 0x3F;\n\
-      body_size = read_buffer[4];\n\
       for (j = 0,  in_mem_element_pointer = (char*)list_info->ptr; \n\
            j < len; \n\
-           j ++,   in_mem_element_pointer += child->struct_element->size_of) {\n\
-        if ((result = _haris_from_stream_posthead(in_mem_element_pointer, \n\
-                                                  child->struct_element, \n\
-                                                  stream, reader, depth + 1, \n\
-                                                  num_children, \n\
-                                                  body_size)) != HARIS_SUCCESS)\n\
+           j += got) {\n\
+        if ((result = reader(stream, msg_size, len - j, &read_buffer, &got))\n\
+            != HARIS_SUCCESS)\n\
           return result;\n\
+        for (k = 0; k < got; k ++,   read_buffer += msg_size,\n\
+                                     in_mem_element_pointer += mem_size)\n\
+          haris_lib_read_scalar(read_buffer, (void*)in_mem_element_pointer,\n\
+                                child->scalar_element);\n\
       }\n\
-      break;\n\
-    }\n\
-    case HARIS_CHILD_STRUCT:\n\
-      if ((result = _haris_lib_init_struct_mem(ptr, info, i))\n\
-           != HARIS_SUCCESS)\n\
-        return result;\n\
-      if ((result = _haris_from_stream(((HarisSubstructInfo*)list_info)->ptr,\n\
-                                      child->struct_element, \n\
-                                      stream, reader, depth + 1)) \n\
+    } else { /* list of structures */\n\
+      int element_children, element_body;\n\
+      if ((result = haris_lib_read(stream, reader, 5, &read_buffer))\n\
           != HARIS_SUCCESS)\n\
         return result;\n\
-      break;\n\
-    case HARIS_CHILD_EMBEDDED_STRUCT:\n\
-      if ((result = _haris_from_stream((void*)list_info,\n\
-                                       child->struct_element,\n\
-                                       stream, reader, depth + 1))\n\
+      haris_read_uint24(read_buffer, &len);\n\
+      element_children = read_buffer[3] & 0x3F;\n\
+      element_body = read_buffer[4];\n\
+      child_ptr = NULL;\n\
+      if (child) {\n\
+        HARIS_ASSERT(child->child_type == HARIS_CHILD_STRUCT_LIST &&\n\
+                     first_byte_of_child_header == 0xC0 &&\n\
+                     (read_buffer[3] & 0xC0) == 0x40, STRUCTURE);\n\
+        if ((result = haris_lib_reserve_list_mem(frame->ptr, frame->info,\n\
+                                                 field, len, arena))\n\
+             != HARIS_SUCCESS)\n\
+          return result;\n\
+        child_ptr = list_info->ptr;\n\
+      } else if (element_children == 0) {\n\
+        /* Elements without children are laid out back to back */\n\
+        if (element_body > 0 &&\n\
+            (result = haris_lib_skip(stream, reader,\n\
+                                     (haris_uint32_t)element_body, len))\n\
+            != HARIS_SUCCESS)\n\
+          return result;\n\
+        continue;\n\
+      }\n\
+      if (len == 0) continue;\n",
+  (job->optimizations.specialize ?
+"      if (element && element->decode_body) {\n\
+        haris_uint32_t j;\n\
+        for (j = 0; j < len; j ++)\n\
+          if ((result = element->decode_body((char*)child_ptr +\n\
+                                             j * element->size_of,\n\
+                                             stream, reader, arena,\n\
+                                             depth + (int)(frame - stack) + 1,\n\
+                                             element_children, element_body))\n\
+              != HARIS_SUCCESS)\n\
+            return result;\n\
+        continue;\n\
+      }\n" : ""),
+"      if ((result = haris_lib_push_frame(stack, &frame, depth, child_ptr,\n\
+                                         element, element_children,\n\
+                                         element_body, len - 1))\n\
           != HARIS_SUCCESS)\n\
         return result;\n\
-      break;\n\
     }\n\
   }\n\
-  for (; i < num_children; i ++) {\n\
-    if ((result = handle_child(stream, reader, depth + 1)) != HARIS_SUCCESS)\n\
-      return result;\n\
-  }\n\
-  return HARIS_SUCCESS;\n}\n\n");
+}\n\n");
   return CJOB_SUCCESS;
 }
 
@@ -1019,50 +1555,77 @@ static CJobStatus write_to_stream_funcs(CJob *job)
 "static HarisStatus _haris_to_stream(void *ptr,\n\
                                    const HarisStructureInfo *info, \n\
                                    void *stream,\n\
-                                   HarisStreamWriter writer)\n\
+                                   HarisStreamWriter writer, int depth)\n\
 {\n\
   HarisStatus result;\n\
   unsigned char header[2];\n\
   haris_lib_write_nonnull_header(info, header);\n\
   if ((result = writer(stream, header, 2)) != HARIS_SUCCESS) return result;\n\
-  return _haris_to_stream_posthead(ptr, info, stream, writer);\n}\n\n");
-  CJOB_FMT_PRIV_FUNCTION(job,
+  return _haris_to_stream_posthead(ptr, info, stream, writer, depth);\n}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job, "%s%s%s%s",
 "static HarisStatus _haris_to_stream_posthead(void *ptr, \n\
                                             const HarisStructureInfo *info, \n\
                                             void *stream,\n\
-                                            HarisStreamWriter writer)\n\
+                                            HarisStreamWriter writer,\n\
+                                            int depth)\n\
 {\n\
-  int i;\n\
+  HarisFrame stack[HARIS_DEPTH_LIMIT + 1], *frame = stack;\n\
   const HarisChild *child;\n\
   HarisListInfo *list_info;\n\
   HarisStatus result;\n\
   unsigned char body[256], child_header[6];\n\
-  if ((result = writer(stream, body,\n\
-                       haris_lib_write_body(ptr, info, body) - body))\n\
-      != HARIS_SUCCESS)\n\
-    return result;\n\
-  for (i = 0; i < info->num_children; i ++) {\n\
-    child = &info->children[i];\n\
-    list_info = (HarisListInfo*)((char*)ptr + child->offset);\n\
-    switch (child->child_type) {\n\
-    case HARIS_CHILD_TEXT:\n\
-    case HARIS_CHILD_SCALAR_LIST:\n\
-    case HARIS_CHILD_STRUCT_LIST:\n\
-      if (!list_info->has) {\n\
-        goto WriteNull;\n\
+  void *child_ptr;\n\
+  int present;\n",
+  (job->optimizations.specialize ?
+"  if (info->encode_body)\n\
+    return info->encode_body(ptr, stream, writer, depth);\n" : ""),
+"  HARIS_ASSERT(depth <= HARIS_DEPTH_LIMIT, DEPTH);\n\
+  frame->ptr = ptr;\n\
+  frame->info = info;\n\
+  frame->child = -1;\n\
+  frame->elements_left = 0;\n\
+  for (;;) {\n\
+    if (frame->child < 0) { /* the body comes first */\n\
+      frame->child = 0;\n\
+      if ((result = writer(stream, body,\n\
+                           haris_lib_write_body(frame->ptr, frame->info,\n\
+                                                body) - body))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      continue;\n\
+    }\n\
+    if (frame->child == frame->info->num_children) {\n\
+      if (frame->elements_left > 0) { /* on to the next element */\n\
+        frame->elements_left --;\n\
+        frame->ptr = (char*)frame->ptr + frame->info->size_of;\n\
+        frame->child = -1;\n\
+      } else if (frame == stack) {\n\
+        return HARIS_SUCCESS;\n\
+      } else {\n\
+        frame --;\n\
       }\n\
-      break;\n\
+      continue;\n\
+    }\n\
+    child = &frame->info->children[frame->child ++];\n\
+    list_info = (HarisListInfo*)((char*)frame->ptr + child->offset);\n\
+    switch (child->child_type) {\n\
     case HARIS_CHILD_STRUCT:\n\
-      if (!((HarisSubstructInfo*)list_info)->has) {\n\
-        goto WriteNull;\n\
-      }\n\
+      present = ((HarisSubstructInfo*)list_info)->has;\n\
       break;\n\
     case HARIS_CHILD_EMBEDDED_STRUCT:\n\
-      if (!*((char*)ptr + child->has_offset)) {\n\
-        goto WriteNull;\n\
-      }\n\
+      present = *((char*)frame->ptr + child->has_offset);\n\
       break;\n\
+    default:\n\
+      present = list_info->has;\n\
     }\n\
+    if (!present) {\n\
+      HARIS_ASSERT(child->nullable, STRUCTURE);\n\
+      child_header[0] = 0x0;\n\
+      if ((result = writer(stream, child_header, 1)) != HARIS_SUCCESS)\n\
+        return result;\n\
+      continue;\n\
+    }\n",
+"    child_ptr = NULL;\n\
     switch (child->child_type) {\n\
     case HARIS_CHILD_TEXT:\n\
     case HARIS_CHILD_SCALAR_LIST:\n\
@@ -1077,11 +1640,16 @@ static CJobStatus write_to_stream_funcs(CJob *job)
       haris_write_uint24(child_header + 1, &list_info->len);\n\
       if ((result = writer(stream, child_header, 4)) != HARIS_SUCCESS)\n\
         return result;\n\
+      if (haris_lib_bulk_scalars[child->scalar_element]) {\n\
+        if ((result = haris_lib_write_bulk(stream, writer, list_info->ptr,\n\
+                                           list_info->len * msg_size))\n\
+            != HARIS_SUCCESS)\n\
+          return result;\n\
+        break;\n\
+      }\n\
       for (j = 0,             in_mem_element_pointer = (char*)list_info->ptr;\n\
            j < list_info->len; \n\
            j ++,              in_mem_element_pointer += mem_size) {\n\
-        /* As above, we can easily optimize this to batch writes to the \n\
-           stream */\n\
         haris_lib_write_scalar(buffer, in_mem_element_pointer,\n\
                                child->scalar_element);\n\
         if ((result = writer(stream, buffer, msg_size)) != HARIS_SUCCESS)\n\
@@ -1090,48 +1658,588 @@ static CJobStatus write_to_stream_funcs(CJob *job)
       break;\n\
     }\n\
     case HARIS_CHILD_STRUCT_LIST:\n\
-    {\n\
-      char *in_mem_element_pointer;\n\
-      haris_uint32_t j;\n\
       child_header[0] = 0xC0;\n\
       haris_write_uint24(child_header + 1, &list_info->len);\n\
       (void)haris_lib_write_nonnull_header(child->struct_element, \n\
                                            child_header + 4);\n\
       if ((result = writer(stream, child_header, 6)) != HARIS_SUCCESS)\n\
         return result;\n\
-      for (j = 0, in_mem_element_pointer = (char*)list_info->ptr; \n\
-           j < list_info->len; \n\
-           j ++, in_mem_element_pointer += child->struct_element->size_of) {\n\
-        if ((result = _haris_to_stream_posthead(in_mem_element_pointer,\n\
-                                               child->struct_element, \n\
-                                               stream, writer)) \n\
-            != HARIS_SUCCESS)\n\
-          return result;\n\
-      }\n\
+      if (list_info->len > 0) child_ptr = list_info->ptr;\n\
       break;\n\
-    }\n\
     case HARIS_CHILD_STRUCT:\n\
-      if ((result = _haris_to_stream(((HarisSubstructInfo*)list_info)->ptr,\n\
-                                    child->struct_element, \n\
-                                    stream, writer)) != HARIS_SUCCESS)\n\
-        return result;\n\
-      break;\n\
     case HARIS_CHILD_EMBEDDED_STRUCT:\n\
-      if ((result = _haris_to_stream((void*)list_info,\n\
-                                     child->struct_element,\n\
-                                     stream, writer)) != HARIS_SUCCESS)\n\
+      (void)haris_lib_write_nonnull_header(child->struct_element,\n\
+                                           child_header);\n\
+      if ((result = writer(stream, child_header, 2)) != HARIS_SUCCESS)\n\
         return result;\n\
-      break;\n\
+      child_ptr = (child->child_type == HARIS_CHILD_STRUCT ?\n\
+                   ((HarisSubstructInfo*)list_info)->ptr : (void*)list_info);\n\
     }\n\
-    continue;\n\
-   WriteNull:\n\
-    child_header[0] = 0x0;\n\
-    if ((result = writer(stream, child_header, 1)) != HARIS_SUCCESS)\n\
+    if (child_ptr &&\n\
+        (result = haris_lib_push_frame(stack, &frame, depth, child_ptr,\n\
+                                       child->struct_element, 0, 0,\n\
+                                       (child->child_type ==\n\
+                                        HARIS_CHILD_STRUCT_LIST ?\n\
+                                        list_info->len - 1 : 0)))\n\
+        != HARIS_SUCCESS)\n\
       return result;\n\
-    continue;\n\
   }\n\
-  return HARIS_SUCCESS;\n\
 }\n\n");
   return CJOB_SUCCESS;
 }
 
+/* ********* MESSAGE STREAMS ********* */
+
+/* A message stream reads a sequence of messages of the same type out of
+   one of the protocol streams, decoding every one into the same structure:
+
+   HarisStatus S_stream_next(HarisMessageStream *, S *reuse, 
+                             haris_uint32_t *out_sz);
+
+   Each protocol library that can be read in sequence provides a 
+   haris_stream_open_X function that fills in a HarisMessageStream with 
+   the protocol stream, the function that decodes its next message and the
+   function that tells whether there is another message at all.
+   Since the decoders never give list memory back, the structure stops
+   allocating once it has seen the largest message in the sequence.
+
+   int haris_stream_at_end(HarisMessageStream *);
+
+   ... returns 1 when the input ends exactly where the last message did. A
+   stream that isn't at its end but can't produce a whole message makes
+   S_stream_next return HARIS_INPUT_ERROR, so a truncated last message
+   isn't mistaken for the end of the stream. Checking may have to wait for
+   more input, but consumes none of it.
+*/
+static CJobStatus write_message_stream_funcs(CJob *job)
+{
+  int i;
+  const char *prefix = job->prefix, *name;
+  CJOB_FMT_HEADER_STRING(job,
+"typedef HarisStatus (*HarisMessageReader)(void *, \n\
+                                          const HarisStructureInfo *,\n\
+                                          void *, haris_uint32_t *);\n\n\
+typedef struct {\n\
+  void *stream;\n\
+  HarisMessageReader next;\n\
+  int (*at_end)(void *);\n\
+} HarisMessageStream;\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"int haris_stream_at_end(HarisMessageStream *stream)\n\
+{\n\
+  return stream->at_end(stream->stream);\n\
+}\n\n");
+  for (i = 0; i < job->schema->num_structs; i ++) {
+    name = job->schema->structs[i].name;
+    CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_stream_next(HarisMessageStream *stream, %s%s *reuse,\n\
+                             haris_uint32_t *out_sz)\n\
+{\n\
+  return stream->next(reuse, &haris_lib_structures[%d], stream->stream,\n\
+                      out_sz);\n}\n\n",
+                          prefix, name, prefix, name, 
+                          job->schema->structs[i].schema_index);
+  }
+  return CJOB_SUCCESS;
+}
+
+/* ********* PRODUCED LISTS ********* */
+
+/* A list of structures can be encoded straight out of a callback rather
+   than out of memory. For every structure S with a list of structures L,
+   whose elements are E, the file and fd protocols provide
+
+   HarisStatus S_to_file_producing_L(S *, haris_uint32_t count,
+                                     HarisStatus (*next_element)(void *,
+                                                                 E *),
+                                     void *ctx, FILE *, haris_uint32_t *);
+   HarisStatus S_to_fd_producing_L(S *, haris_uint32_t count, ...,
+                                   int, haris_uint32_t *);
+
+   ... which encode S, except that L holds `count` elements, each of which
+   is filled in by a call to `next_element` and encoded at once. The
+   scratch element is created before the first call and destroyed after
+   the last, and every call sees it as the previous one left it, so lists
+   in it can be reinitialized without allocating. Whatever L holds in S
+   itself is ignored. Only one element is ever in memory, but the size of
+   the message can't be known up front: an error from a callback or a
+   message that grows too large leaves a partial message on the stream.
+
+   The protocols pass in a `settle` function, called after each element is
+   written, that must finish with any pointers the writer kept into the
+   scratch element; it can be NULL if the writer never keeps any.
+*/
+static CJobStatus write_producer_funcs(CJob *job)
+{
+  CJobStatus result;
+  int i, j;
+  ParsedSchema *schema = job->schema;
+  if (!schema_has_struct_lists(schema)) return CJOB_SUCCESS;
+  /* The children on either side of the produced list are written by
+     walking a copy of the structure's info that has no body and holds only
+     those children */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static void haris_lib_slice_children(const HarisStructureInfo *info,\n\
+                                     int first, int last,\n\
+                                     HarisStructureInfo *out)\n\
+{\n\
+  *out = *info;\n\
+  out->num_scalars = 0;\n\
+  out->num_children = last - first;\n\
+  out->children = info->children + first;\n\
+  out->body_size = 0;\n\
+  out->fixed_size = 0;\n%s\
+}\n\n",
+                         (job->optimizations.specialize ?
+                          "  out->encode_body = NULL;\n" : ""));
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_produce_begin(void *ptr,\n\
+                                           const HarisStructureInfo *info,\n\
+                                           int field, haris_uint32_t count,\n\
+                                           void *stream,\n\
+                                           HarisStreamWriter writer,\n\
+                                           haris_uint64_t *size)\n\
+{\n\
+  HarisStructureInfo before, after;\n\
+  HarisStatus result;\n\
+  haris_uint32_t before_size, after_size;\n\
+  unsigned char header[6], body[256];\n\
+  HARIS_ASSERT(count <= 0xFFFFFF, SIZE);\n\
+  haris_lib_slice_children(info, 0, field, &before);\n\
+  haris_lib_slice_children(info, field + 1, info->num_children, &after);\n\
+  if ((before_size = haris_lib_size(ptr, &before, 0, &result)) == 0 ||\n\
+      (after_size = haris_lib_size(ptr, &after, 0, &result)) == 0)\n\
+    return result;\n\
+  /* The slices count a header of 2 bytes each; the structure's header\n\
+     and the list's take 8 between them */\n\
+  *size = (haris_uint64_t)before_size + after_size + 4 +\n\
+    (haris_uint64_t)info->body_size;\n\
+  HARIS_ASSERT(*size <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
+  haris_lib_write_nonnull_header(info, header);\n\
+  if ((result = writer(stream, header, 2)) != HARIS_SUCCESS ||\n\
+      (result = writer(stream, body,\n\
+                       haris_lib_write_body(ptr, info, body) - body))\n\
+      != HARIS_SUCCESS ||\n\
+      (result = _haris_to_stream_posthead(ptr, &before, stream, writer, 0))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n\
+  header[0] = 0xC0;\n\
+  haris_write_uint24(header + 1, &count);\n\
+  (void)haris_lib_write_nonnull_header(info->children[field].struct_element,\n\
+                                       header + 4);\n\
+  return writer(stream, header, 6);\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_produce_element(void *ptr,\n\
+                                             const HarisStructureInfo *info,\n\
+                                             void *stream,\n\
+                                             HarisStreamWriter writer,\n\
+                                             HarisStatus (*settle)(void *),\n\
+                                             haris_uint64_t *size)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t element_size = haris_lib_size(ptr, info, 1, &result);\n\
+  if (element_size == 0) return result;\n\
+  /* Elements share the list's header */\n\
+  *size += element_size - 2;\n\
+  HARIS_ASSERT(*size <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
+  if ((result = _haris_to_stream_posthead(ptr, info, stream, writer, 1))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n\
+  return (settle ? settle(stream) : HARIS_SUCCESS);\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_produce_end(void *ptr,\n\
+                                         const HarisStructureInfo *info,\n\
+                                         int field, void *stream,\n\
+                                         HarisStreamWriter writer)\n\
+{\n\
+  HarisStructureInfo after;\n\
+  haris_lib_slice_children(info, field + 1, info->num_children, &after);\n\
+  return _haris_to_stream_posthead(ptr, &after, stream, writer, 0);\n\
+}\n\n");
+  for (i = 0; i < schema->num_structs; i ++) {
+    ParsedStruct *strct = &schema->structs[i];
+    for (j = 0; j < strct->num_children; j ++) {
+      if (strct->children[j].tag == CHILD_STRUCT_LIST &&
+          (result = write_producer(job, strct, j)) != CJOB_SUCCESS)
+        return result;
+    }
+  }
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_producer(CJob *job, ParsedStruct *strct, int field)
+{
+  const char *prefix = job->prefix, *name = strct->name;
+  ParsedStruct *element = strct->children[field].type.struct_list;
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus %s%s_produce_%s(%s%s *strct, haris_uint32_t count,\n\
+                                   HarisStatus (*next_element)(void *,\n\
+                                                               %s%s *),\n\
+                                   void *ctx, void *stream,\n\
+                                   HarisStreamWriter writer,\n\
+                                   HarisStatus (*settle)(void *),\n\
+                                   haris_uint32_t *out_sz)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint64_t size = 0;\n\
+  haris_uint32_t j;\n\
+  %s%s *scratch = %s%s_create();\n\
+  if (!scratch) return HARIS_MEM_ERROR;\n\
+  if ((result = haris_lib_produce_begin(strct, &haris_lib_structures[%d],\n\
+                                        %d, count, stream, writer, &size))\n\
+      != HARIS_SUCCESS)\n\
+    goto Finish;\n\
+  for (j = 0; j < count; j ++) {\n\
+    if ((result = next_element(ctx, scratch)) != HARIS_SUCCESS ||\n\
+        (result = haris_lib_produce_element(scratch,\n\
+                                            &haris_lib_structures[%d],\n\
+                                            stream, writer, settle, &size))\n\
+        != HARIS_SUCCESS)\n\
+      goto Finish;\n\
+  }\n\
+  if ((result = haris_lib_produce_end(strct, &haris_lib_structures[%d], %d,\n\
+                                      stream, writer)) == HARIS_SUCCESS &&\n\
+      out_sz)\n\
+    *out_sz = (haris_uint32_t)size;\n\
+  Finish:\n\
+  %s%s_destroy(scratch);\n\
+  return result;\n\
+}\n\n",
+                         prefix, name, strct->children[field].name,
+                         prefix, name, prefix, element->name,
+                         prefix, element->name, prefix, element->name,
+                         strct->schema_index, field, element->schema_index,
+                         strct->schema_index, field,
+                         prefix, element->name);
+  return CJOB_SUCCESS;
+}
+
+/* ********* SPECIALIZED ENCODERS AND DECODERS ********* */
+
+/* With `-O specialize`, every structure S gets a pair of functions
+
+   static HarisStatus S_decode_body(void *, void *, HarisSpanReader,
+                                    HarisArena *, int, int, int);
+   static HarisStatus S_encode_body(void *, void *, HarisStreamWriter, int);
+
+   ... which have exactly the same contracts as _haris_from_stream_posthead
+   (with every field selected) and _haris_to_stream_posthead, respectively,
+   but which have the layout of S baked in: the offset and width of every
+   scalar and the kind of every child are constants, and children are
+   encoded and decoded by direct calls to their own specialized functions.
+   The general functions dispatch to these through the decode_body and
+   encode_body members of HarisStructureInfo, so the protocol libraries
+   are none the wiser.
+*/
+
+static CJobStatus write_specialized_funcs(CJob *job)
+{
+  CJobStatus result;
+  int i;
+  for (i = 0; i < job->schema->num_structs; i ++) {
+    if ((result = write_specialized_decoder(job, &job->schema->structs[i]))
+        != CJOB_SUCCESS ||
+        (result = write_specialized_encoder(job, &job->schema->structs[i]))
+        != CJOB_SUCCESS)
+      return result;
+  }
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_specialized_decoder(CJob *job, ParsedStruct *strct)
+{
+  int i;
+  const char *prefix = job->prefix, *name = strct->name;
+  char *func = strformat(
+"static HarisStatus %s%s_decode_body(void *ptr, void *stream,\n\
+                                     HarisSpanReader reader,\n\
+                                     HarisArena *arena, int depth,\n\
+                                     int num_children, int body_size)\n\
+{\n\
+  %s%s *strct = (%s%s*)ptr;\n\
+  HarisStatus result;\n\
+  const unsigned char *buf;\n\
+  int i;\n\
+  HARIS_ASSERT(depth <= HARIS_DEPTH_LIMIT, DEPTH);\n\
+  HARIS_ASSERT(body_size >= %d && num_children >= %d, STRUCTURE);\n\
+  if ((result = haris_lib_read(stream, reader, (haris_uint32_t)body_size,\n\
+                              &buf))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n",
+                         prefix, name, prefix, name, prefix, name,
+                         strct->offset, strct->num_children);
+  for (i = 0; i < strct->num_scalars; i ++)
+    func = strappend(func, "  haris_read_%s(buf + %d, &strct->%s);\n",
+                     scalar_function_suffix(strct->scalars[i].type.tag),
+                     strct->scalars[i].offset, strct->scalars[i].name);
+  /* A structure without children never needs to allocate */
+  if (strct->num_children == 0)
+    func = strappend(func, "  (void)arena;\n");
+  for (i = 0; i < strct->num_children; i ++)
+    func = append_specialized_child_decoder(func, job, strct, i);
+  func = strappend(func,
+"  for (i = %d; i < num_children; i ++)\n\
+    if ((result = handle_child(stream, reader, depth + 1)) != HARIS_SUCCESS)\n\
+      return result;\n\
+  return HARIS_SUCCESS;\n}\n\n", strct->num_children);
+  if (!func) return CJOB_MEM_ERROR;
+  return add_private_function(job, func);
+}
+
+/* Append the code that decodes the given child to the decoder. When this
+   code runs, the first byte of the child's header is in buf[0]. */
+static char *append_specialized_child_decoder(char *func, CJob *job,
+                                              ParsedStruct *strct, int field)
+{
+  const char *prefix = job->prefix;
+  ChildField *child = &strct->children[field];
+  const char *child_name = child->name;
+  func = strappend(func,
+"  /* %s */\n\
+  if ((result = haris_lib_read(stream, reader, 1, &buf)) != HARIS_SUCCESS)\n\
+    return result;\n", child_name);
+  /* A null header can never pass the header checks below, so non-nullable
+     children need no special test for null */
+  if (child->nullable)
+    func = strappend(func,
+                     "  if (!buf[0]) {\n    strct->_%s_%s = 0;\n  } else {\n",
+                     child_name,
+                     (child_is_embeddable(child) ? "has" : "info.has"));
+  else
+    func = strappend(func, "  {\n");
+  switch (child->tag) {
+  case CHILD_TEXT:
+  case CHILD_SCALAR_LIST:
+  {
+    ScalarTag tag = (child->tag == CHILD_TEXT ? 
+                     SCALAR_UINT8 : child->type.scalar_list.tag);
+    func = strappend(func,
+"    haris_uint32_t len, j, k, got;\n\
+    %s *elements;\n\
+    HARIS_ASSERT(buf[0] == 0x%X, STRUCTURE);\n\
+    if ((result = haris_lib_read(stream, reader, 3, &buf))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    haris_read_uint24(buf, &len);\n\
+    if ((result = haris_lib_reserve_list_mem(strct,\n\
+                                             &haris_lib_structures[%d],\n\
+                                             %d, len, arena))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    elements = (%s*)strct->_%s_info.ptr;\n\
+    if (haris_lib_bulk_scalars[%s]) {\n\
+      if ((result = haris_lib_read_bulk(stream, reader, elements, len * %d))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+    } else {\n\
+      for (j = 0; j < len; j += got) {\n\
+        if ((result = reader(stream, %d, len - j, &buf, &got))\n\
+            != HARIS_SUCCESS)\n\
+          return result;\n\
+        for (k = 0; k < got; k ++)\n\
+          haris_read_%s(buf + %d * k, &elements[j + k]);\n\
+      }\n\
+    }\n",
+                     scalar_type_name(tag), 0x80 | scalar_bit_pattern(tag),
+                     strct->schema_index, field,
+                     scalar_type_name(tag), child_name,
+                     scalar_enumerated_name(tag), sizeof_scalar(tag),
+                     sizeof_scalar(tag), scalar_function_suffix(tag),
+                     sizeof_scalar(tag));
+    break;
+  }
+  case CHILD_STRUCT_LIST:
+  {
+    const char *element_name = child->type.struct_list->name;
+    func = strappend(func,
+"    haris_uint32_t len, j;\n\
+    int element_children, element_body;\n\
+    %s%s *elements;\n\
+    HARIS_ASSERT(buf[0] == 0xC0, STRUCTURE);\n\
+    if ((result = haris_lib_read(stream, reader, 5, &buf))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    HARIS_ASSERT((buf[3] & 0xC0) == 0x40, STRUCTURE);\n\
+    haris_read_uint24(buf, &len);\n\
+    element_children = buf[3] & 0x3F;\n\
+    element_body = buf[4];\n\
+    if ((result = haris_lib_reserve_list_mem(strct,\n\
+                                             &haris_lib_structures[%d],\n\
+                                             %d, len, arena))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    elements = (%s%s*)strct->_%s_info.ptr;\n\
+    for (j = 0; j < len; j ++)\n\
+      if ((result = %s%s_decode_body(&elements[j], stream, reader, arena,\n\
+                                     depth + 1, element_children,\n\
+                                     element_body)) != HARIS_SUCCESS)\n\
+        return result;\n",
+                     prefix, element_name,
+                     strct->schema_index, field,
+                     prefix, element_name, child_name,
+                     prefix, element_name);
+    break;
+  }
+  case CHILD_STRUCT:
+  {
+    const char *child_struct_name = child->type.strct->name;
+    func = strappend(func,
+"    int child_children = buf[0] & 0x3F;\n\
+    HARIS_ASSERT((buf[0] & 0xC0) == 0x40, STRUCTURE);\n\
+    if ((result = haris_lib_read(stream, reader, 1, &buf))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n");
+    if (child_is_embeddable(child)) {
+      func = strappend(func,
+"    strct->_%s_has = 1;\n\
+    if ((result = %s%s_decode_body(&strct->_%s_embedded, stream, reader,\n\
+                                   arena,\n",
+                       child_name, prefix, child_struct_name, child_name);
+    } else {
+      func = strappend(func,
+"    if ((result = haris_lib_reserve_struct_mem(strct,\n\
+                                               &haris_lib_structures[%d],\n\
+                                               %d, arena)) != HARIS_SUCCESS)\n\
+      return result;\n\
+    if ((result = %s%s_decode_body(strct->_%s_info.ptr, stream, reader,\n\
+                                   arena,\n",
+                       strct->schema_index, field,
+                       prefix, child_struct_name, child_name);
+    }
+    func = strappend(func,
+"                                   depth + 1, child_children, buf[0]))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n");
+    break;
+  }
+  }
+  return strappend(func, "  }\n");
+}
+
+static CJobStatus write_specialized_encoder(CJob *job, ParsedStruct *strct)
+{
+  int i;
+  const char *prefix = job->prefix, *name = strct->name;
+  char *func = strformat(
+"static HarisStatus %s%s_encode_body(void *ptr, void *stream,\n\
+                                     HarisStreamWriter writer, int depth)\n\
+{\n\
+  %s%s *strct = (%s%s*)ptr;\n\
+  HarisStatus result;\n",
+                         prefix, name, prefix, name, prefix, name);
+  if (strct->offset > 0)
+    func = strappend(func, "  unsigned char body[%d];\n", strct->offset);
+  if (strct->num_children > 0)
+    func = strappend(func, "  unsigned char header[6];\n");
+  func = strappend(func, "  HARIS_ASSERT(depth <= HARIS_DEPTH_LIMIT, DEPTH);\n");
+  for (i = 0; i < strct->num_scalars; i ++)
+    func = strappend(func, "  haris_write_%s(body + %d, &strct->%s);\n",
+                     scalar_function_suffix(strct->scalars[i].type.tag),
+                     strct->scalars[i].offset, strct->scalars[i].name);
+  if (strct->offset > 0)
+    func = strappend(func, 
+"  if ((result = writer(stream, body, %d)) != HARIS_SUCCESS)\n\
+    return result;\n", strct->offset);
+  for (i = 0; i < strct->num_children; i ++)
+    func = append_specialized_child_encoder(func, job, strct, i);
+  func = strappend(func, "  return HARIS_SUCCESS;\n}\n\n");
+  if (!func) return CJOB_MEM_ERROR;
+  return add_private_function(job, func);
+}
+
+/* Append the code that encodes the given child to the encoder. As in
+   _haris_to_stream_posthead, an absent child is written as null if it is
+   nullable and is a structure error otherwise. */
+static char *append_specialized_child_encoder(char *func, CJob *job,
+                                              ParsedStruct *strct, int field)
+{
+  const char *prefix = job->prefix;
+  ChildField *child = &strct->children[field];
+  const char *child_name = child->name;
+  func = strappend(func, "  /* %s */\n  if (!strct->_%s_%s) {\n", 
+                   child_name, child_name,
+                   (child_is_embeddable(child) ? "has" : "info.has"));
+  if (child->nullable)
+    func = strappend(func,
+"    header[0] = 0;\n\
+    if ((result = writer(stream, header, 1)) != HARIS_SUCCESS)\n\
+      return result;\n");
+  else
+    func = strappend(func, "    return HARIS_STRUCTURE_ERROR;\n");
+  func = strappend(func, "  } else {\n");
+  switch (child->tag) {
+  case CHILD_TEXT:
+  case CHILD_SCALAR_LIST:
+  {
+    ScalarTag tag = (child->tag == CHILD_TEXT ? 
+                     SCALAR_UINT8 : child->type.scalar_list.tag);
+    func = strappend(func,
+"    %s *elements = (%s*)strct->_%s_info.ptr;\n\
+    unsigned char element[%d];\n\
+    haris_uint32_t j;\n\
+    header[0] = 0x%X;\n\
+    haris_write_uint24(header + 1, &strct->_%s_info.len);\n\
+    if ((result = writer(stream, header, 4)) != HARIS_SUCCESS)\n\
+      return result;\n\
+    if (haris_lib_bulk_scalars[%s]) {\n\
+      if ((result = haris_lib_write_bulk(stream, writer, elements,\n\
+                                         strct->_%s_info.len * %d))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+    } else {\n\
+      for (j = 0; j < strct->_%s_info.len; j ++) {\n\
+        haris_write_%s(element, &elements[j]);\n\
+        if ((result = writer(stream, element, %d)) != HARIS_SUCCESS)\n\
+          return result;\n\
+      }\n\
+    }\n",
+                     scalar_type_name(tag), scalar_type_name(tag), child_name,
+                     sizeof_scalar(tag), 0x80 | scalar_bit_pattern(tag),
+                     child_name, scalar_enumerated_name(tag), child_name,
+                     sizeof_scalar(tag), child_name,
+                     scalar_function_suffix(tag), sizeof_scalar(tag));
+    break;
+  }
+  case CHILD_STRUCT_LIST:
+  {
+    ParsedStruct *element = child->type.struct_list;
+    func = strappend(func,
+"    %s%s *elements = (%s%s*)strct->_%s_info.ptr;\n\
+    haris_uint32_t j;\n\
+    header[0] = 0xC0;\n\
+    haris_write_uint24(header + 1, &strct->_%s_info.len);\n\
+    header[4] = 0x%X;\n\
+    header[5] = %d;\n\
+    if ((result = writer(stream, header, 6)) != HARIS_SUCCESS)\n\
+      return result;\n\
+    for (j = 0; j < strct->_%s_info.len; j ++)\n\
+      if ((result = %s%s_encode_body(&elements[j], stream, writer,\n\
+                                     depth + 1)) != HARIS_SUCCESS)\n\
+        return result;\n",
+                     prefix, element->name, prefix, element->name, child_name,
+                     child_name, 0x40 | element->num_children, element->offset,
+                     child_name, prefix, element->name);
+    break;
+  }
+  case CHILD_STRUCT:
+  {
+    ParsedStruct *child_struct = child->type.strct;
+    func = strappend(func,
+"    header[0] = 0x%X;\n\
+    header[1] = %d;\n\
+    if ((result = writer(stream, header, 2)) != HARIS_SUCCESS)\n\
+      return result;\n\
+    if ((result = %s%s_encode_body(%sstrct->_%s_%s, stream, writer,\n\
+                                   depth + 1)) != HARIS_SUCCESS)\n\
+      return result;\n",
+                     0x40 | child_struct->num_children, child_struct->offset,
+                     prefix, child_struct->name, 
+                     (child_is_embeddable(child) ? "&" : ""), child_name,
+                     (child_is_embeddable(child) ? "embedded" : "info.ptr"));
+    break;
+  }
+  }
+  return strappend(func, "  }\n");
+}
@@ -0,0 +1,396 @@
+#include "cgenc_decoder.h"
+
+/* Push decoders take a message in whatever pieces it happens to arrive in,
+   rather than pulling bytes out of a stream until the message is done.
+   For a structure S, we generate
+
+   void S_decoder_init(HarisDecoder *, S *);
+   HarisStatus S_decoder_feed(HarisDecoder *, const unsigned char *, size_t,
+                              size_t *);
+
+   S_decoder_init readies the decoder to decode a message into the given
+   structure. Each call to S_decoder_feed hands it the next piece of the
+   message, and returns HARIS_NEED_MORE if all of the bytes were used up
+   and the message isn't done yet, or HARIS_SUCCESS once it is. The last
+   argument tells how many bytes were used; a piece that holds the end of
+   one message and the start of the next is only used up to the end of
+   the first. Any other return value is an error, and the decoder keeps
+   returning it until it's initialized again.
+
+   Nothing is buffered but the header or body being read (at most 255
+   bytes) and a partial scalar; list payloads are copied straight into the
+   structure as they arrive. The decoder keeps its place in the message on
+   an explicit stack, so it never recurses and it never blocks, which is
+   what a non-blocking socket needs.
+*/
+
+static CJobStatus write_decoder_structures(CJob *);
+static CJobStatus write_static_decoder_funcs(CJob *);
+static CJobStatus write_public_decoder_funcs(CJob *, ParsedStruct *);
+
+/* =============================PUBLIC INTERFACE============================= */
+
+CJobStatus write_decoder_funcs(CJob *job)
+{
+  CJobStatus result;
+  int i;
+  ParsedSchema *schema = job->schema;
+  if ((result = write_decoder_structures(job)) != CJOB_SUCCESS ||
+      (result = write_static_decoder_funcs(job)) != CJOB_SUCCESS)
+    return result;
+  for (i = 0; i < schema->num_structs; i++) {
+    if ((result = write_public_decoder_funcs(job, &schema->structs[i]))
+        != CJOB_SUCCESS)
+      return result;
+  }
+  return CJOB_SUCCESS;
+}
+
+/* =============================STATIC FUNCTIONS============================= */
+
+/* There is a frame on the stack for every structure that is being decoded,
+   from the message itself (at the bottom) down to the one whose body or
+   children are being read. Structures the schema doesn't know about are
+   read and thrown away.
+
+   `scratch` holds the bytes of a header, body or scalar that has been
+   split between two pieces of input; `have` is how many of them are
+   there so far. While a list of scalars is being read, `list_dest` is
+   where its next element goes (NULL if it's being thrown away) and
+   `list_left` is how many elements remain. */
+static CJobStatus write_decoder_structures(CJob *job)
+{
+  CJOB_FMT_HEADER_STRING(job,
+"typedef struct {\n\
+  HarisStatus status;\n\
+  int state;\n\
+  int depth;\n\
+  haris_uint32_t consumed;\n\
+  haris_uint32_t have;\n\
+  unsigned char scratch[256];\n\
+  unsigned char first_byte;\n\
+  unsigned char *list_dest;\n\
+  haris_uint32_t list_left;\n\
+  haris_uint32_t list_unit;\n\
+  HarisScalarType list_type;\n\
+  HarisFrame stack[HARIS_DEPTH_LIMIT + 1];\n\
+} HarisDecoder;\n\n");
+  CJOB_FMT_SOURCE_STRING(job,
+"enum {\n\
+  HARIS_DECODER_HEADER, HARIS_DECODER_BODY, HARIS_DECODER_CHILD,\n\
+  HARIS_DECODER_CHILD_HEADER, HARIS_DECODER_SCALARS\n\
+};\n\n");
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_static_decoder_funcs(CJob *job)
+{
+  /* Points *out at the next `need` bytes of the message: straight into the
+     input if they're all there, or else into `scratch`, once enough pieces
+     have come in to fill it */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_decoder_gather(HarisDecoder *dec,\n\
+                                            const unsigned char **in,\n\
+                                            size_t *n, haris_uint32_t need,\n\
+                                            const unsigned char **out)\n\
+{\n\
+  haris_uint32_t take = need - dec->have;\n\
+  if (take > *n) take = (haris_uint32_t)*n;\n\
+  HARIS_ASSERT(take <= HARIS_MESSAGE_SIZE_LIMIT - dec->consumed, SIZE);\n\
+  dec->consumed += take;\n\
+  if (dec->have == 0 && take == need) {\n\
+    *out = *in;\n\
+  } else {\n\
+    memcpy(dec->scratch + dec->have, *in, take);\n\
+    dec->have += take;\n\
+    *out = dec->scratch;\n\
+  }\n\
+  *in += take;\n\
+  *n -= take;\n\
+  if (dec->have < need && *out == dec->scratch) return HARIS_NEED_MORE;\n\
+  dec->have = 0;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_decoder_push(HarisDecoder *dec, void *ptr,\n\
+                                          const HarisStructureInfo *info,\n\
+                                          int num_children, int body_size,\n\
+                                          haris_uint32_t elements_left)\n\
+{\n\
+  HarisFrame *frame;\n\
+  HARIS_ASSERT(dec->depth < HARIS_DEPTH_LIMIT, DEPTH);\n\
+  HARIS_ASSERT(!info || (body_size >= info->body_size &&\n\
+                         num_children >= info->num_children), STRUCTURE);\n\
+  frame = &dec->stack[++ dec->depth];\n\
+  frame->ptr = ptr;\n\
+  frame->info = info;\n\
+  frame->num_children = num_children;\n\
+  frame->body_size = body_size;\n\
+  frame->child = 0;\n\
+  frame->elements_left = elements_left;\n\
+  dec->state = HARIS_DECODER_BODY;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  /* Reads as much of a list of scalars as there is input for. Whole
+     elements are converted straight out of the input; an element that's
+     split between two pieces is put back together in `scratch`. */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_decoder_scalars(HarisDecoder *dec,\n\
+                                            const unsigned char **in,\n\
+                                            size_t *n)\n\
+{\n\
+  HarisStatus result;\n\
+  const unsigned char *src;\n\
+  haris_uint32_t count, j;\n\
+  size_t mem_size;\n\
+  while (dec->list_left > 0) {\n\
+    if (dec->have == 0 && *n >= dec->list_unit) {\n\
+      count = dec->list_left;\n\
+      if (count > *n / dec->list_unit)\n\
+        count = (haris_uint32_t)(*n / dec->list_unit);\n\
+      HARIS_ASSERT(count <= (HARIS_MESSAGE_SIZE_LIMIT - dec->consumed) /\n\
+                   dec->list_unit, SIZE);\n\
+      dec->consumed += count * dec->list_unit;\n\
+      src = *in;\n\
+      *in += count * dec->list_unit;\n\
+      *n -= count * dec->list_unit;\n\
+    } else {\n\
+      if ((result = haris_lib_decoder_gather(dec, in, n, dec->list_unit,\n\
+                                             &src)) != HARIS_SUCCESS)\n\
+        return result;\n\
+      count = 1;\n\
+    }\n\
+    dec->list_left -= count;\n\
+    if (!dec->list_dest) continue;\n\
+    if (haris_lib_bulk_scalars[dec->list_type]) {\n\
+      memcpy(dec->list_dest, src, count * dec->list_unit);\n\
+      dec->list_dest += count * dec->list_unit;\n\
+      continue;\n\
+    }\n\
+    mem_size = haris_lib_in_memory_scalar_sizes[dec->list_type];\n\
+    for (j = 0; j < count; j ++, src += dec->list_unit,\n\
+                               dec->list_dest += mem_size)\n\
+      haris_lib_read_scalar(src, dec->list_dest, dec->list_type);\n\
+  }\n\
+  dec->state = HARIS_DECODER_CHILD;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  /* Called once the first byte of a non-null child's header is known.
+     Reads the rest of the header, makes room for the child in the
+     structure, and sets the decoder up to read what follows. */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_decoder_child(HarisDecoder *dec,\n\
+                                           const unsigned char **in,\n\
+                                           size_t *n)\n\
+{\n\
+  HarisFrame *frame = &dec->stack[dec->depth];\n\
+  const HarisChild *child = (frame->info &&\n\
+                             frame->child < frame->info->num_children ?\n\
+                             &frame->info->children[frame->child] : NULL);\n\
+  HarisListInfo *list_info = (child ?\n\
+    (HarisListInfo*)((char*)frame->ptr + child->offset) : NULL);\n\
+  const HarisStructureInfo *element = (child ? child->struct_element : NULL);\n\
+  unsigned char first = dec->first_byte;\n\
+  const unsigned char *header;\n\
+  haris_uint32_t len;\n\
+  HarisStatus result;\n\
+  void *child_ptr = NULL;\n\
+  int field = frame->child;\n\
+  if ((first & 0xC0) == 0x40) { /* structure */\n\
+    if ((result = haris_lib_decoder_gather(dec, in, n, 1, &header))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    frame->child ++;\n\
+    if (child) {\n\
+      if (child->child_type == HARIS_CHILD_STRUCT) {\n\
+        if ((result = haris_lib_reserve_struct_mem(frame->ptr, frame->info,\n\
+                                                   field, NULL))\n\
+            != HARIS_SUCCESS)\n\
+          return result;\n\
+        child_ptr = ((HarisSubstructInfo*)list_info)->ptr;\n\
+      } else {\n\
+        HARIS_ASSERT(child->child_type == HARIS_CHILD_EMBEDDED_STRUCT,\n\
+                     STRUCTURE);\n\
+        *((char*)frame->ptr + child->has_offset) = 1;\n\
+        child_ptr = (void*)list_info;\n\
+      }\n\
+    }\n\
+    return haris_lib_decoder_push(dec, child_ptr, element, first & 0x3F,\n\
+                                  header[0], 0);\n\
+  } else if ((first & 0xC0) == 0x80) { /* list of scalars */\n\
+    if ((result = haris_lib_decoder_gather(dec, in, n, 3, &header))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    haris_read_uint24(header, &len);\n\
+    frame->child ++;\n\
+    dec->list_dest = NULL;\n\
+    dec->list_unit = (haris_uint32_t)\n\
+      haris_lib_message_size_from_bit_pattern[first & 0x3];\n\
+    if (child) {\n\
+      HARIS_ASSERT((child->child_type == HARIS_CHILD_TEXT ||\n\
+                    child->child_type == HARIS_CHILD_SCALAR_LIST) &&\n\
+                   first == (0x80 |\n\
+                     haris_lib_scalar_bit_patterns[child->scalar_element]),\n\
+                   STRUCTURE);\n\
+      if ((result = haris_lib_reserve_list_mem(frame->ptr, frame->info,\n\
+                                               field, len, NULL))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      dec->list_dest = (unsigned char*)list_info->ptr;\n\
+      dec->list_type = child->scalar_element;\n\
+    }\n\
+    dec->list_left = len;\n\
+    dec->state = HARIS_DECODER_SCALARS;\n\
+    return HARIS_SUCCESS;\n\
+  } else { /* list of structures */\n\
+    if ((result = haris_lib_decoder_gather(dec, in, n, 5, &header))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    haris_read_uint24(header, &len);\n\
+    frame->child ++;\n\
+    if (child) {\n\
+      HARIS_ASSERT(child->child_type == HARIS_CHILD_STRUCT_LIST &&\n\
+                   first == 0xC0 && (header[3] & 0xC0) == 0x40, STRUCTURE);\n\
+      if ((result = haris_lib_reserve_list_mem(frame->ptr, frame->info,\n\
+                                               field, len, NULL))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      child_ptr = list_info->ptr;\n\
+    }\n\
+    dec->state = HARIS_DECODER_CHILD;\n\
+    if (len == 0) return HARIS_SUCCESS;\n\
+    if (!child && (header[3] & 0x3F) == 0) {\n\
+      /* Unknown elements without children are nothing but bodies */\n\
+      if (header[4] == 0) return HARIS_SUCCESS;\n\
+      dec->list_dest = NULL;\n\
+      dec->list_unit = header[4];\n\
+      dec->list_left = len;\n\
+      dec->state = HARIS_DECODER_SCALARS;\n\
+      return HARIS_SUCCESS;\n\
+    }\n\
+    return haris_lib_decoder_push(dec, child_ptr, element, header[3] & 0x3F,\n\
+                                  header[4], len - 1);\n\
+  }\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_decoder_run(HarisDecoder *dec,\n\
+                                         const unsigned char **in,\n\
+                                         size_t *n)\n\
+{\n\
+  HarisStatus result;\n\
+  HarisFrame *frame;\n\
+  const unsigned char *data;\n\
+  for (;;) {\n\
+    frame = &dec->stack[dec->depth];\n\
+    switch (dec->state) {\n\
+    case HARIS_DECODER_HEADER:\n\
+      if ((result = haris_lib_decoder_gather(dec, in, n, 2, &data))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      HARIS_ASSERT(data[0] && !(data[0] & 0x80), STRUCTURE);\n\
+      HARIS_ASSERT(data[1] >= frame->info->body_size &&\n\
+                   (data[0] & 0x3F) >= frame->info->num_children, STRUCTURE);\n\
+      frame->num_children = data[0] & 0x3F;\n\
+      frame->body_size = data[1];\n\
+      dec->state = HARIS_DECODER_BODY;\n\
+      break;\n\
+    case HARIS_DECODER_BODY:\n\
+      if ((result = haris_lib_decoder_gather(dec, in, n,\n\
+                                             (haris_uint32_t)frame->body_size,\n\
+                                             &data)) != HARIS_SUCCESS)\n\
+        return result;\n\
+      if (frame->info) haris_lib_read_body(frame->ptr, frame->info, data);\n\
+      dec->state = HARIS_DECODER_CHILD;\n\
+      break;\n\
+    case HARIS_DECODER_CHILD:\n\
+      if (frame->child == frame->num_children) {\n\
+        if (frame->elements_left > 0) { /* on to the next element */\n\
+          frame->elements_left --;\n\
+          if (frame->info)\n\
+            frame->ptr = (char*)frame->ptr + frame->info->size_of;\n\
+          frame->child = 0;\n\
+          dec->state = HARIS_DECODER_BODY;\n\
+        } else if (dec->depth == 0) {\n\
+          return HARIS_SUCCESS;\n\
+        } else {\n\
+          dec->depth --;\n\
+        }\n\
+        break;\n\
+      }\n\
+      if ((result = haris_lib_decoder_gather(dec, in, n, 1, &data))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      if (data[0]) {\n\
+        dec->first_byte = data[0];\n\
+        dec->state = HARIS_DECODER_CHILD_HEADER;\n\
+        break;\n\
+      }\n\
+      if (frame->info && frame->child < frame->info->num_children) {\n\
+        HARIS_ASSERT(frame->info->children[frame->child].nullable,\n\
+                     STRUCTURE);\n\
+        haris_lib_mark_absent(frame->ptr,\n\
+                              &frame->info->children[frame->child]);\n\
+      }\n\
+      frame->child ++;\n\
+      break;\n\
+    case HARIS_DECODER_CHILD_HEADER:\n\
+      if ((result = haris_lib_decoder_child(dec, in, n)) != HARIS_SUCCESS)\n\
+        return result;\n\
+      break;\n\
+    case HARIS_DECODER_SCALARS:\n\
+      if ((result = haris_lib_decoder_scalars(dec, in, n)) != HARIS_SUCCESS)\n\
+        return result;\n\
+      break;\n\
+    }\n\
+  }\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static void _public_decoder_init(HarisDecoder *dec, void *ptr,\n\
+                                 const HarisStructureInfo *info)\n\
+{\n\
+  dec->status = HARIS_NEED_MORE;\n\
+  dec->state = HARIS_DECODER_HEADER;\n\
+  dec->depth = 0;\n\
+  dec->consumed = 0;\n\
+  dec->have = 0;\n\
+  dec->stack[0].ptr = ptr;\n\
+  dec->stack[0].info = info;\n\
+  dec->stack[0].child = 0;\n\
+  dec->stack[0].elements_left = 0;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus _public_decoder_feed(HarisDecoder *dec,\n\
+                                        const HarisStructureInfo *info,\n\
+                                        const unsigned char *bytes,\n\
+                                        size_t n, size_t *used)\n\
+{\n\
+  size_t left = n;\n\
+  if (dec->status == HARIS_NEED_MORE) {\n\
+    if (dec->stack[0].info != info)\n\
+      dec->status = HARIS_STRUCTURE_ERROR;\n\
+    else\n\
+      dec->status = haris_lib_decoder_run(dec, &bytes, &left);\n\
+  }\n\
+  if (used) *used = n - left;\n\
+  return dec->status;\n\
+}\n\n");
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_public_decoder_funcs(CJob *job, ParsedStruct *strct)
+{
+  const char *prefix = job->prefix, *name = strct->name;
+  CJOB_FMT_PUB_FUNCTION(job,
+"void %s%s_decoder_init(HarisDecoder *dec, %s%s *strct)\n\
+{\n\
+  _public_decoder_init(dec, strct, &haris_lib_structures[%d]);\n}\n\n",
+                        prefix, name, prefix, name, strct->schema_index);
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_decoder_feed(HarisDecoder *dec, const unsigned char *bytes,\n\
+                              size_t n, size_t *used)\n\
+{\n\
+  return _public_decoder_feed(dec, &haris_lib_structures[%d], bytes, n,\n\
+                              used);\n}\n\n",
+                        prefix, name, strct->schema_index);
+  return CJOB_SUCCESS;
+}
@@ -0,0 +1,8 @@
+#ifndef CGENC_DECODER_H_
+#define CGENC_DECODER_H_
+
+#include "cgen.h"
+
+CJobStatus write_decoder_funcs(CJob *);
+
+#endif
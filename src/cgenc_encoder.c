@@ -0,0 +1,297 @@
+#include "cgenc_encoder.h"
+
+/* Chunked encoders are the other half of the push decoders: rather than
+   writing a whole message in one go, they hand it out a piece at a time,
+   in pieces as big as the caller has room for. For a structure S, we
+   generate
+
+   HarisStatus S_encoder_begin(HarisEncoder *, S *, haris_uint32_t *);
+   HarisStatus S_encoder_pull(HarisEncoder *, unsigned char *, size_t,
+                              size_t *);
+
+   S_encoder_begin checks that the structure can be encoded, readies the
+   encoder to encode it, and reports how big the message will be (the last
+   argument may be NULL). Each call to S_encoder_pull then writes the next
+   piece of the message into the given buffer, filling it if there's
+   enough left, and says how many bytes it wrote. It returns
+   HARIS_NEED_MORE if there is still more of the message to pull, or
+   HARIS_SUCCESS once the last of it has been written. The structure
+   mustn't be changed until the message is done.
+
+   Nothing is copied ahead of time but a single header, body or scalar
+   that doesn't fit into what's left of the caller's buffer; lists are
+   written straight from the structure. As with the push decoders, the
+   encoder keeps its place on an explicit stack, so any amount of output
+   room can be handed to it, whenever it's available.
+*/
+
+static CJobStatus write_encoder_structures(CJob *);
+static CJobStatus write_static_encoder_funcs(CJob *);
+static CJobStatus write_public_encoder_funcs(CJob *, ParsedStruct *);
+
+/* =============================PUBLIC INTERFACE============================= */
+
+CJobStatus write_encoder_funcs(CJob *job)
+{
+  CJobStatus result;
+  int i;
+  ParsedSchema *schema = job->schema;
+  if ((result = write_encoder_structures(job)) != CJOB_SUCCESS ||
+      (result = write_static_encoder_funcs(job)) != CJOB_SUCCESS)
+    return result;
+  for (i = 0; i < schema->num_structs; i++) {
+    if ((result = write_public_encoder_funcs(job, &schema->structs[i]))
+        != CJOB_SUCCESS)
+      return result;
+  }
+  return CJOB_SUCCESS;
+}
+
+/* =============================STATIC FUNCTIONS============================= */
+
+/* As in the push decoder, every structure being encoded has a frame on the
+   stack. `pending` holds bytes that have been encoded but not yet pulled;
+   `pending_pos` of its `pending_len` bytes are gone. While a list of
+   scalars is being written, `list_src` points at its next element and
+   `list_left` counts the elements still to go, or the bytes still to go
+   if the list can be copied as it is (`list_bulk`). */
+static CJobStatus write_encoder_structures(CJob *job)
+{
+  CJOB_FMT_HEADER_STRING(job,
+"typedef struct {\n\
+  HarisStatus status;\n\
+  int state;\n\
+  int depth;\n\
+  unsigned char pending[256];\n\
+  haris_uint32_t pending_len;\n\
+  haris_uint32_t pending_pos;\n\
+  const char *list_src;\n\
+  haris_uint32_t list_left;\n\
+  int list_bulk;\n\
+  HarisScalarType list_type;\n\
+  HarisFrame stack[HARIS_DEPTH_LIMIT + 1];\n\
+} HarisEncoder;\n\n");
+  CJOB_FMT_SOURCE_STRING(job,
+"enum {\n\
+  HARIS_ENCODER_BODY, HARIS_ENCODER_CHILD, HARIS_ENCODER_SCALARS,\n\
+  HARIS_ENCODER_DONE\n\
+};\n\n");
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_static_encoder_funcs(CJob *job)
+{
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_encoder_push(HarisEncoder *enc, void *ptr,\n\
+                                          const HarisStructureInfo *info,\n\
+                                          haris_uint32_t elements_left)\n\
+{\n\
+  HarisFrame *frame;\n\
+  HARIS_ASSERT(enc->depth < HARIS_DEPTH_LIMIT, DEPTH);\n\
+  frame = &enc->stack[++ enc->depth];\n\
+  frame->ptr = ptr;\n\
+  frame->info = info;\n\
+  frame->child = 0;\n\
+  frame->elements_left = elements_left;\n\
+  enc->state = HARIS_ENCODER_BODY;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  /* Encodes the next body or child header into `pending`, or moves on to
+     the next structure. Lists of scalars are left to
+     haris_lib_encoder_scalars. */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_encoder_step(HarisEncoder *enc)\n\
+{\n\
+  HarisFrame *frame = &enc->stack[enc->depth];\n\
+  const HarisChild *child;\n\
+  HarisListInfo *list_info;\n\
+  int present;\n\
+  enc->pending_pos = 0;\n\
+  if (enc->state == HARIS_ENCODER_BODY) {\n\
+    enc->pending_len = (haris_uint32_t)\n\
+      (haris_lib_write_body(frame->ptr, frame->info, enc->pending) -\n\
+       enc->pending);\n\
+    enc->state = HARIS_ENCODER_CHILD;\n\
+    return HARIS_SUCCESS;\n\
+  }\n\
+  enc->pending_len = 0;\n\
+  if (frame->child == frame->info->num_children) {\n\
+    if (frame->elements_left > 0) { /* on to the next element */\n\
+      frame->elements_left --;\n\
+      frame->ptr = (char*)frame->ptr + frame->info->size_of;\n\
+      frame->child = 0;\n\
+      enc->state = HARIS_ENCODER_BODY;\n\
+    } else if (enc->depth == 0) {\n\
+      enc->state = HARIS_ENCODER_DONE;\n\
+    } else {\n\
+      enc->depth --;\n\
+    }\n\
+    return HARIS_SUCCESS;\n\
+  }\n\
+  child = &frame->info->children[frame->child ++];\n\
+  list_info = (HarisListInfo*)((char*)frame->ptr + child->offset);\n\
+  switch (child->child_type) {\n\
+  case HARIS_CHILD_STRUCT:\n\
+    present = ((HarisSubstructInfo*)list_info)->has;\n\
+    break;\n\
+  case HARIS_CHILD_EMBEDDED_STRUCT:\n\
+    present = *((char*)frame->ptr + child->has_offset);\n\
+    break;\n\
+  default:\n\
+    present = list_info->has;\n\
+  }\n\
+  if (!present) {\n\
+    HARIS_ASSERT(child->nullable, STRUCTURE);\n\
+    enc->pending[0] = 0;\n\
+    enc->pending_len = 1;\n\
+    return HARIS_SUCCESS;\n\
+  }\n\
+  switch (child->child_type) {\n\
+  case HARIS_CHILD_TEXT:\n\
+  case HARIS_CHILD_SCALAR_LIST:\n\
+    enc->pending[0] = (0x80 |\n\
+                       haris_lib_scalar_bit_patterns[child->scalar_element]);\n\
+    haris_write_uint24(enc->pending + 1, &list_info->len);\n\
+    enc->pending_len = 4;\n\
+    if (list_info->len == 0) break;\n\
+    enc->list_src = (const char*)list_info->ptr;\n\
+    enc->list_type = child->scalar_element;\n\
+    enc->list_bulk = haris_lib_bulk_scalars[child->scalar_element];\n\
+    enc->list_left = list_info->len;\n\
+    if (enc->list_bulk)\n\
+      enc->list_left *= (haris_uint32_t)\n\
+        haris_lib_message_scalar_sizes[child->scalar_element];\n\
+    enc->state = HARIS_ENCODER_SCALARS;\n\
+    break;\n\
+  case HARIS_CHILD_STRUCT_LIST:\n\
+    enc->pending[0] = 0xC0;\n\
+    haris_write_uint24(enc->pending + 1, &list_info->len);\n\
+    (void)haris_lib_write_nonnull_header(child->struct_element,\n\
+                                         enc->pending + 4);\n\
+    enc->pending_len = 6;\n\
+    if (list_info->len == 0) break;\n\
+    return haris_lib_encoder_push(enc, list_info->ptr, child->struct_element,\n\
+                                  list_info->len - 1);\n\
+  case HARIS_CHILD_STRUCT:\n\
+    (void)haris_lib_write_nonnull_header(child->struct_element,\n\
+                                         enc->pending);\n\
+    enc->pending_len = 2;\n\
+    return haris_lib_encoder_push(enc, ((HarisSubstructInfo*)list_info)->ptr,\n\
+                                  child->struct_element, 0);\n\
+  case HARIS_CHILD_EMBEDDED_STRUCT:\n\
+    (void)haris_lib_write_nonnull_header(child->struct_element,\n\
+                                         enc->pending);\n\
+    enc->pending_len = 2;\n\
+    return haris_lib_encoder_push(enc, list_info, child->struct_element, 0);\n\
+  }\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  /* Writes as much of a list of scalars as there's room for. An element
+     that only partly fits is encoded into `pending` instead. */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static void haris_lib_encoder_scalars(HarisEncoder *enc, unsigned char *out,\n\
+                                      size_t room, size_t *pos)\n\
+{\n\
+  size_t msg_size, mem_size;\n\
+  haris_uint32_t count;\n\
+  if (enc->list_bulk) {\n\
+    count = enc->list_left;\n\
+    if (count > room) count = (haris_uint32_t)room;\n\
+    memcpy(out, enc->list_src, count);\n\
+    enc->list_src += count;\n\
+    enc->list_left -= count;\n\
+    *pos += count;\n\
+  } else {\n\
+    msg_size = haris_lib_message_scalar_sizes[enc->list_type];\n\
+    mem_size = haris_lib_in_memory_scalar_sizes[enc->list_type];\n\
+    for (; enc->list_left > 0 && room >= msg_size; enc->list_left --,\n\
+           enc->list_src += mem_size, out += msg_size, room -= msg_size,\n\
+           *pos += msg_size)\n\
+      haris_lib_write_scalar(out, enc->list_src, enc->list_type);\n\
+    if (enc->list_left > 0 && room > 0) {\n\
+      haris_lib_write_scalar(enc->pending, enc->list_src, enc->list_type);\n\
+      enc->pending_len = (haris_uint32_t)msg_size;\n\
+      enc->pending_pos = 0;\n\
+      enc->list_src += mem_size;\n\
+      enc->list_left --;\n\
+    }\n\
+  }\n\
+  if (enc->list_left == 0) enc->state = HARIS_ENCODER_CHILD;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus _public_encoder_begin(HarisEncoder *enc, void *ptr,\n\
+                                        const HarisStructureInfo *info,\n\
+                                        haris_uint32_t *size)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t encoded_size = haris_lib_size(ptr, info, 0, &result);\n\
+  enc->status = result;\n\
+  if (encoded_size == 0) return result;\n\
+  if (encoded_size > HARIS_MESSAGE_SIZE_LIMIT)\n\
+    return enc->status = HARIS_SIZE_ERROR;\n\
+  enc->status = HARIS_NEED_MORE;\n\
+  enc->state = HARIS_ENCODER_BODY;\n\
+  enc->depth = 0;\n\
+  enc->stack[0].ptr = ptr;\n\
+  enc->stack[0].info = info;\n\
+  enc->stack[0].child = 0;\n\
+  enc->stack[0].elements_left = 0;\n\
+  (void)haris_lib_write_nonnull_header(info, enc->pending);\n\
+  enc->pending_len = 2;\n\
+  enc->pending_pos = 0;\n\
+  if (size) *size = encoded_size;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus _public_encoder_pull(HarisEncoder *enc,\n\
+                                       const HarisStructureInfo *info,\n\
+                                       unsigned char *out, size_t cap,\n\
+                                       size_t *n)\n\
+{\n\
+  size_t pos = 0, take;\n\
+  HarisStatus result;\n\
+  if (enc->status == HARIS_NEED_MORE && enc->stack[0].info != info)\n\
+    enc->status = HARIS_STRUCTURE_ERROR;\n\
+  while (enc->status == HARIS_NEED_MORE) {\n\
+    if (enc->pending_pos < enc->pending_len) {\n\
+      take = enc->pending_len - enc->pending_pos;\n\
+      if (take > cap - pos) take = cap - pos;\n\
+      memcpy(out + pos, enc->pending + enc->pending_pos, take);\n\
+      enc->pending_pos += (haris_uint32_t)take;\n\
+      pos += take;\n\
+      if (enc->pending_pos < enc->pending_len) break;\n\
+    }\n\
+    if (enc->state == HARIS_ENCODER_DONE) {\n\
+      enc->status = HARIS_SUCCESS;\n\
+    } else if (enc->state == HARIS_ENCODER_SCALARS) {\n\
+      if (pos == cap) break;\n\
+      haris_lib_encoder_scalars(enc, out + pos, cap - pos, &pos);\n\
+    } else if ((result = haris_lib_encoder_step(enc)) != HARIS_SUCCESS) {\n\
+      enc->status = result;\n\
+    }\n\
+  }\n\
+  if (n) *n = pos;\n\
+  return enc->status;\n\
+}\n\n");
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_public_encoder_funcs(CJob *job, ParsedStruct *strct)
+{
+  const char *prefix = job->prefix, *name = strct->name;
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_encoder_begin(HarisEncoder *enc, %s%s *strct,\n\
+                               haris_uint32_t *size)\n\
+{\n\
+  return _public_encoder_begin(enc, strct, &haris_lib_structures[%d],\n\
+                               size);\n}\n\n",
+                        prefix, name, prefix, name, strct->schema_index);
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_encoder_pull(HarisEncoder *enc, unsigned char *out,\n\
+                              size_t cap, size_t *n)\n\
+{\n\
+  return _public_encoder_pull(enc, &haris_lib_structures[%d], out, cap, n);\n\
+}\n\n",
+                        prefix, name, strct->schema_index);
+  return CJOB_SUCCESS;
+}
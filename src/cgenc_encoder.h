@@ -0,0 +1,8 @@
+#ifndef CGENC_ENCODER_H_
+#define CGENC_ENCODER_H_
+
+#include "cgen.h"
+
+CJobStatus write_encoder_funcs(CJob *);
+
+#endif
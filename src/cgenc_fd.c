@@ -26,34 +26,98 @@ CJobStatus write_fd_protocol_funcs(CJob *job)
 
 static CJobStatus write_fd_structures(CJob *job)
 {
-  CJOB_FMT_HEADER_STRING(job, "#include <unistd.h>\n#include<errno.h>\n\n");
-  /* See cgenc_file.c for information about these structure elements; the 
-     basic idea is the same here. */
+  CJOB_FMT_HEADER_STRING(job, 
+"#include <unistd.h>\n#include <sys/uio.h>\n#include<errno.h>\n\n");
+  /* See cgenc_file.c for information about the first three structure 
+     elements; the basic idea is the same here. Messages are written with
+     writev(): `iov` describes the output that hasn't been written yet, in 
+     order. Small writes are staged in `buffer`, where the bytes from 
+     `staged` to `curr` haven't been given an iovec yet, and large list
+     payloads are described where they lie in the C structure. */
+  CJOB_FMT_HEADER_STRING(job,
+"/* The number of iovecs the fd protocol gathers before calling writev();\n\
+   this must not be larger than the system's IOV_MAX.\n\
+*/\n\n\
+#ifndef HARIS_FD_IOV_COUNT\n\
+#define HARIS_FD_IOV_COUNT 64\n\
+#endif\n\n");
   CJOB_FMT_HEADER_STRING(job, 
 "typedef struct {\n\
   int fd;\n\
   haris_uint32_t curr;\n\
-  unsigned char buffer[1000];\n\
+  unsigned char buffer[HARIS_STREAM_CHUNK_SIZE];\n\
+  haris_uint32_t staged;\n\
+  int num_iov;\n\
+  struct iovec iov[HARIS_FD_IOV_COUNT];\n\
 } HarisFdStream;\n\n");
+  /* A session reads ahead from its file descriptor as far as a single read()
+     will go, and keeps whatever it doesn't use for the next message; the
+     unused bytes are buffer[start] through buffer[end - 1]. `curr` counts
+     the bytes of the message being decoded, and `eof` is set once read()
+     has reported the end of the file. Sessions are set up with 
+     haris_fd_session_init. */
+  CJOB_FMT_HEADER_STRING(job,
+"#ifndef HARIS_FD_SESSION_SIZE\n\
+#define HARIS_FD_SESSION_SIZE 65536\n\
+#endif\n\n\
+typedef struct {\n\
+  int fd;\n\
+  int eof;\n\
+  haris_uint32_t start;\n\
+  haris_uint32_t end;\n\
+  haris_uint32_t curr;\n\
+  unsigned char buffer[HARIS_FD_SESSION_SIZE];\n\
+} HarisFdSession;\n\n");
   return CJOB_SUCCESS;
 }
 
 static CJobStatus write_static_fd_funcs(CJob *job)
 {
+  /* Skipped data is passed over with lseek when the descriptor supports
+     it. lseek happily moves past the end of a file, so the last byte is
+     read to make sure it exists. Returns 1 if the bytes were skipped, 0 if
+     the descriptor can't seek (a pipe or a socket, say) and they have to be
+     drained instead, and -1 if the input ended too soon. */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static int haris_lib_seek_fd(int fd, haris_uint32_t size)\n\
+{\n\
+  unsigned char last;\n\
+  ssize_t result;\n\
+  if (lseek(fd, (off_t)size - 1, SEEK_CUR) == (off_t)-1) return 0;\n\
+  do {\n\
+    result = read(fd, &last, 1);\n\
+  } while (result < 0 && errno == EINTR);\n\
+  return (result == 1 ? 1 : -1);\n\
+}\n\n");
   CJOB_FMT_PRIV_FUNCTION(job,
 "static HarisStatus read_from_fd_stream(void *_stream,\n\
-                                         haris_uint32_t count,\n\
-                                         const unsigned char **dest)\n\
+                                       haris_uint32_t unit,\n\
+                                       haris_uint32_t count,\n\
+                                       const unsigned char **dest,\n\
+                                       haris_uint32_t *got)\n\
 {\n\
   HarisFdStream *stream = (HarisFdStream*)_stream;\n\
   ssize_t result;\n\
-  haris_uint32_t bytes_read = 0;\n\
-  if (count == 0) return HARIS_SUCCESS;\n\
-  HARIS_ASSERT(count + stream->curr <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
-  HARIS_ASSERT(count <= 1000, SIZE);\n\
+  haris_uint32_t bytes_read = 0, size;\n\
+  int seeked;\n\
+  if (!dest && count > HARIS_STREAM_CHUNK_SIZE / unit) {\n\
+    HARIS_ASSERT(count <= (HARIS_MESSAGE_SIZE_LIMIT - stream->curr) / unit,\n\
+                 SIZE);\n\
+    size = count * unit;\n\
+    if ((seeked = haris_lib_seek_fd(stream->fd, size)) != 0) {\n\
+      HARIS_ASSERT(seeked > 0, INPUT);\n\
+      *got = count;\n\
+      stream->curr += size;\n\
+      return HARIS_SUCCESS;\n\
+    }\n\
+  }\n\
+  if (count > HARIS_STREAM_CHUNK_SIZE / unit)\n\
+    count = HARIS_STREAM_CHUNK_SIZE / unit;\n\
+  size = count * unit;\n\
+  HARIS_ASSERT(size + stream->curr <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
   do {\n\
     result = read(stream->fd, stream->buffer + bytes_read, \n\
-                  count - bytes_read);\n\
+                  size - bytes_read);\n\
     if (result < 0) {\n\
       if (errno != EINTR)\n\
         return HARIS_INPUT_ERROR;\n\
@@ -62,34 +126,105 @@ static CJobStatus write_static_fd_funcs(CJob *job)
     } else if (result == 0) { /* EOF: error */\n\
       return HARIS_INPUT_ERROR;\n\
     } else {\n\
-      bytes_read += result;\n\
+      bytes_read += (haris_uint32_t)result;\n\
     }\n\
-  } while (bytes_read < count);\n\
-  *dest = stream->buffer;\n\
-  stream->curr += count;\n\
+  } while (bytes_read < size);\n\
+  if (dest) *dest = stream->buffer;\n\
+  *got = count;\n\
+  stream->curr += size;\n\
   return HARIS_SUCCESS;\n\
 }\n\n");
   CJOB_FMT_PRIV_FUNCTION(job,
-"static HarisStatus force_write_to_fd_stream(int fd, \n\
-                                             const unsigned char *src,\n\
-                                             haris_uint32_t count)\n\
+"static HarisStatus read_from_fd_session(void *_session,\n\
+                                        haris_uint32_t unit,\n\
+                                        haris_uint32_t count,\n\
+                                        const unsigned char **dest,\n\
+                                        haris_uint32_t *got)\n\
 {\n\
+  HarisFdSession *session = (HarisFdSession*)_session;\n\
   ssize_t result;\n\
-  haris_uint32_t bytes_written = 0;\n\
-  if (count == 0) return HARIS_SUCCESS;\n\
-  do {\n\
-    result = write(fd, src + bytes_written, count - bytes_written);\n\
+  haris_uint32_t avail = session->end - session->start, size;\n\
+  int seeked;\n\
+  /* A skip that runs past what's buffered uses up the buffer, then seeks\n\
+     over the rest */\n\
+  if (!dest && count > avail / unit) {\n\
+    HARIS_ASSERT(count <= (HARIS_MESSAGE_SIZE_LIMIT - session->curr) / unit,\n\
+                 SIZE);\n\
+    size = count * unit;\n\
+    if (!session->eof &&\n\
+        (seeked = haris_lib_seek_fd(session->fd, size - avail)) != 0) {\n\
+      HARIS_ASSERT(seeked > 0, INPUT);\n\
+      session->start = session->end = 0;\n\
+      *got = count;\n\
+      session->curr += size;\n\
+      return HARIS_SUCCESS;\n\
+    }\n\
+  }\n\
+  if (avail < unit) {\n\
+    memmove(session->buffer, session->buffer + session->start, avail);\n\
+    session->start = 0;\n\
+    session->end = avail;\n\
+    do {\n\
+      HARIS_ASSERT(!session->eof, INPUT);\n\
+      result = read(session->fd, session->buffer + session->end,\n\
+                    HARIS_FD_SESSION_SIZE - session->end);\n\
+      if (result < 0) {\n\
+        if (errno != EINTR)\n\
+          return HARIS_INPUT_ERROR;\n\
+      } else if (result == 0) {\n\
+        session->eof = 1;\n\
+      } else {\n\
+        session->end += (haris_uint32_t)result;\n\
+      }\n\
+    } while (session->end < unit);\n\
+    avail = session->end;\n\
+  }\n\
+  if (count > avail / unit) count = avail / unit;\n\
+  HARIS_ASSERT(count * unit + session->curr <= HARIS_MESSAGE_SIZE_LIMIT,\n\
+               SIZE);\n\
+  if (dest) *dest = session->buffer + session->start;\n\
+  *got = count;\n\
+  session->start += count * unit;\n\
+  session->curr += count * unit;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus flush_fd_stream(HarisFdStream *stream)\n\
+{\n\
+  ssize_t result;\n\
+  size_t written;\n\
+  struct iovec *iov = stream->iov;\n\
+  int num_iov;\n\
+  if (stream->curr > stream->staged) {\n\
+    stream->iov[stream->num_iov].iov_base = stream->buffer + stream->staged;\n\
+    stream->iov[stream->num_iov].iov_len = stream->curr - stream->staged;\n\
+    stream->num_iov ++;\n\
+  }\n\
+  num_iov = stream->num_iov;\n\
+  stream->curr = stream->staged = 0;\n\
+  stream->num_iov = 0;\n\
+  while (num_iov > 0) {\n\
+    result = writev(stream->fd, iov, num_iov);\n\
     if (result < 0) {\n\
       if (errno != EINTR)\n\
         return HARIS_INPUT_ERROR;\n\
       else\n\
         continue;\n\
-    } else {\n\
-      bytes_written += result;\n\
     }\n\
-  } while (bytes_written < count);\n\
+    /* Skip past everything that was written; writev() can stop short */\n\
+    for (written = (size_t)result; \n\
+         num_iov > 0 && written >= iov->iov_len; \n\
+         num_iov --, iov ++)\n\
+      written -= iov->iov_len;\n\
+    if (num_iov > 0) {\n\
+      iov->iov_base = (char*)iov->iov_base + written;\n\
+      iov->iov_len -= written;\n\
+    }\n\
+  }\n\
   return HARIS_SUCCESS;\n\
 }\n\n");
+  /* Each large write takes one iovec, and the staged bytes before it take
+     another, so the stream is flushed when fewer than two are left. */
   CJOB_FMT_PRIV_FUNCTION(job,
 "static HarisStatus write_to_fd_stream(void *_stream,\n\
                                         const unsigned char *src,\n\
@@ -97,22 +232,35 @@ static CJobStatus write_static_fd_funcs(CJob *job)
 {\n\
   HarisFdStream *stream = (HarisFdStream*)_stream;\n\
   HarisStatus result;\n\
-  haris_uint32_t copy_size;\n\
-  HARIS_ASSERT(count <= 1000, SIZE);\n\
-  if (count == 0) return HARIS_SUCCESS;\n\
-  if (count + stream->curr > 1000) {\n\
-    copy_size = 1000 - stream->curr;\n\
-    memcpy(stream->buffer + stream->curr, src, copy_size);\n\
-    if ((result = force_write_to_fd_stream(stream->fd, stream->buffer,\n\
-                                           1000)) != HARIS_SUCCESS)\n\
+  if (stream->num_iov > HARIS_FD_IOV_COUNT - 2 ||\n\
+      (count <= 255 && count > HARIS_STREAM_CHUNK_SIZE - stream->curr))\n\
+    if ((result = flush_fd_stream(stream)) != HARIS_SUCCESS)\n\
       return result;\n\
-    memcpy(stream->buffer, src + copy_size, count - copy_size);\n\
-    stream->curr = count - copy_size;\n\
-  } else {\n\
+  if (count <= 255) {\n\
     memcpy(stream->buffer + stream->curr, src, count);\n\
     stream->curr += count;\n\
+    return HARIS_SUCCESS;\n\
   }\n\
+  if (stream->curr > stream->staged) {\n\
+    stream->iov[stream->num_iov].iov_base = stream->buffer + stream->staged;\n\
+    stream->iov[stream->num_iov].iov_len = stream->curr - stream->staged;\n\
+    stream->num_iov ++;\n\
+    stream->staged = stream->curr;\n\
+  }\n\
+  stream->iov[stream->num_iov].iov_base = (void*)src;\n\
+  stream->iov[stream->num_iov].iov_len = count;\n\
+  stream->num_iov ++;\n\
   return HARIS_SUCCESS;\n\
+}\n\n");
+  /* The iovecs of large writes point into the structure being encoded;
+     when that's a scratch element that's about to be refilled, they have
+     to be written out first. Any iovec at all means there's one of them. */
+  if (schema_has_struct_lists(job->schema))
+    CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus settle_fd_stream(void *stream)\n\
+{\n\
+  if (((HarisFdStream*)stream)->num_iov == 0) return HARIS_SUCCESS;\n\
+  return flush_fd_stream((HarisFdStream*)stream);\n\
 }\n\n");
   CJOB_FMT_PRIV_FUNCTION(job,
 "static HarisStatus _public_to_fd(void *ptr,\n\
@@ -126,12 +274,12 @@ static CJobStatus write_static_fd_funcs(CJob *job)
   if (encoded_size == 0) return result;\n\
   HARIS_ASSERT(encoded_size <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
   fd_stream.fd = fd;\n\
-  fd_stream.curr = 0;\n\
+  fd_stream.curr = fd_stream.staged = 0;\n\
+  fd_stream.num_iov = 0;\n\
   if ((result = _haris_to_stream(ptr, info, &fd_stream,\n\
-                                 write_to_fd_stream)) != HARIS_SUCCESS)\n\
-    return result;\n\
-  if ((result = force_write_to_fd_stream(fd, fd_stream.buffer, \n\
-                                         fd_stream.curr)) != HARIS_SUCCESS)\n\
+                                 write_to_fd_stream, 0))\n\
+      != HARIS_SUCCESS ||\n\
+      (result = flush_fd_stream(&fd_stream)) != HARIS_SUCCESS)\n\
     return result;\n\
   if (out_sz) *out_sz = encoded_size;\n\
   return HARIS_SUCCESS;\n\
@@ -147,16 +295,79 @@ static CJobStatus write_static_fd_funcs(CJob *job)
   fd_stream.fd = fd;\n\
   fd_stream.curr = 0;\n\
   if ((result = _haris_from_stream(ptr, info, &fd_stream,\n\
-                                   read_from_fd_stream, 0)) != HARIS_SUCCESS)\n\
+                                   read_from_fd_stream, NULL, 0))\n\
+      != HARIS_SUCCESS)\n\
     return result;\n\
   if (out_sz) *out_sz = fd_stream.curr;\n\
   return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus _public_from_fd_session(void *ptr,\n\
+                                           const HarisStructureInfo *info,\n\
+                                           HarisFdSession *session,\n\
+                                           haris_uint32_t *out_sz)\n\
+{\n\
+  HarisStatus result;\n\
+  session->curr = 0;\n\
+  if ((result = _haris_from_stream(ptr, info, session,\n\
+                                   read_from_fd_session, NULL, 0))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n\
+  if (out_sz) *out_sz = session->curr;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"void haris_fd_session_init(HarisFdSession *session, int fd)\n\
+{\n\
+  session->fd = fd;\n\
+  session->eof = 0;\n\
+  session->start = session->end = session->curr = 0;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus next_from_fd_session(void *ptr,\n\
+                                        const HarisStructureInfo *info,\n\
+                                        void *session,\n\
+                                        haris_uint32_t *out_sz)\n\
+{\n\
+  return _public_from_fd_session(ptr, info, (HarisFdSession*)session,\n\
+                                 out_sz);\n\
+}\n\n");
+  /* An empty session has to read to find out whether the descriptor has
+     more; as with files, a read error is left for the next read */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static int fd_session_at_end(void *_session)\n\
+{\n\
+  HarisFdSession *session = (HarisFdSession*)_session;\n\
+  ssize_t result;\n\
+  if (session->start < session->end) return 0;\n\
+  session->start = session->end = 0;\n\
+  while (!session->eof) {\n\
+    result = read(session->fd, session->buffer, HARIS_FD_SESSION_SIZE);\n\
+    if (result > 0) {\n\
+      session->end = (haris_uint32_t)result;\n\
+      return 0;\n\
+    } else if (result == 0) {\n\
+      session->eof = 1;\n\
+    } else if (errno != EINTR) {\n\
+      return 0;\n\
+    }\n\
+  }\n\
+  return 1;\n\
+}\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"void haris_stream_open_fd(HarisMessageStream *message_stream,\n\
+                          HarisFdSession *session)\n\
+{\n\
+  message_stream->stream = session;\n\
+  message_stream->next = next_from_fd_session;\n\
+  message_stream->at_end = fd_session_at_end;\n\
 }\n\n");
   return CJOB_SUCCESS;
 }
 
 static CJobStatus write_public_fd_funcs(CJob *job, ParsedStruct *strct)
 {
+  int i;
   const char *prefix = job->prefix, *name = strct->name;
   CJOB_FMT_PUB_FUNCTION(job,
 "HarisStatus %s%s_to_fd(%s%s *strct, int fd, \n\
@@ -172,5 +383,36 @@ static CJobStatus write_public_fd_funcs(CJob *job, ParsedStruct *strct)
   return _public_from_fd(strct, &haris_lib_structures[%d],\n\
                            fd, out_sz);\n}\n\n",
                         prefix, name, prefix, name, strct->schema_index);
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_from_fd_session(%s%s *strct, HarisFdSession *session,\n\
+                                 haris_uint32_t *out_sz)\n\
+{\n\
+  return _public_from_fd_session(strct, &haris_lib_structures[%d],\n\
+                                 session, out_sz);\n}\n\n",
+                        prefix, name, prefix, name, strct->schema_index);
+  for (i = 0; i < strct->num_children; i ++) {
+    ChildField *child = &strct->children[i];
+    if (child->tag != CHILD_STRUCT_LIST) continue;
+    CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_to_fd_producing_%s(%s%s *strct, haris_uint32_t count,\n\
+                                    HarisStatus (*next_element)(void *,\n\
+                                                                %s%s *),\n\
+                                    void *ctx, int fd,\n\
+                                    haris_uint32_t *out_sz)\n\
+{\n\
+  HarisStatus result;\n\
+  HarisFdStream fd_stream;\n\
+  fd_stream.fd = fd;\n\
+  fd_stream.curr = fd_stream.staged = 0;\n\
+  fd_stream.num_iov = 0;\n\
+  if ((result = %s%s_produce_%s(strct, count, next_element, ctx, &fd_stream,\n\
+                               write_to_fd_stream, settle_fd_stream,\n\
+                               out_sz)) != HARIS_SUCCESS)\n\
+    return result;\n\
+  return flush_fd_stream(&fd_stream);\n}\n\n",
+                          prefix, name, child->name, prefix, name,
+                          prefix, child->type.struct_list->name,
+                          prefix, name, child->name);
+  }
   return CJOB_SUCCESS;
 }
@@ -30,6 +30,9 @@ static CJobStatus write_file_structures(CJob *job)
      `buffer` is used for scratch space: the read calls read into the buffer,
      and the write calls use the array as a simple output buffer (that is,
      we write the bytes into the array until it's full and then call fwrite).
+     `sz` is the size of the buffer, which the user chooses when they set up
+     a stream with haris_file_stream_init; S_from_file and S_to_file use a
+     buffer of HARIS_FILE_BUFFER_SIZE bytes on the stack.
      `curr`'s meaning varies based on the context: in a read context, it stores
      the total number of bytes we've seen so far. This is used to make sure the
      message doesn't get too big. In a write context, it's used to store the
@@ -39,108 +42,264 @@ static CJobStatus write_file_structures(CJob *job)
 */
   CJOB_FMT_HEADER_STRING(job, "#include <stdio.h>\n\n");
   CJOB_FMT_HEADER_STRING(job,
-"typedef struct {\n\
+"/* The size of the buffer used by S_from_file and S_to_file. Streams set\n\
+   up with haris_file_stream_init use the buffer they're given instead;\n\
+   both must be at least 256 bytes long.\n\
+\n\
+   If HARIS_UNLOCKED_STDIO is 1, the file is locked once for each message\n\
+   with flockfile(), and short reads use getc_unlocked() rather than\n\
+   fread(). Both are POSIX functions, so this is off by default, and\n\
+   turning it on requires _POSIX_C_SOURCE >= 200112L to be defined before\n\
+   <stdio.h> is first included (on the command line, say).\n\
+*/\n\n\
+#ifndef HARIS_FILE_BUFFER_SIZE\n\
+#define HARIS_FILE_BUFFER_SIZE 8192\n\
+#endif\n\n\
+#ifndef HARIS_UNLOCKED_STDIO\n\
+#define HARIS_UNLOCKED_STDIO 0\n\
+#endif\n\n\
+#if HARIS_UNLOCKED_STDIO && \\\n\
+    (!defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200112L)\n\
+#error \"HARIS_UNLOCKED_STDIO requires _POSIX_C_SOURCE >= 200112L\"\n\
+#endif\n\n\
+typedef struct {\n\
   FILE *file;\n\
   haris_uint32_t curr;\n\
-  unsigned char buffer[1000];\n\
+  haris_uint32_t sz;\n\
+  unsigned char *buffer;\n\
 } HarisFileStream;\n\n");
   return CJOB_SUCCESS;
 }
 
 static CJobStatus write_static_file_funcs(CJob *job)
 {
+  /* Skips that are larger than the buffer are done with fseek, if the file
+     will let us. Seeking past the end of a file isn't an error, so the last
+     skipped byte is read to make sure it's really there. A buffer smaller
+     than a unit (which the header tells users not to set up) could never
+     make progress, so it's turned away rather than returning no units. */
   CJOB_FMT_PRIV_FUNCTION(job,
 "static HarisStatus read_from_file_stream(void *_stream,\n\
+                                         haris_uint32_t unit,\n\
                                          haris_uint32_t count,\n\
-                                         const unsigned char **dest)\n\
+                                         const unsigned char **dest,\n\
+                                         haris_uint32_t *got)\n\
 {\n\
   HarisFileStream *stream = (HarisFileStream*)_stream;\n\
-  HARIS_ASSERT(count + stream->curr <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
-  HARIS_ASSERT(count <= 1000, SIZE);\n\
-  HARIS_ASSERT(fread(stream->buffer, 1, count, stream->file) == count,\n\
-               INPUT);\n\
-  *dest = stream->buffer;\n\
-  stream->curr += count;\n\
+  haris_uint32_t size;\n\
+  HARIS_ASSERT(unit <= stream->sz, INPUT);\n\
+  if (!dest && count > stream->sz / unit) {\n\
+    HARIS_ASSERT(count <= (HARIS_MESSAGE_SIZE_LIMIT - stream->curr) / unit,\n\
+                 SIZE);\n\
+    size = count * unit;\n\
+    if (fseek(stream->file, (long)size - 1, SEEK_CUR) == 0) {\n\
+      HARIS_ASSERT(getc(stream->file) != EOF, INPUT);\n\
+      *got = count;\n\
+      stream->curr += size;\n\
+      return HARIS_SUCCESS;\n\
+    }\n\
+  }\n\
+  if (count > stream->sz / unit)\n\
+    count = stream->sz / unit;\n\
+  size = count * unit;\n\
+  HARIS_ASSERT(size + stream->curr <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
+#if HARIS_UNLOCKED_STDIO\n\
+  if (size <= 8) {\n\
+    haris_uint32_t i;\n\
+    int c;\n\
+    for (i = 0; i < size; i ++) {\n\
+      HARIS_ASSERT((c = getc_unlocked(stream->file)) != EOF, INPUT);\n\
+      stream->buffer[i] = (unsigned char)c;\n\
+    }\n\
+  } else\n\
+#endif\n\
+  HARIS_ASSERT(fread(stream->buffer, 1, size, stream->file) == size, INPUT);\n\
+  if (dest) *dest = stream->buffer;\n\
+  *got = count;\n\
+  stream->curr += size;\n\
   return HARIS_SUCCESS;\n\
 }\n\n");
   CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus flush_file_stream(HarisFileStream *stream)\n\
+{\n\
+  HARIS_ASSERT(fwrite(stream->buffer, 1, stream->curr, stream->file)\n\
+               == stream->curr, INPUT);\n\
+  stream->curr = 0;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  /* Writes that don't fit in the buffer flush it, and writes at least as
+     large as the buffer go straight to fwrite without being copied */
+  CJOB_FMT_PRIV_FUNCTION(job,
 "static HarisStatus write_to_file_stream(void *_stream,\n\
                                         const unsigned char *src,\n\
                                         haris_uint32_t count)\n\
 {\n\
   HarisFileStream *stream = (HarisFileStream*)_stream;\n\
-  haris_uint32_t copy_size;\n\
-  HARIS_ASSERT(count <= 1000, SIZE);\n\
-  if (count + stream->curr > 1000) {\n\
-    copy_size = 1000 - stream->curr;\n\
-    memcpy(stream->buffer + stream->curr, src, copy_size);\n\
-    HARIS_ASSERT(fwrite(stream->buffer, 1, 1000, stream->file) == count, \n\
-                        INPUT);\n\
-    memcpy(stream->buffer, src + copy_size, count - copy_size);\n\
-    stream->curr = count - copy_size;\n\
-  } else {\n\
-    memcpy(stream->buffer + stream->curr, src, count);\n\
-    stream->curr += count;\n\
+  HarisStatus result;\n\
+  if (count > stream->sz - stream->curr) {\n\
+    if ((result = flush_file_stream(stream)) != HARIS_SUCCESS)\n\
+      return result;\n\
+    if (count >= stream->sz) {\n\
+      HARIS_ASSERT(fwrite(src, 1, count, stream->file) == count, INPUT);\n\
+      return HARIS_SUCCESS;\n\
+    }\n\
   }\n\
+  memcpy(stream->buffer + stream->curr, src, count);\n\
+  stream->curr += count;\n\
   return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"void haris_file_stream_init(HarisFileStream *stream, FILE *f,\n\
+                            unsigned char *buffer, haris_uint32_t sz)\n\
+{\n\
+  stream->file = f;\n\
+  stream->buffer = buffer;\n\
+  stream->sz = sz;\n\
+  stream->curr = 0;\n\
 }\n\n");
   CJOB_FMT_PRIV_FUNCTION(job,
 "static HarisStatus _public_to_file(void *ptr,\n\
                                    const HarisStructureInfo *info,\n\
-                                   FILE *f,\n\
+                                   HarisFileStream *stream,\n\
                                    haris_uint32_t *out_sz)\n\
 {\n\
   HarisStatus result;\n\
-  HarisFileStream file_stream;\n\
   haris_uint32_t encoded_size = haris_lib_size(ptr, info, 0, &result);\n\
   if (encoded_size == 0) return result;\n\
   HARIS_ASSERT(encoded_size <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
-  file_stream.file = f;\n\
-  file_stream.curr = 0;\n\
-  if ((result = _haris_to_stream(ptr, info, &file_stream,\n\
-                                 write_to_file_stream)) != HARIS_SUCCESS)\n\
-    return result;\n\
-  HARIS_ASSERT(fwrite(file_stream.buffer, 1, file_stream.curr, \n\
-                      file_stream.file) == file_stream.curr, INPUT);\n\
+  stream->curr = 0;\n\
+#if HARIS_UNLOCKED_STDIO\n\
+  flockfile(stream->file);\n\
+#endif\n\
+  if ((result = _haris_to_stream(ptr, info, stream,\n\
+                                 write_to_file_stream, 0))\n\
+      == HARIS_SUCCESS)\n\
+    result = flush_file_stream(stream);\n\
+#if HARIS_UNLOCKED_STDIO\n\
+  funlockfile(stream->file);\n\
+#endif\n\
+  if (result != HARIS_SUCCESS) return result;\n\
   if (out_sz) *out_sz = encoded_size;\n\
   return HARIS_SUCCESS;\n\
 }\n\n");
   CJOB_FMT_PRIV_FUNCTION(job,
 "static HarisStatus _public_from_file(void *ptr,\n\
                                      const HarisStructureInfo *info,\n\
-                                     FILE *f,\n\
+                                     HarisFileStream *stream,\n\
                                      haris_uint32_t *out_sz)\n\
 {\n\
   HarisStatus result;\n\
-  HarisFileStream file_stream;\n\
-  file_stream.file = f;\n\
-  file_stream.curr = 0;\n\
-  if ((result = _haris_from_stream(ptr, info, &file_stream,\n\
-                                   read_from_file_stream, 0)) != HARIS_SUCCESS)\n\
-    return result;\n\
-  if (out_sz) *out_sz = file_stream.curr;\n\
+  stream->curr = 0;\n\
+#if HARIS_UNLOCKED_STDIO\n\
+  flockfile(stream->file);\n\
+#endif\n\
+  result = _haris_from_stream(ptr, info, stream, read_from_file_stream,\n\
+                              NULL, 0);\n\
+#if HARIS_UNLOCKED_STDIO\n\
+  funlockfile(stream->file);\n\
+#endif\n\
+  if (result != HARIS_SUCCESS) return result;\n\
+  if (out_sz) *out_sz = stream->curr;\n\
   return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus next_from_file_stream(void *ptr,\n\
+                                         const HarisStructureInfo *info,\n\
+                                         void *stream,\n\
+                                         haris_uint32_t *out_sz)\n\
+{\n\
+  return _public_from_file(ptr, info, (HarisFileStream*)stream, out_sz);\n\
+}\n\n");
+  /* A read error isn't the end of the file; the next read reports it */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static int file_stream_at_end(void *_stream)\n\
+{\n\
+  HarisFileStream *stream = (HarisFileStream*)_stream;\n\
+  int c = getc(stream->file);\n\
+  if (c == EOF)\n\
+    return feof(stream->file) != 0;\n\
+  ungetc(c, stream->file);\n\
+  return 0;\n\
+}\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"void haris_stream_open_file(HarisMessageStream *message_stream,\n\
+                            HarisFileStream *stream)\n\
+{\n\
+  message_stream->stream = stream;\n\
+  message_stream->next = next_from_file_stream;\n\
+  message_stream->at_end = file_stream_at_end;\n\
 }\n\n");
   return CJOB_SUCCESS;
 }
 
 static CJobStatus write_public_file_funcs(CJob *job, ParsedStruct *strct)
 {
+  int i;
   const char *prefix = job->prefix, *name = strct->name;
   CJOB_FMT_PUB_FUNCTION(job,
 "HarisStatus %s%s_to_file(%s%s *strct, FILE *f, \n\
                           haris_uint32_t *out_sz)\n\
 {\n\
+  unsigned char buffer[HARIS_FILE_BUFFER_SIZE];\n\
+  HarisFileStream stream;\n\
+  haris_file_stream_init(&stream, f, buffer, sizeof buffer);\n\
   return _public_to_file(strct, &haris_lib_structures[%d],\n\
-                         f, out_sz);\n}\n\n",
+                         &stream, out_sz);\n}\n\n",
                         prefix, name, prefix, name, strct->schema_index);
   CJOB_FMT_PUB_FUNCTION(job,
 "HarisStatus %s%s_from_file(%s%s *strct, FILE *f,\n\
                             haris_uint32_t *out_sz)\n\
 {\n\
+  unsigned char buffer[HARIS_FILE_BUFFER_SIZE];\n\
+  HarisFileStream stream;\n\
+  haris_file_stream_init(&stream, f, buffer, sizeof buffer);\n\
   return _public_from_file(strct, &haris_lib_structures[%d],\n\
-                           f, out_sz);\n}\n\n",
+                           &stream, out_sz);\n}\n\n",
                         prefix, name, prefix, name, strct->schema_index);
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_to_file_stream(%s%s *strct, HarisFileStream *stream,\n\
+                                 haris_uint32_t *out_sz)\n\
+{\n\
+  return _public_to_file(strct, &haris_lib_structures[%d],\n\
+                         stream, out_sz);\n}\n\n",
+                        prefix, name, prefix, name, strct->schema_index);
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_from_file_stream(%s%s *strct, HarisFileStream *stream,\n\
+                                   haris_uint32_t *out_sz)\n\
+{\n\
+  return _public_from_file(strct, &haris_lib_structures[%d],\n\
+                           stream, out_sz);\n}\n\n",
+                        prefix, name, prefix, name, strct->schema_index);
+  for (i = 0; i < strct->num_children; i ++) {
+    ChildField *child = &strct->children[i];
+    if (child->tag != CHILD_STRUCT_LIST) continue;
+    /* The file stream copies everything it's given, so it needs no help
+       to let go of the scratch element */
+    CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_to_file_producing_%s(%s%s *strct, haris_uint32_t count,\n\
+                                      HarisStatus (*next_element)(void *,\n\
+                                                                  %s%s *),\n\
+                                      void *ctx, FILE *f,\n\
+                                      haris_uint32_t *out_sz)\n\
+{\n\
+  unsigned char buffer[HARIS_FILE_BUFFER_SIZE];\n\
+  HarisFileStream stream;\n\
+  HarisStatus result;\n\
+  haris_file_stream_init(&stream, f, buffer, sizeof buffer);\n\
+#if HARIS_UNLOCKED_STDIO\n\
+  flockfile(f);\n\
+#endif\n\
+  if ((result = %s%s_produce_%s(strct, count, next_element, ctx, &stream,\n\
+                               write_to_file_stream, NULL, out_sz))\n\
+      == HARIS_SUCCESS)\n\
+    result = flush_file_stream(&stream);\n\
+#if HARIS_UNLOCKED_STDIO\n\
+  funlockfile(f);\n\
+#endif\n\
+  return result;\n}\n\n",
+                          prefix, name, child->name, prefix, name,
+                          prefix, child->type.struct_list->name,
+                          prefix, name, child->name);
+  }
   return CJOB_SUCCESS;
 }
-
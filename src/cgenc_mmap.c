@@ -0,0 +1,144 @@
+#include "cgenc_mmap.h"
+
+static CJobStatus write_mmap_structures(CJob *);
+static CJobStatus write_static_mmap_funcs(CJob *);
+static CJobStatus write_public_mmap_funcs(CJob *, ParsedStruct *);
+
+/* =============================PUBLIC INTERFACE============================= */
+
+CJobStatus write_mmap_protocol_funcs(CJob *job)
+{
+  CJobStatus result;
+  int i;
+  ParsedSchema *schema = job->schema;
+  if ((result = write_mmap_structures(job)) != CJOB_SUCCESS ||
+      (result = write_static_mmap_funcs(job)) != CJOB_SUCCESS)
+    return result;
+  for (i = 0; i < schema->num_structs; i ++) {
+    if ((result = write_public_mmap_funcs(job, &schema->structs[i]))
+        != CJOB_SUCCESS)
+      return result;
+  }
+  return CJOB_SUCCESS;
+}
+
+/* =============================STATIC FUNCTIONS============================= */
+
+static CJobStatus write_mmap_structures(CJob *job)
+{
+  CJOB_FMT_HEADER_STRING(job,
+"#include <stddef.h>\n#include <unistd.h>\n#include <fcntl.h>\n\
+#include <sys/types.h>\n#include <sys/stat.h>\n#include <sys/mman.h>\n\n");
+  /* An iterator walks over a file of back-to-back messages that has been
+     mapped into memory in its entirety. `base` and `sz` describe the
+     mapping, and `pos` is the offset of the next message to be decoded.
+     `curr` counts the bytes of the message being decoded, like the `curr`
+     member of the other streams. Messages are decoded straight out of
+     the mapping, so no bytes are copied except into the C structure. */
+  CJOB_FMT_HEADER_STRING(job,
+"typedef struct {\n\
+  const unsigned char *base;\n\
+  size_t sz;\n\
+  size_t pos;\n\
+  haris_uint32_t curr;\n\
+} HarisMmapIter;\n\n");
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_static_mmap_funcs(CJob *job)
+{
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus read_from_mmap_iter(void *_iter,\n\
+                                       haris_uint32_t unit,\n\
+                                       haris_uint32_t count,\n\
+                                       const unsigned char **dest,\n\
+                                       haris_uint32_t *got)\n\
+{\n\
+  HarisMmapIter *iter = (HarisMmapIter*)_iter;\n\
+  size_t avail = iter->sz - iter->pos;\n\
+  HARIS_ASSERT(unit <= avail, INPUT);\n\
+  HARIS_ASSERT(unit + iter->curr <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
+  if (avail > HARIS_MESSAGE_SIZE_LIMIT - iter->curr)\n\
+    avail = HARIS_MESSAGE_SIZE_LIMIT - iter->curr;\n\
+  if (count > avail / unit) count = (haris_uint32_t)(avail / unit);\n\
+  if (dest) *dest = iter->base + iter->pos;\n\
+  *got = count;\n\
+  iter->pos += count * unit;\n\
+  iter->curr += count * unit;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  /* The mapping is made with MAP_PRIVATE and PROT_READ, so nothing we do
+     can make it back to the file. An empty file can't be mapped, but it
+     is a perfectly good (empty) sequence of messages. posix_madvise() is
+     only declared when the right feature test macros are defined, hence
+     the #ifdef. */
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus haris_mmap_open(HarisMmapIter *iter, const char *path)\n\
+{\n\
+  struct stat st;\n\
+  void *addr;\n\
+  int fd = open(path, O_RDONLY);\n\
+  HARIS_ASSERT(fd >= 0, INPUT);\n\
+  if (fstat(fd, &st) < 0 || (off_t)(size_t)st.st_size != st.st_size) {\n\
+    close(fd);\n\
+    return HARIS_INPUT_ERROR;\n\
+  }\n\
+  iter->base = NULL;\n\
+  iter->sz = (size_t)st.st_size;\n\
+  iter->pos = 0;\n\
+  iter->curr = 0;\n\
+  if (iter->sz > 0) {\n\
+    addr = mmap(NULL, iter->sz, PROT_READ, MAP_PRIVATE, fd, 0);\n\
+    if (addr == MAP_FAILED) {\n\
+      close(fd);\n\
+      return HARIS_INPUT_ERROR;\n\
+    }\n\
+#ifdef POSIX_MADV_SEQUENTIAL\n\
+    posix_madvise(addr, iter->sz, POSIX_MADV_SEQUENTIAL);\n\
+#endif\n\
+    iter->base = (const unsigned char *)addr;\n\
+  }\n\
+  close(fd);\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"int haris_mmap_at_end(const HarisMmapIter *iter)\n\
+{\n\
+  return iter->pos == iter->sz;\n\
+}\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"void haris_mmap_close(HarisMmapIter *iter)\n\
+{\n\
+  if (iter->base)\n\
+    munmap((void *)iter->base, iter->sz);\n\
+  iter->base = NULL;\n\
+  iter->sz = iter->pos = 0;\n\
+}\n\n");
+  /* If a message can't be decoded, the iterator is left pointing at its
+     first byte, so the caller can see where the bad message starts. */
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus _public_mmap_next(void *ptr,\n\
+                                     const HarisStructureInfo *info,\n\
+                                     HarisMmapIter *iter)\n\
+{\n\
+  HarisStatus result;\n\
+  size_t start = iter->pos;\n\
+  iter->curr = 0;\n\
+  if ((result = _haris_from_stream(ptr, info, iter, read_from_mmap_iter,\n\
+                                   NULL, 0)) != HARIS_SUCCESS)\n\
+    iter->pos = start;\n\
+  return result;\n\
+}\n\n");
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_public_mmap_funcs(CJob *job, ParsedStruct *strct)
+{
+  const char *prefix = job->prefix, *name = strct->name;
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_mmap_next(HarisMmapIter *iter, %s%s *reuse)\n\
+{\n\
+  return _public_mmap_next(reuse, &haris_lib_structures[%d], iter);\n}\n\n",
+                        prefix, name, prefix, name, strct->schema_index);
+  return CJOB_SUCCESS;
+}
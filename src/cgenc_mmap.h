@@ -0,0 +1,8 @@
+#ifndef CGENC_MMAP_H_
+#define CGENC_MMAP_H_
+
+#include "cgen.h"
+
+CJobStatus write_mmap_protocol_funcs(CJob *);
+
+#endif
@@ -49,8 +49,8 @@ static CJobStatus write_readint(CJob *job)
   haris_int8_t *ptr = (haris_int8_t*)_ptr;\n\
   haris_uint8_t uint;\n\
   haris_read_uint8(b, &uint);\n\
-  if (*b & 0x80) \n\
-    *ptr = -(haris_int8_t)~(uint - 1);\n\
+  if (b[0] & 0x80)\n\
+    *ptr = (haris_int8_t)(-(haris_int8_t)(~uint & 0xFFU) - 1);\n\
   else\n\
     *ptr = (haris_int8_t)uint;\n\
 }\n\n");
@@ -60,8 +60,8 @@ static CJobStatus write_readint(CJob *job)
   haris_int16_t *ptr = (haris_int16_t*)_ptr;\n\
   haris_uint16_t uint;\n\
   haris_read_uint16(b, &uint);\n\
-  if (*b & 0x80)\n\
-    *ptr = -(haris_int16_t)~(uint - 1);\n\
+  if (b[1] & 0x80)\n\
+    *ptr = (haris_int16_t)(-(haris_int16_t)(~uint & 0xFFFFU) - 1);\n\
   else\n\
     *ptr = (haris_int16_t)uint;\n\
 }\n\n");
@@ -71,8 +71,8 @@ static CJobStatus write_readint(CJob *job)
   haris_int32_t *ptr = (haris_int32_t*)_ptr;\n\
   haris_uint32_t uint;\n\
   haris_read_uint32(b, &uint);\n\
-  if (*b & 0x80)\n\
-    *ptr = -(haris_int32_t)~(uint - 1);\n\
+  if (b[3] & 0x80)\n\
+    *ptr = (haris_int32_t)(-(haris_int32_t)(~uint & 0xFFFFFFFFUL) - 1);\n\
   else\n\
     *ptr = (haris_int32_t)uint;\n\
 }\n\n");
@@ -82,8 +82,8 @@ static CJobStatus write_readint(CJob *job)
   haris_int64_t *ptr = (haris_int64_t*)_ptr;\n\
   haris_uint64_t uint;\n\
   haris_read_uint64(b, &uint);\n\
-  if (*b & 0x80)\n\
-    *ptr = -(haris_int64_t)~(uint - 1);\n\
+  if (b[7] & 0x80)\n\
+    *ptr = -(haris_int64_t)~uint - 1;\n\
   else\n\
     *ptr = (haris_int64_t)uint;\n\
 }\n\n");
@@ -132,25 +132,21 @@ static CJobStatus write_readuint(CJob *job)
 
 static CJobStatus write_writeint(CJob *job)
 {
+  /* Converting to an unsigned type is defined to wrap modulo 2^N, so this
+     gives us the two's complement representation on any host, and it never
+     negates the most negative value. */
   CJOB_FMT_PRIV_FUNCTION(job, 
 "static void haris_write_int8(unsigned char *b, const void *_ptr)\n\
 {\n\
   haris_int8_t i = *(const haris_int8_t*)_ptr;\n\
-  if (i >= 0)\n\
-    *b = (unsigned char)i;\n\
-  else\n\
-    *b = ~(unsigned char)(-i) + (unsigned char)1;\n\
+  *b = (unsigned char)i;\n\
   return;\n\
 }\n\n");
   CJOB_FMT_PRIV_FUNCTION(job,
 "static void haris_write_int16(unsigned char *b, const void *_ptr)\n\
 {\n\
   haris_int16_t i = *(const haris_int16_t*)_ptr;\n\
-  haris_uint16_t ui;\n\
-  if (i >= 0)\n\
-    ui = (haris_uint16_t)i;\n\
-  else\n\
-    ui = ~(haris_uint16_t)(-i) + 1;\n\
+  haris_uint16_t ui = (haris_uint16_t)i;\n\
   haris_write_uint16(b, &ui);\n\
   return;\n\
 }\n\n");
@@ -158,11 +154,7 @@ static CJobStatus write_writeint(CJob *job)
 "static void haris_write_int32(unsigned char *b, const void *_ptr)\n\
 {\n\
   haris_int32_t i = *(const haris_int32_t*)_ptr;\n\
-  haris_uint32_t ui;\n\
-  if (i >= 0)\n\
-    ui = (haris_uint32_t)i;\n\
-  else\n\
-    ui = ~(haris_uint32_t)(-i) + 1;\n\
+  haris_uint32_t ui = (haris_uint32_t)i;\n\
   haris_write_uint32(b, &ui);\n\
   return;\n\
 }\n\n");
@@ -170,11 +162,7 @@ static CJobStatus write_writeint(CJob *job)
 "static void haris_write_int64(unsigned char *b, const void *_ptr)\n\
 {\n\
   haris_int64_t i = *(const haris_int64_t*)_ptr;\n\
-  haris_uint64_t ui;\n\
-  if (i >= 0)\n\
-    ui = (haris_uint64_t)i;\n\
-  else\n\
-    ui = ~(haris_uint64_t)(-i) + 1;\n\
+  haris_uint64_t ui = (haris_uint64_t)i;\n\
   haris_write_uint64(b, &ui);\n\
   return;\n\
 }\n\n");
@@ -234,11 +222,23 @@ static CJobStatus write_writeuint(CJob *job)
   return CJOB_SUCCESS;
 }
 
+/* On IEEE 754 hosts (see HARIS_IEEE_754 in the generated header), floats
+   are read and written by reinterpreting their bits as an integer of the
+   same width, which leaves only the byte-order conversion to do. Elsewhere,
+   we fall back on rebuilding the value arithmetically; that's portable, but
+   slow, and it doesn't handle subnormals, infinities, or NaN. */
 static CJobStatus write_readfloat(CJob *job)
 {
   CJOB_FMT_PRIV_FUNCTION(job, 
 "static void haris_read_float32(const unsigned char *b, void *_ptr)\n\
 {\n\
+#if HARIS_IEEE_754\n\
+  haris_uint32_t i;\n\
+  uint32_t bits;\n\
+  haris_read_uint32(b, &i);\n\
+  bits = (uint32_t)i;\n\
+  memcpy(_ptr, &bits, sizeof bits);\n\
+#else\n\
   haris_float32 *ptr = (haris_float32*)_ptr;\n\
   const int float32_sigbits = 23, float32_bias = 127;\n\
   haris_float64 result;\n\
@@ -259,10 +259,18 @@ static CJobStatus write_readfloat(CJob *job)
   result *= (i >> 31) & 1 ? -1.0: 1.0;\n\
 \n\
   *ptr = (haris_float32)result;\n\
+#endif\n\
 }\n\n");
   CJOB_FMT_PRIV_FUNCTION(job, 
 "static void haris_read_float64(const unsigned char *b, void *_ptr)\n\
 {\n\
+#if HARIS_IEEE_754\n\
+  haris_uint64_t i;\n\
+  uint64_t bits;\n\
+  haris_read_uint64(b, &i);\n\
+  bits = (uint64_t)i;\n\
+  memcpy(_ptr, &bits, sizeof bits);\n\
+#else\n\
   haris_float64 result, *ptr = (haris_float64*)_ptr;\n\
   const int float64_sigbits = 52, float64_bias = 1023;\n\
   haris_int64_t shift;\n\
@@ -282,6 +290,7 @@ static CJobStatus write_readfloat(CJob *job)
   result *= (i >> 63) & 1 ? -1.0: 1.0;\n\
 \n\
   *ptr = result;\n\
+#endif\n\
 }\n\n");
   return CJOB_SUCCESS;
 }
@@ -291,6 +300,13 @@ static CJobStatus write_writefloat(CJob *job)
   CJOB_FMT_PRIV_FUNCTION(job,  
 "static void haris_write_float32(unsigned char *b, const void *_ptr)\n\
 {\n\
+#if HARIS_IEEE_754\n\
+  haris_uint32_t i;\n\
+  uint32_t bits;\n\
+  memcpy(&bits, _ptr, sizeof bits);\n\
+  i = bits;\n\
+  haris_write_uint32(b, &i);\n\
+#else\n\
   haris_float32 f = *(const haris_float32*)_ptr;\n\
   haris_float64 fnorm;\n\
   int shift;\n\
@@ -323,10 +339,17 @@ static CJobStatus write_writefloat(CJob *job)
 \n\
   result = (sign<<31) | (exp<<23) | significand;\n\
   Finish:\n\
-  haris_write_uint32(b, &result);\n}\n\n");
+  haris_write_uint32(b, &result);\n#endif\n}\n\n");
   CJOB_FMT_PRIV_FUNCTION(job, 
 "static void haris_write_float64(unsigned char *b, const void *_ptr)\n\
 {\n\
+#if HARIS_IEEE_754\n\
+  haris_uint64_t i;\n\
+  uint64_t bits;\n\
+  memcpy(&bits, _ptr, sizeof bits);\n\
+  i = bits;\n\
+  haris_write_uint64(b, &i);\n\
+#else\n\
   haris_float64 fnorm, f = *(const haris_float64*)_ptr;\n\
   const int float64_sigbits = 52;\n\
   int shift;\n\
@@ -358,7 +381,7 @@ static CJobStatus write_writefloat(CJob *job)
 \n\
   result = (sign<<63) | (exp<<52) | significand;\n\
   Finish:\n\
-  haris_write_uint64(b, &result);\n}\n\n");
+  haris_write_uint64(b, &result);\n#endif\n}\n\n");
   return CJOB_SUCCESS;
 }
 
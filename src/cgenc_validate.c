@@ -0,0 +1,296 @@
+#include "cgenc_validate.h"
+
+/* Validators check that an encoded buffer holds a well-formed message of
+   a given structure, without decoding it. For a structure S, we generate
+
+   HarisStatus S_validate_buffer(const unsigned char *, haris_uint32_t,
+                                 haris_uint32_t *);
+
+   ... which walks the message against the HarisStructureInfo of S and
+   succeeds, reporting the exact length of the message, if and only if 
+   S_from_buffer would succeed on the same bytes. Every header, 
+   nullability rule and limit that the decoder enforces is checked, but
+   nothing is allocated and nothing is copied, so a validator can be put
+   in front of untrusted input to turn away bad messages cheaply.
+
+   We also generate
+
+   HarisStatus haris_scan_length(const unsigned char *, size_t, size_t *);
+
+   ... which finds the length of the message at the front of a buffer from
+   its headers alone, without knowing its type. It is meant for code that
+   splits a stream of bytes into messages and passes them along.
+*/
+
+static CJobStatus write_scan_funcs(CJob *);
+static CJobStatus write_static_validate_funcs(CJob *);
+static CJobStatus write_public_validate_funcs(CJob *, ParsedStruct *);
+
+/* =============================PUBLIC INTERFACE============================= */
+
+CJobStatus write_validate_funcs(CJob *job)
+{
+  CJobStatus result;
+  int i;
+  ParsedSchema *schema = job->schema;
+  if ((result = write_scan_funcs(job)) != CJOB_SUCCESS ||
+      (result = write_static_validate_funcs(job)) != CJOB_SUCCESS)
+    return result;
+  for (i = 0; i < schema->num_structs; i++) {
+    if ((result = write_public_validate_funcs(job, &schema->structs[i]))
+        != CJOB_SUCCESS)
+      return result;
+  }
+  return CJOB_SUCCESS;
+}
+
+/* =============================STATIC FUNCTIONS============================= */
+
+/* The scanner keeps its own stack rather than recursing, one frame for
+   every structure whose children are still being walked. A frame that
+   stands for a list of structures also counts the elements that are
+   left, all of which share the header in `children` and `body_size`.
+   The index of a frame is the depth of the structures it walks, so the
+   stack never needs more than HARIS_DEPTH_LIMIT + 1 frames. */
+static CJobStatus write_scan_funcs(CJob *job)
+{
+  CJOB_FMT_SOURCE_STRING(job,
+"typedef struct {\n\
+  int children_left;\n\
+  int children;\n\
+  int body_size;\n\
+  haris_uint32_t elements_left;\n\
+} HarisScanFrame;\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_scan_advance(size_t *pos, size_t sz,\n\
+                                          haris_uint64_t n)\n\
+{\n\
+  HARIS_ASSERT((haris_uint64_t)*pos + n <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
+  HARIS_ASSERT(n <= sz - *pos, INPUT);\n\
+  *pos += (size_t)n;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus haris_scan_length(const unsigned char *buf, size_t sz,\n\
+                              size_t *len)\n\
+{\n\
+  HarisScanFrame stack[HARIS_DEPTH_LIMIT + 1], *frame;\n\
+  HarisStatus result;\n\
+  haris_uint32_t list_len;\n\
+  size_t pos = 0;\n\
+  int depth = 0;\n\
+  const unsigned char *header;\n\
+  HARIS_ASSERT(sz >= 1, INPUT);\n\
+  HARIS_ASSERT(buf[0] && !(buf[0] & 0x80), STRUCTURE);\n\
+  HARIS_ASSERT(sz >= 2, INPUT);\n\
+  if ((result = haris_lib_scan_advance(&pos, sz, 2U + buf[1]))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n\
+  stack[0].children_left = buf[0] & 0x3F;\n\
+  stack[0].elements_left = 0;\n\
+  while (depth >= 0) {\n\
+    frame = &stack[depth];\n\
+    if (frame->children_left == 0) {\n\
+      if (frame->elements_left == 0) {\n\
+        depth --;\n\
+        continue;\n\
+      }\n\
+      /* On to the next element of a list */\n\
+      frame->elements_left --;\n\
+      frame->children_left = frame->children;\n\
+      if ((result = haris_lib_scan_advance(&pos, sz,\n\
+                                           (haris_uint64_t)frame->body_size))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      continue;\n\
+    }\n\
+    frame->children_left --;\n\
+    header = buf + pos;\n\
+    HARIS_ASSERT(pos < sz, INPUT);\n\
+    if (!header[0]) {\n\
+      if ((result = haris_lib_scan_advance(&pos, sz, 1)) != HARIS_SUCCESS)\n\
+        return result;\n\
+    } else if ((header[0] & 0xC0) == 0x40) { /* structure */\n\
+      HARIS_ASSERT(depth < HARIS_DEPTH_LIMIT, DEPTH);\n\
+      if ((result = haris_lib_scan_advance(&pos, sz, 2)) != HARIS_SUCCESS ||\n\
+          (result = haris_lib_scan_advance(&pos, sz, header[1]))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      if (header[0] & 0x3F) {\n\
+        frame = &stack[++ depth];\n\
+        frame->children_left = header[0] & 0x3F;\n\
+        frame->elements_left = 0;\n\
+      }\n\
+    } else if ((header[0] & 0xC0) == 0x80) { /* list of scalars */\n\
+      if ((result = haris_lib_scan_advance(&pos, sz, 4)) != HARIS_SUCCESS)\n\
+        return result;\n\
+      haris_read_uint24(header + 1, &list_len);\n\
+      if ((result = haris_lib_scan_advance(&pos, sz, (haris_uint64_t)list_len *\n\
+             haris_lib_message_size_from_bit_pattern[header[0] & 0x3]))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+    } else { /* list of structures */\n\
+      if ((result = haris_lib_scan_advance(&pos, sz, 6)) != HARIS_SUCCESS)\n\
+        return result;\n\
+      haris_read_uint24(header + 1, &list_len);\n\
+      if (list_len == 0) continue;\n\
+      HARIS_ASSERT(depth < HARIS_DEPTH_LIMIT, DEPTH);\n\
+      if ((header[4] & 0x3F) == 0) {\n\
+        /* Elements without children are laid out back to back */\n\
+        if ((result = haris_lib_scan_advance(&pos, sz,\n\
+                                             (haris_uint64_t)list_len *\n\
+                                             header[5])) != HARIS_SUCCESS)\n\
+          return result;\n\
+        continue;\n\
+      }\n\
+      frame = &stack[++ depth];\n\
+      frame->children_left = 0;\n\
+      frame->children = header[4] & 0x3F;\n\
+      frame->body_size = header[5];\n\
+      frame->elements_left = list_len;\n\
+    }\n\
+  }\n\
+  *len = pos;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  return CJOB_SUCCESS;
+}
+
+/* `info` and `child` are NULL for structures and children that the schema
+   doesn't know about (because a newer version of the schema added them);
+   for those, only the shape of the encoding can be checked. Every size is
+   checked against `sz` before it's added to anything, and `sz` is a 
+   haris_uint32_t, so none of the sums can overflow. */
+static CJobStatus write_static_validate_funcs(CJob *job)
+{
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_validate_body(const unsigned char *buf,\n\
+                                           haris_uint32_t sz,\n\
+                                           const HarisStructureInfo *info,\n\
+                                           int num_children, int body_size,\n\
+                                           int depth, haris_uint32_t *out)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t consumed = (haris_uint32_t)body_size, child_size;\n\
+  int i;\n\
+  HARIS_ASSERT(depth <= HARIS_DEPTH_LIMIT, DEPTH);\n\
+  HARIS_ASSERT(!info || (body_size >= info->body_size &&\n\
+                         num_children >= info->num_children), STRUCTURE);\n\
+  HARIS_ASSERT(consumed <= sz, INPUT);\n\
+  for (i = 0; i < num_children; i ++) {\n\
+    if ((result = haris_lib_validate_child(buf + consumed, sz - consumed,\n\
+                                           (info && i < info->num_children ?\n\
+                                            &info->children[i] : NULL),\n\
+                                           depth, &child_size))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    consumed += child_size;\n\
+  }\n\
+  *out = consumed;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_validate_child(const unsigned char *buf,\n\
+                                            haris_uint32_t sz,\n\
+                                            const HarisChild *child,\n\
+                                            int depth, haris_uint32_t *out)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t len, j, consumed, element_size;\n\
+  const HarisStructureInfo *element =\n\
+    (child ? child->struct_element : NULL);\n\
+  HARIS_ASSERT(sz >= 1, INPUT);\n\
+  if (!buf[0]) {\n\
+    HARIS_ASSERT(!child || child->nullable, STRUCTURE);\n\
+    *out = 1;\n\
+    return HARIS_SUCCESS;\n\
+  }\n\
+  switch (buf[0] & 0xC0) {\n\
+  case 0x40:\n\
+    HARIS_ASSERT(!child || child->child_type == HARIS_CHILD_STRUCT ||\n\
+                 child->child_type == HARIS_CHILD_EMBEDDED_STRUCT, STRUCTURE);\n\
+    HARIS_ASSERT(sz >= 2, INPUT);\n\
+    if ((result = haris_lib_validate_body(buf + 2, sz - 2, element,\n\
+                                          buf[0] & 0x3F, buf[1], depth + 1,\n\
+                                          out)) != HARIS_SUCCESS)\n\
+      return result;\n\
+    *out += 2;\n\
+    return HARIS_SUCCESS;\n\
+  case 0x80:\n\
+    HARIS_ASSERT(!child ||\n\
+                 ((child->child_type == HARIS_CHILD_TEXT ||\n\
+                   child->child_type == HARIS_CHILD_SCALAR_LIST) &&\n\
+                  buf[0] == (0x80 |\n\
+                    haris_lib_scalar_bit_patterns[child->scalar_element])),\n\
+                 STRUCTURE);\n\
+    HARIS_ASSERT(sz >= 4, INPUT);\n\
+    haris_read_uint24(buf + 1, &len);\n\
+    consumed = 4 + len * \n\
+      (haris_uint32_t)haris_lib_message_size_from_bit_pattern[buf[0] & 0x3];\n\
+    HARIS_ASSERT(consumed <= sz, INPUT);\n\
+    *out = consumed;\n\
+    return HARIS_SUCCESS;\n\
+  default:\n\
+    HARIS_ASSERT(!child || (child->child_type == HARIS_CHILD_STRUCT_LIST &&\n\
+                            buf[0] == 0xC0), STRUCTURE);\n\
+    HARIS_ASSERT(sz >= 6, INPUT);\n\
+    HARIS_ASSERT(!child || (buf[4] & 0xC0) == 0x40, STRUCTURE);\n\
+    haris_read_uint24(buf + 1, &len);\n\
+    if (len > 0 && (buf[4] & 0x3F) == 0 &&\n\
+        (!element || element->num_children == 0)) {\n\
+      /* The elements are nothing but bodies, so the list can be measured\n\
+         without visiting them */\n\
+      HARIS_ASSERT(depth + 1 <= HARIS_DEPTH_LIMIT, DEPTH);\n\
+      HARIS_ASSERT(!element || buf[5] >= element->body_size, STRUCTURE);\n\
+      consumed = 6 + len * buf[5];\n\
+      HARIS_ASSERT(consumed <= sz, INPUT);\n\
+      *out = consumed;\n\
+      return HARIS_SUCCESS;\n\
+    }\n\
+    for (j = 0, consumed = 6; j < len; j ++) {\n\
+      if ((result = haris_lib_validate_body(buf + consumed, sz - consumed,\n\
+                                            element, buf[4] & 0x3F, buf[5],\n\
+                                            depth + 1, &element_size))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      consumed += element_size;\n\
+    }\n\
+    *out = consumed;\n\
+    return HARIS_SUCCESS;\n\
+  }\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus _public_validate_buffer(const HarisStructureInfo *info,\n\
+                                           const unsigned char *buf,\n\
+                                           haris_uint32_t sz,\n\
+                                           haris_uint32_t *consumed)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t body_and_children;\n\
+  HARIS_ASSERT(sz >= 1, INPUT);\n\
+  HARIS_ASSERT(buf[0] && !(buf[0] & 0x80), STRUCTURE);\n\
+  HARIS_ASSERT(sz >= 2, INPUT);\n\
+  if ((result = haris_lib_validate_body(buf + 2, sz - 2, info, buf[0] & 0x3F,\n\
+                                        buf[1], 0, &body_and_children))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n\
+  HARIS_ASSERT(body_and_children + 2 <= HARIS_MESSAGE_SIZE_LIMIT, SIZE);\n\
+  if (consumed) *consumed = body_and_children + 2;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_public_validate_funcs(CJob *job, ParsedStruct *strct)
+{
+  const char *prefix = job->prefix, *name = strct->name;
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_validate_buffer(const unsigned char *buf,\n\
+                                  haris_uint32_t sz,\n\
+                                  haris_uint32_t *consumed)\n\
+{\n\
+  return _public_validate_buffer(&haris_lib_structures[%d], buf, sz,\n\
+                                 consumed);\n}\n\n",
+                        prefix, name, strct->schema_index);
+  return CJOB_SUCCESS;
+}
@@ -0,0 +1,8 @@
+#ifndef CGENC_VALIDATE_H_
+#define CGENC_VALIDATE_H_
+
+#include "cgen.h"
+
+CJobStatus write_validate_funcs(CJob *);
+
+#endif
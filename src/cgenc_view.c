@@ -0,0 +1,442 @@
+#include "cgenc_view.h"
+
+/* Views are read-only windows onto structures in an encoded buffer. Every
+   accessor reads its field straight out of the message; nothing is
+   allocated and nothing besides the requested field is decoded. For a
+   structure S with a scalar field X, a structure field C and a list field
+   L, we generate
+
+   HarisStatus S_view_from_buffer(S_view *, const unsigned char *,
+                                  haris_uint32_t);
+   T S_view_get_X(const S_view *);
+   HarisStatus S_view_get_C(const S_view *, C_view *);
+   HarisStatus S_view_get_L(const S_view *, HarisListView *);
+
+   ... and, for every element of L,
+
+   HarisStatus S_view_L_at(const HarisListView *, haris_uint32_t, T *);
+     ... if L is a list of scalars (Text can be read directly from the
+     `ptr` member of the list view), or
+   HarisStatus S_view_L_at(const HarisListView *, haris_uint32_t, E_view *);
+   HarisStatus S_view_L_next(HarisListView *, E_view *);
+     ... if L is a list of structures E.
+
+   Getting a child walks over the children that precede it in the message,
+   so it costs time proportional to their encoded size; structures that
+   are read many times should be decoded normally instead. The same goes
+   for S_view_L_at on elements that have children, so a list is best read
+   in order with S_view_L_next, which takes the elements off the front of
+   the list view one at a time.
+
+   S_view_get_X reads straight out of the body, so it must not be called
+   on the view of a null structure; HARIS_VIEW_IS_NULL tells them apart.
+*/
+
+static CJobStatus write_view_structures(CJob *);
+static CJobStatus write_static_view_funcs(CJob *);
+static CJobStatus write_public_view_funcs(CJob *, ParsedStruct *);
+static CJobStatus write_view_child_funcs(CJob *, ParsedStruct *, int);
+
+/* =============================PUBLIC INTERFACE============================= */
+
+CJobStatus write_view_funcs(CJob *job)
+{
+  CJobStatus result;
+  int i;
+  ParsedSchema *schema = job->schema;
+  if ((result = write_view_structures(job)) != CJOB_SUCCESS ||
+      (result = write_static_view_funcs(job)) != CJOB_SUCCESS)
+    return result;
+  for (i = 0; i < schema->num_structs; i++) {
+    if ((result = write_public_view_funcs(job, &schema->structs[i]))
+        != CJOB_SUCCESS)
+      return result;
+  }
+  return CJOB_SUCCESS;
+}
+
+/* =============================STATIC FUNCTIONS============================= */
+
+static CJobStatus write_view_structures(CJob *job)
+{
+  int i;
+  /* A view of a null structure or list has a NULL `body` or `ptr`. `sz` is
+     the number of bytes in the buffer from `body` or `ptr` onward; every
+     access is checked against it. The header of a structure list applies
+     to every element, so list views carry it along. */
+  CJOB_FMT_HEADER_STRING(job,
+"/* A view of a null structure has no body, so none of its scalars can be\n\
+   read. */\n\
+#define HARIS_VIEW_IS_NULL(view) ((view)->body == NULL)\n\n\
+typedef struct {\n\
+  const unsigned char *body;\n\
+  haris_uint32_t sz;\n\
+  int body_size;\n\
+  int num_children;\n\
+} HarisView;\n\n\
+typedef struct {\n\
+  const unsigned char *ptr;\n\
+  haris_uint32_t sz;\n\
+  haris_uint32_t len;\n\
+  int body_size;\n\
+  int num_children;\n\
+} HarisListView;\n\n");
+  for (i = 0; i < job->schema->num_structs; i ++)
+    CJOB_FMT_HEADER_STRING(job, "typedef HarisView %s%s_view;\n", 
+                           job->prefix, job->schema->structs[i].name);
+  CJOB_FMT_HEADER_STRING(job, "\n");
+  return CJOB_SUCCESS;
+}
+
+/* Only the helpers that some structure in the schema uses are written, so
+   that the generated source compiles cleanly with -Wunused-function. */
+static CJobStatus write_static_view_funcs(CJob *job)
+{
+  int i, j, has_struct = 0, has_list = 0, has_struct_list = 0;
+  ParsedSchema *schema = job->schema;
+  for (i = 0; i < schema->num_structs; i ++) {
+    for (j = 0; j < schema->structs[i].num_children; j ++) {
+      switch (schema->structs[i].children[j].tag) {
+      case CHILD_STRUCT:
+        has_struct = 1;
+        break;
+      case CHILD_STRUCT_LIST:
+        has_struct_list = 1;
+        /* Fall through */
+      case CHILD_TEXT:
+      case CHILD_SCALAR_LIST:
+        has_list = 1;
+        break;
+      }
+    }
+  }
+  if (has_struct || has_list)
+    CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_view_skip_body(const unsigned char *buf,\n\
+                                            haris_uint32_t sz,\n\
+                                            int body_size, int num_children,\n\
+                                            int depth, haris_uint32_t *out)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t consumed = (haris_uint32_t)body_size, child_size;\n\
+  int i;\n\
+  HARIS_ASSERT(depth <= HARIS_DEPTH_LIMIT, DEPTH);\n\
+  HARIS_ASSERT(consumed <= sz, INPUT);\n\
+  for (i = 0; i < num_children; i ++) {\n\
+    if ((result = haris_lib_view_skip_child(buf + consumed, sz - consumed,\n\
+                                            depth + 1, &child_size))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    consumed += child_size;\n\
+  }\n\
+  *out = consumed;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  if (has_struct || has_list)
+    CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_view_skip_child(const unsigned char *buf,\n\
+                                             haris_uint32_t sz, int depth,\n\
+                                             haris_uint32_t *out)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t len, j, consumed, element_size;\n\
+  HARIS_ASSERT(sz >= 1, INPUT);\n\
+  if (!buf[0]) {\n\
+    *out = 1;\n\
+    return HARIS_SUCCESS;\n\
+  }\n\
+  switch (buf[0] & 0xC0) {\n\
+  case 0x40:\n\
+    HARIS_ASSERT(sz >= 2, INPUT);\n\
+    if ((result = haris_lib_view_skip_body(buf + 2, sz - 2, buf[1],\n\
+                                           buf[0] & 0x3F, depth, out))\n\
+        != HARIS_SUCCESS)\n\
+      return result;\n\
+    *out += 2;\n\
+    return HARIS_SUCCESS;\n\
+  case 0x80:\n\
+    HARIS_ASSERT(sz >= 4, INPUT);\n\
+    haris_read_uint24(buf + 1, &len);\n\
+    consumed = 4 + len * \n\
+      (haris_uint32_t)haris_lib_message_size_from_bit_pattern[buf[0] & 0x3];\n\
+    HARIS_ASSERT(consumed <= sz, INPUT);\n\
+    *out = consumed;\n\
+    return HARIS_SUCCESS;\n\
+  case 0xC0:\n\
+    HARIS_ASSERT(sz >= 6, INPUT);\n\
+    HARIS_ASSERT((buf[4] & 0xC0) == 0x40, STRUCTURE);\n\
+    haris_read_uint24(buf + 1, &len);\n\
+    for (j = 0, consumed = 6; j < len; j ++) {\n\
+      if ((result = haris_lib_view_skip_body(buf + consumed, sz - consumed,\n\
+                                             buf[5], buf[4] & 0x3F,\n\
+                                             depth, &element_size))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      consumed += element_size;\n\
+    }\n\
+    *out = consumed;\n\
+    return HARIS_SUCCESS;\n\
+  }\n\
+  return HARIS_STRUCTURE_ERROR;\n\
+}\n\n");
+  /* Finds the given child of the viewed structure in the buffer */
+  if (has_struct || has_list)
+    CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_view_find_child(const HarisView *view,\n\
+                                             int field,\n\
+                                             const unsigned char **out,\n\
+                                             haris_uint32_t *out_sz)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t consumed = (haris_uint32_t)view->body_size, child_size;\n\
+  int i;\n\
+  HARIS_ASSERT(view->body, STRUCTURE);\n\
+  for (i = 0; i < field; i ++) {\n\
+    if ((result = haris_lib_view_skip_child(view->body + consumed,\n\
+                                            view->sz - consumed, 1,\n\
+                                            &child_size)) != HARIS_SUCCESS)\n\
+      return result;\n\
+    consumed += child_size;\n\
+  }\n\
+  HARIS_ASSERT(consumed < view->sz, INPUT);\n\
+  *out = view->body + consumed;\n\
+  *out_sz = view->sz - consumed;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_view_struct(const unsigned char *buf,\n\
+                                         haris_uint32_t sz,\n\
+                                         const HarisStructureInfo *info,\n\
+                                         int nullable, HarisView *out)\n\
+{\n\
+  HARIS_ASSERT(sz >= 1, INPUT);\n\
+  if (!buf[0]) {\n\
+    HARIS_ASSERT(nullable, STRUCTURE);\n\
+    out->body = NULL;\n\
+    out->sz = 0;\n\
+    out->body_size = out->num_children = 0;\n\
+    return HARIS_SUCCESS;\n\
+  }\n\
+  HARIS_ASSERT((buf[0] & 0xC0) == 0x40, STRUCTURE);\n\
+  HARIS_ASSERT(sz >= 2, INPUT);\n\
+  HARIS_ASSERT(buf[1] >= info->body_size && \n\
+               (buf[0] & 0x3F) >= info->num_children, STRUCTURE);\n\
+  HARIS_ASSERT((haris_uint32_t)buf[1] <= sz - 2, INPUT);\n\
+  out->body = buf + 2;\n\
+  out->sz = sz - 2;\n\
+  out->body_size = buf[1];\n\
+  out->num_children = buf[0] & 0x3F;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  if (has_struct)
+    CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_view_get_struct(const HarisView *view,\n\
+                                             const HarisStructureInfo *info,\n\
+                                             int field, HarisView *out)\n\
+{\n\
+  HarisStatus result;\n\
+  const unsigned char *child;\n\
+  haris_uint32_t sz;\n\
+  if ((result = haris_lib_view_find_child(view, field, &child, &sz))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n\
+  return haris_lib_view_struct(child, sz, info->children[field].struct_element,\n\
+                               info->children[field].nullable, out);\n\
+}\n\n");
+  if (has_list)
+    CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_view_get_list(const HarisView *view,\n\
+                                           const HarisStructureInfo *info,\n\
+                                           int field, HarisListView *out)\n\
+{\n\
+  HarisStatus result;\n\
+  const unsigned char *buf;\n\
+  haris_uint32_t sz;\n\
+  const HarisChild *child = &info->children[field];\n\
+  if ((result = haris_lib_view_find_child(view, field, &buf, &sz))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n\
+  out->body_size = out->num_children = 0;\n\
+  if (!buf[0]) {\n\
+    HARIS_ASSERT(child->nullable, STRUCTURE);\n\
+    out->ptr = NULL;\n\
+    out->sz = out->len = 0;\n\
+    return HARIS_SUCCESS;\n\
+  }\n\
+  if (child->child_type == HARIS_CHILD_STRUCT_LIST) {\n\
+    HARIS_ASSERT(buf[0] == 0xC0, STRUCTURE);\n\
+    HARIS_ASSERT(sz >= 6, INPUT);\n\
+    HARIS_ASSERT((buf[4] & 0xC0) == 0x40, STRUCTURE);\n\
+    out->num_children = buf[4] & 0x3F;\n\
+    out->body_size = buf[5];\n\
+    HARIS_ASSERT(out->body_size >= child->struct_element->body_size &&\n\
+                 out->num_children >= child->struct_element->num_children,\n\
+                 STRUCTURE);\n\
+    haris_read_uint24(buf + 1, &out->len);\n\
+    out->ptr = buf + 6;\n\
+    out->sz = sz - 6;\n\
+  } else {\n\
+    HARIS_ASSERT(buf[0] == (0x80 | \n\
+                            haris_lib_scalar_bit_patterns[child->scalar_element]),\n\
+                 STRUCTURE);\n\
+    HARIS_ASSERT(sz >= 4, INPUT);\n\
+    haris_read_uint24(buf + 1, &out->len);\n\
+    out->ptr = buf + 4;\n\
+    out->sz = sz - 4;\n\
+    HARIS_ASSERT(out->len * \n\
+                 haris_lib_message_scalar_sizes[child->scalar_element] \n\
+                 <= out->sz, INPUT);\n\
+  }\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  if (has_struct_list)
+    CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_view_struct_at(const HarisListView *list,\n\
+                                            haris_uint32_t i,\n\
+                                            HarisView *out)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t j, consumed = 0, element_size;\n\
+  HARIS_ASSERT(list->ptr && i < list->len, INPUT);\n\
+  if (list->num_children == 0) {\n\
+    /* Elements without children are laid out back to back */\n\
+    consumed = i * (haris_uint32_t)list->body_size;\n\
+    HARIS_ASSERT(consumed <= list->sz, INPUT);\n\
+  } else {\n\
+    for (j = 0; j < i; j ++) {\n\
+      if ((result = haris_lib_view_skip_body(list->ptr + consumed,\n\
+                                             list->sz - consumed,\n\
+                                             list->body_size,\n\
+                                             list->num_children, 1,\n\
+                                             &element_size))\n\
+          != HARIS_SUCCESS)\n\
+        return result;\n\
+      consumed += element_size;\n\
+    }\n\
+  }\n\
+  HARIS_ASSERT((haris_uint32_t)list->body_size <= list->sz - consumed, INPUT);\n\
+  out->body = list->ptr + consumed;\n\
+  out->sz = list->sz - consumed;\n\
+  out->body_size = list->body_size;\n\
+  out->num_children = list->num_children;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  /* Takes the first element off the front of the list view, so reading a
+     whole list this way costs time proportional to its encoded size */
+  if (has_struct_list)
+    CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus haris_lib_view_struct_next(HarisListView *list,\n\
+                                              HarisView *out)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t element_size;\n\
+  HARIS_ASSERT(list->ptr && list->len > 0, INPUT);\n\
+  if ((result = haris_lib_view_skip_body(list->ptr, list->sz,\n\
+                                         list->body_size, list->num_children,\n\
+                                         1, &element_size)) != HARIS_SUCCESS)\n\
+    return result;\n\
+  out->body = list->ptr;\n\
+  out->sz = list->sz;\n\
+  out->body_size = list->body_size;\n\
+  out->num_children = list->num_children;\n\
+  list->ptr += element_size;\n\
+  list->sz -= element_size;\n\
+  list->len --;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_public_view_funcs(CJob *job, ParsedStruct *strct)
+{
+  CJobStatus result;
+  int i;
+  const char *prefix = job->prefix, *name = strct->name;
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_view_from_buffer(%s%s_view *view, const unsigned char *buf,\n\
+                                   haris_uint32_t sz)\n\
+{\n\
+  return haris_lib_view_struct(buf, sz, &haris_lib_structures[%d], 0, view);\n\
+}\n\n",
+                        prefix, name, prefix, name, strct->schema_index);
+  for (i = 0; i < strct->num_scalars; i ++) {
+    ScalarField *scalar = &strct->scalars[i];
+    const char *type_name = scalar_type_name(scalar->type.tag);
+    CJOB_FMT_PUB_FUNCTION(job,
+"%s %s%s_view_get_%s(const %s%s_view *view)\n\
+{\n\
+  %s ret;\n\
+  haris_read_%s(view->body + %d, &ret);\n\
+  return ret;\n\
+}\n\n",
+                          type_name, prefix, name, scalar->name, prefix, name,
+                          type_name, scalar_function_suffix(scalar->type.tag),
+                          scalar->offset);
+  }
+  for (i = 0; i < strct->num_children; i ++) {
+    if ((result = write_view_child_funcs(job, strct, i)) != CJOB_SUCCESS)
+      return result;
+  }
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_view_child_funcs(CJob *job, ParsedStruct *strct,
+                                         int field)
+{
+  const char *prefix = job->prefix, *name = strct->name;
+  ChildField *child = &strct->children[field];
+  switch (child->tag) {
+  case CHILD_STRUCT:
+    CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_view_get_%s(const %s%s_view *view, %s%s_view *out)\n\
+{\n\
+  return haris_lib_view_get_struct(view, &haris_lib_structures[%d], %d, out);\n\
+}\n\n",
+                          prefix, name, child->name, prefix, name,
+                          prefix, child->type.strct->name,
+                          strct->schema_index, field);
+    return CJOB_SUCCESS;
+  case CHILD_TEXT:
+  case CHILD_SCALAR_LIST:
+  case CHILD_STRUCT_LIST:
+    CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_view_get_%s(const %s%s_view *view, HarisListView *out)\n\
+{\n\
+  return haris_lib_view_get_list(view, &haris_lib_structures[%d], %d, out);\n\
+}\n\n",
+                          prefix, name, child->name, prefix, name,
+                          strct->schema_index, field);
+    break;
+  }
+  if (child->tag == CHILD_SCALAR_LIST) {
+    ScalarTag tag = child->type.scalar_list.tag;
+    const char *type_name = scalar_type_name(tag);
+    CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_view_%s_at(const HarisListView *list, haris_uint32_t i,\n\
+                             %s *out)\n\
+{\n\
+  HARIS_ASSERT(list->ptr && i < list->len, INPUT);\n\
+  haris_read_%s(list->ptr + i * %d, out);\n\
+  return HARIS_SUCCESS;\n\
+}\n\n",
+                          prefix, name, child->name, type_name,
+                          scalar_function_suffix(tag), sizeof_scalar(tag));
+  } else if (child->tag == CHILD_STRUCT_LIST) {
+    CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_view_%s_at(const HarisListView *list, haris_uint32_t i,\n\
+                             %s%s_view *out)\n\
+{\n\
+  return haris_lib_view_struct_at(list, i, out);\n\
+}\n\n",
+                          prefix, name, child->name,
+                          prefix, child->type.struct_list->name);
+    CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_view_%s_next(HarisListView *list, %s%s_view *out)\n\
+{\n\
+  return haris_lib_view_struct_next(list, out);\n\
+}\n\n",
+                          prefix, name, child->name,
+                          prefix, child->type.struct_list->name);
+  }
+  return CJOB_SUCCESS;
+}
@@ -0,0 +1,8 @@
+#ifndef CGENC_VIEW_H_
+#define CGENC_VIEW_H_
+
+#include "cgen.h"
+
+CJobStatus write_view_funcs(CJob *);
+
+#endif
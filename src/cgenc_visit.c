@@ -0,0 +1,315 @@
+#include "cgenc_visit.h"
+
+/* Visitors walk a message in an encoded buffer and hand each of its fields
+   to a callback as the walk reaches it, in the order they're encoded.
+   Nothing is allocated and nothing is copied, so a list of structures of
+   any length can be processed in constant memory. For a structure S with a
+   scalar field X, a Text field T, a list of scalars L, a structure field C
+   and a list of structures E, we generate
+
+   struct S_visitor {
+     void (*on_begin)(void *ctx);
+     void (*on_end)(void *ctx);
+     void (*on_X)(void *ctx, TYPE value);
+     void (*on_T)(void *ctx, const char *text, haris_uint32_t len);
+     void (*on_L_begin)(void *ctx, haris_uint32_t len);
+     void (*on_L_element)(void *ctx, haris_uint32_t i, TYPE value);
+     const C_visitor *C;
+     void (*on_E_begin)(void *ctx, haris_uint32_t len);
+     const E_visitor *E;
+   };
+
+   HarisStatus S_visit_buffer(const unsigned char *, haris_uint32_t,
+                              const S_visitor *, void *,
+                              haris_uint32_t *);
+
+   Every member of a visitor may be NULL, in which case the field is
+   skipped. A structure field, or each element of a list of structures, is
+   walked with the nested visitor, between its own on_begin and on_end.
+   Children that are null fire no callbacks at all. Text points straight
+   into the buffer and is not null-terminated.
+
+   The message is validated before the walk starts, so no callback ever
+   fires for a message that S_from_buffer would reject.
+*/
+
+static CJobStatus write_visitor_structures(CJob *);
+static CJobStatus write_static_visit_funcs(CJob *);
+static CJobStatus write_struct_visit_func(CJob *, ParsedStruct *);
+static char *append_child_visit(char *, CJob *, ParsedStruct *, int);
+static CJobStatus write_public_visit_funcs(CJob *, ParsedStruct *);
+
+/* =============================PUBLIC INTERFACE============================= */
+
+CJobStatus write_visit_funcs(CJob *job)
+{
+  CJobStatus result;
+  int i;
+  ParsedSchema *schema = job->schema;
+  if ((result = write_visitor_structures(job)) != CJOB_SUCCESS ||
+      (result = write_static_visit_funcs(job)) != CJOB_SUCCESS)
+    return result;
+  for (i = 0; i < schema->num_structs; i++) {
+    if ((result = write_struct_visit_func(job, &schema->structs[i]))
+        != CJOB_SUCCESS ||
+        (result = write_public_visit_funcs(job, &schema->structs[i]))
+        != CJOB_SUCCESS)
+      return result;
+  }
+  return CJOB_SUCCESS;
+}
+
+/* =============================STATIC FUNCTIONS============================= */
+
+/* Visitors refer to each other (a structure can even contain itself), so
+   all of the typedefs come before any of the definitions. */
+static CJobStatus write_visitor_structures(CJob *job)
+{
+  int i, j;
+  ParsedSchema *schema = job->schema;
+  const char *prefix = job->prefix;
+  for (i = 0; i < schema->num_structs; i ++)
+    CJOB_FMT_HEADER_STRING(job, "typedef struct %s%s_visitor %s%s_visitor;\n",
+                           prefix, schema->structs[i].name,
+                           prefix, schema->structs[i].name);
+  CJOB_FMT_HEADER_STRING(job, "\n");
+  for (i = 0; i < schema->num_structs; i ++) {
+    ParsedStruct *strct = &schema->structs[i];
+    CJOB_FMT_HEADER_STRING(job,
+"struct %s%s_visitor {\n\
+  void (*on_begin)(void *ctx);\n\
+  void (*on_end)(void *ctx);\n", prefix, strct->name);
+    for (j = 0; j < strct->num_scalars; j ++)
+      CJOB_FMT_HEADER_STRING(job, "  void (*on_%s)(void *ctx, %s value);\n",
+                             strct->scalars[j].name,
+                             scalar_type_name(strct->scalars[j].type.tag));
+    for (j = 0; j < strct->num_children; j ++) {
+      ChildField *child = &strct->children[j];
+      switch (child->tag) {
+      case CHILD_TEXT:
+        CJOB_FMT_HEADER_STRING(job,
+"  void (*on_%s)(void *ctx, const char *text, haris_uint32_t len);\n",
+                               child->name);
+        break;
+      case CHILD_SCALAR_LIST:
+        CJOB_FMT_HEADER_STRING(job,
+"  void (*on_%s_begin)(void *ctx, haris_uint32_t len);\n\
+  void (*on_%s_element)(void *ctx, haris_uint32_t i, %s value);\n",
+                               child->name, child->name,
+                               scalar_type_name(child->type.scalar_list.tag));
+        break;
+      case CHILD_STRUCT:
+        CJOB_FMT_HEADER_STRING(job, "  const %s%s_visitor *%s;\n", prefix,
+                               child->type.strct->name, child->name);
+        break;
+      case CHILD_STRUCT_LIST:
+        CJOB_FMT_HEADER_STRING(job,
+"  void (*on_%s_begin)(void *ctx, haris_uint32_t len);\n\
+  const %s%s_visitor *%s;\n",
+                               child->name, prefix,
+                               child->type.struct_list->name, child->name);
+        break;
+      }
+    }
+    CJOB_FMT_HEADER_STRING(job, "};\n\n");
+  }
+  return CJOB_SUCCESS;
+}
+
+/* Visiting starts after the message has been validated, so the walk
+   needs no checks of its own; `sz` is only carried along so that children
+   that aren't visited can be measured by the validator. Each structure
+   gets its own visiting function, which returns the number of bytes in
+   the body and children of the structure. */
+static CJobStatus write_static_visit_funcs(CJob *job)
+{
+  int i, j, has_struct = 0;
+  ParsedSchema *schema = job->schema;
+  for (i = 0; i < schema->num_structs; i ++) {
+    for (j = 0; j < schema->structs[i].num_children; j ++) {
+      if (schema->structs[i].children[j].tag == CHILD_STRUCT ||
+          schema->structs[i].children[j].tag == CHILD_STRUCT_LIST)
+        has_struct = 1;
+    }
+  }
+  if (has_struct)
+    CJOB_FMT_PRIV_FUNCTION(job,
+"static haris_uint32_t haris_lib_visit_child(const unsigned char *buf,\n\
+                                            haris_uint32_t sz,\n\
+                                            haris_uint32_t (*visit)(\n\
+                                              const unsigned char *,\n\
+                                              haris_uint32_t, int, int,\n\
+                                              const void *, void *),\n\
+                                            const void *visitor,\n\
+                                            void (*on_begin)(void *,\n\
+                                                             haris_uint32_t),\n\
+                                            void *ctx)\n\
+{\n\
+  haris_uint32_t len, j, consumed = 0;\n\
+  if ((buf[0] & 0xC0) == 0x40 && visitor)\n\
+    return 2 + visit(buf + 2, sz - 2, buf[0] & 0x3F, buf[1], visitor, ctx);\n\
+  if (buf[0] == 0xC0 && (visitor || on_begin)) {\n\
+    haris_read_uint24(buf + 1, &len);\n\
+    if (on_begin) on_begin(ctx, len);\n\
+    if (visitor) {\n\
+      for (j = 0, consumed = 6; j < len; j ++)\n\
+        consumed += visit(buf + consumed, sz - consumed, buf[4] & 0x3F,\n\
+                          buf[5], visitor, ctx);\n\
+      return consumed;\n\
+    }\n\
+  }\n\
+  (void)haris_lib_validate_child(buf, sz, NULL, 0, &consumed);\n\
+  return consumed;\n\
+}\n\n");
+  CJOB_FMT_PRIV_FUNCTION(job,
+"static HarisStatus _public_visit_buffer(const HarisStructureInfo *info,\n\
+                                        haris_uint32_t (*visit)(\n\
+                                          const unsigned char *,\n\
+                                          haris_uint32_t, int, int,\n\
+                                          const void *, void *),\n\
+                                        const unsigned char *buf,\n\
+                                        haris_uint32_t sz,\n\
+                                        const void *visitor, void *ctx,\n\
+                                        haris_uint32_t *consumed)\n\
+{\n\
+  HarisStatus result;\n\
+  haris_uint32_t size;\n\
+  if ((result = _public_validate_buffer(info, buf, sz, &size))\n\
+      != HARIS_SUCCESS)\n\
+    return result;\n\
+  visit(buf + 2, size - 2, buf[0] & 0x3F, buf[1], visitor, ctx);\n\
+  if (consumed) *consumed = size;\n\
+  return HARIS_SUCCESS;\n\
+}\n\n");
+  return CJOB_SUCCESS;
+}
+
+static CJobStatus write_struct_visit_func(CJob *job, ParsedStruct *strct)
+{
+  int i, has_text = 0, has_list = 0;
+  const char *prefix = job->prefix, *name = strct->name;
+  char *func;
+  for (i = 0; i < strct->num_children; i ++) {
+    if (strct->children[i].tag == CHILD_TEXT)
+      has_text = 1;
+    else if (strct->children[i].tag == CHILD_SCALAR_LIST)
+      has_list = 1;
+  }
+  func = strformat(
+"static haris_uint32_t %s%s_visit_body(const unsigned char *buf,\n\
+                                       haris_uint32_t sz, int num_children,\n\
+                                       int body_size, const void *visitor,\n\
+                                       void *ctx)\n\
+{\n\
+  const %s%s_visitor *v = (const %s%s_visitor*)visitor;\n\
+  haris_uint32_t consumed = (haris_uint32_t)body_size, child_size = 0;\n\
+  int i;\n%s\
+  if (v->on_begin) v->on_begin(ctx);\n",
+                   prefix, name, prefix, name, prefix, name,
+                   (has_list ? "  haris_uint32_t len, j;\n" :
+                    has_text ? "  haris_uint32_t len;\n" : ""));
+  for (i = 0; i < strct->num_scalars; i ++) {
+    ScalarField *scalar = &strct->scalars[i];
+    func = strappend(func,
+"  if (v->on_%s) {\n\
+    %s value;\n\
+    haris_read_%s(buf + %d, &value);\n\
+    v->on_%s(ctx, value);\n\
+  }\n",
+                     scalar->name, scalar_type_name(scalar->type.tag),
+                     scalar_function_suffix(scalar->type.tag),
+                     scalar->offset, scalar->name);
+  }
+  for (i = 0; i < strct->num_children; i ++)
+    func = append_child_visit(func, job, strct, i);
+  /* Children from a newer version of the schema are skipped */
+  func = strappend(func,
+"  for (i = %d; i < num_children; i ++) {\n\
+    (void)haris_lib_validate_child(buf + consumed, sz - consumed, NULL, 0,\n\
+                                   &child_size);\n\
+    consumed += child_size;\n\
+  }\n\
+  if (v->on_end) v->on_end(ctx);\n\
+  return consumed;\n}\n\n", strct->num_children);
+  if (!func) return CJOB_MEM_ERROR;
+  return add_private_function(job, func);
+}
+
+/* Append the code that visits the given child, which starts at
+   buf + consumed, and moves `consumed` past it. Lists of scalars are
+   measured by the validator, which only has to read their headers. */
+static char *append_child_visit(char *func, CJob *job, ParsedStruct *strct,
+                                int field)
+{
+  const char *prefix = job->prefix;
+  ChildField *child = &strct->children[field];
+  const char *child_name = child->name;
+  switch (child->tag) {
+  case CHILD_TEXT:
+    return strappend(func,
+"  /* %s */\n\
+  if (buf[consumed] && v->on_%s) {\n\
+    haris_read_uint24(buf + consumed + 1, &len);\n\
+    v->on_%s(ctx, (const char*)buf + consumed + 4, len);\n\
+  }\n\
+  (void)haris_lib_validate_child(buf + consumed, sz - consumed, NULL, 0,\n\
+                                 &child_size);\n\
+  consumed += child_size;\n",
+                     child_name, child_name, child_name);
+  case CHILD_SCALAR_LIST:
+  {
+    ScalarTag tag = child->type.scalar_list.tag;
+    return strappend(func,
+"  /* %s */\n\
+  if (buf[consumed] && (v->on_%s_begin || v->on_%s_element)) {\n\
+    haris_read_uint24(buf + consumed + 1, &len);\n\
+    if (v->on_%s_begin) v->on_%s_begin(ctx, len);\n\
+    if (v->on_%s_element) {\n\
+      for (j = 0; j < len; j ++) {\n\
+        %s value;\n\
+        haris_read_%s(buf + consumed + 4 + j * %d, &value);\n\
+        v->on_%s_element(ctx, j, value);\n\
+      }\n\
+    }\n\
+  }\n\
+  (void)haris_lib_validate_child(buf + consumed, sz - consumed, NULL, 0,\n\
+                                 &child_size);\n\
+  consumed += child_size;\n",
+                     child_name, child_name, child_name, child_name,
+                     child_name, child_name, scalar_type_name(tag),
+                     scalar_function_suffix(tag), sizeof_scalar(tag),
+                     child_name);
+  }
+  case CHILD_STRUCT:
+    return strappend(func,
+"  /* %s */\n\
+  consumed += haris_lib_visit_child(buf + consumed, sz - consumed,\n\
+                                    %s%s_visit_body, v->%s, NULL, ctx);\n",
+                     child_name, prefix, child->type.strct->name,
+                     child_name);
+  case CHILD_STRUCT_LIST:
+    return strappend(func,
+"  /* %s */\n\
+  consumed += haris_lib_visit_child(buf + consumed, sz - consumed,\n\
+                                    %s%s_visit_body, v->%s,\n\
+                                    v->on_%s_begin, ctx);\n",
+                     child_name, prefix, child->type.struct_list->name,
+                     child_name, child_name);
+  }
+  return func;
+}
+
+static CJobStatus write_public_visit_funcs(CJob *job, ParsedStruct *strct)
+{
+  const char *prefix = job->prefix, *name = strct->name;
+  CJOB_FMT_PUB_FUNCTION(job,
+"HarisStatus %s%s_visit_buffer(const unsigned char *buf, haris_uint32_t sz,\n\
+                               const %s%s_visitor *visitor, void *ctx,\n\
+                               haris_uint32_t *consumed)\n\
+{\n\
+  return _public_visit_buffer(&haris_lib_structures[%d], %s%s_visit_body,\n\
+                              buf, sz, visitor, ctx, consumed);\n}\n\n",
+                        prefix, name, prefix, name, strct->schema_index,
+                        prefix, name);
+  return CJOB_SUCCESS;
+}
@@ -0,0 +1,8 @@
+#ifndef CGENC_VISIT_H_
+#define CGENC_VISIT_H_
+
+#include "cgen.h"
+
+CJobStatus write_visit_funcs(CJob *);
+
+#endif
@@ -60,33 +60,46 @@ static CJobStatus write_header_boilerplate(CJob *job)
    take more than a minute to do). Make sure to remove the #include directive \n\
    if you do not have stdint.h.\n\
 \n\
-   These type definitions trade time for space; that is, they use the fastest\n\
-   possible types with those sizes rather than the smallest. This means that\n\
-   the in-memory representation of a structure might be larger than is \n\
-   technically necessary to store the number. If you wish to use less space\n\
-   in-memory in exchange for a potentially longer running time, use the\n\
-   [u]int_leastN_t types rather than the [u]int_fastN_t types.\n*/\n");
-  CJOB_FMT_HEADER_STRING(job,
-"#include <stdint.h>\n\
-\n\
-typedef uint_fast8_t    haris_uint8_t;\n\
+   By default, these type definitions trade space for time; that is, they\n\
+   use the fastest possible types with those sizes rather than the smallest.\n\
+   This means that the in-memory representation of a structure might be\n\
+   larger than is technically necessary to store the number. If you wish to\n\
+   use less space in-memory in exchange for a potentially longer running\n\
+   time, compile your schema with `-O compact-types`, which uses the\n\
+   [u]int_leastN_t types rather than the [u]int_fastN_t types. On most\n\
+   hosts, that also lets lists of integers be copied straight out of a\n\
+   message.\n*/\n");
+  CJOB_FMT_HEADER_STRING(job, "#include <stdint.h>\n\n%s",
+                         (job->optimizations.compact_types ?
+"typedef uint_least8_t   haris_uint8_t;\n\
+typedef int_least8_t    haris_int8_t;\n\
+typedef uint_least16_t  haris_uint16_t;\n\
+typedef int_least16_t   haris_int16_t;\n\
+typedef uint_least32_t  haris_uint32_t;\n\
+typedef int_least32_t   haris_int32_t;\n\
+typedef uint_least64_t  haris_uint64_t;\n\
+typedef int_least64_t   haris_int64_t;\n" :
+"typedef uint_fast8_t    haris_uint8_t;\n\
 typedef int_fast8_t     haris_int8_t;\n\
 typedef uint_fast16_t   haris_uint16_t;\n\
 typedef int_fast16_t    haris_int16_t;\n\
 typedef uint_fast32_t   haris_uint32_t;\n\
 typedef int_fast32_t    haris_int32_t;\n\
 typedef uint_fast64_t   haris_uint64_t;\n\
-typedef int_fast64_t    haris_int64_t;\n\
-\n\
+typedef int_fast64_t    haris_int64_t;\n"));
+  CJOB_FMT_HEADER_STRING(job,
+"\n\
 typedef float           haris_float32;\n\
 typedef double          haris_float64;\n\
 \n\
 typedef enum {\n\
   HARIS_SUCCESS, HARIS_STRUCTURE_ERROR, HARIS_DEPTH_ERROR, HARIS_SIZE_ERROR,\n\
-  HARIS_INPUT_ERROR, HARIS_MEM_ERROR\n\
+  HARIS_INPUT_ERROR, HARIS_MEM_ERROR, HARIS_NEED_MORE\n\
 } HarisStatus;\n\n\
-typedef HarisStatus (*HarisStreamReader)(void *, haris_uint32_t, \n\
-                                         const unsigned char **);\n\n\
+typedef HarisStatus (*HarisSpanReader)(void *, haris_uint32_t, \n\
+                                       haris_uint32_t,\n\
+                                       const unsigned char **,\n\
+                                       haris_uint32_t *);\n\n\
 typedef HarisStatus (*HarisStreamWriter)(void *, const unsigned char *, \n\
                                          haris_uint32_t);\n\n");
   return CJOB_SUCCESS;
@@ -113,12 +126,47 @@ static CJobStatus write_header_macros(CJob *job)
   CJOB_FMT_HEADER_STRING(job, 
 "/* Changeable size limits for error-checking. You can freely modify these if\n\
    you would like your Haris client to be able to process larger or deeper\n\
-   messages. \n\
+   messages. Nesting is followed with stacks of HARIS_DEPTH_LIMIT + 1\n\
+   frames rather than by recursion (except in -O specialize codecs), so a\n\
+   deeper limit costs a few bytes of stack per level, not a call.\n\
 */\n\
 \n\
 #define HARIS_DEPTH_LIMIT 64\n\
 #define HARIS_MESSAGE_SIZE_LIMIT 1000000000\n\
 \n\
+/* The size of the scratch buffer that the fd protocol reads into and\n\
+   stages small writes in. Reads fill as much of it as they can, so it\n\
+   must be at least 256 (enough for the largest structure body).\n\
+*/\n\
+\n\
+#define HARIS_STREAM_CHUNK_SIZE 1000\n\
+\n\
+/* Haris messages are little-endian, and floating-point numbers are\n\
+   transmitted in IEEE 754 format. When the host represents scalars the\n\
+   same way, lists of scalars are copied in and out of messages wholesale\n\
+   rather than one element at a time. These are detected automatically on\n\
+   common compilers; define either to 0 or 1 to override the detection.\n\
+*/\n\
+\n\
+#ifndef HARIS_LITTLE_ENDIAN\n\
+#if (defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && \\\n\
+     __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || \\\n\
+    defined(_M_IX86) || defined(_M_X64) || defined(_M_AMD64)\n\
+#define HARIS_LITTLE_ENDIAN 1\n\
+#else\n\
+#define HARIS_LITTLE_ENDIAN 0\n\
+#endif\n\
+#endif\n\
+\n\
+#ifndef HARIS_IEEE_754\n\
+#if defined(__STDC_IEC_559__) || \\\n\
+    (defined(__GCC_IEC_559) && __GCC_IEC_559 > 0) || defined(_MSC_VER)\n\
+#define HARIS_IEEE_754 1\n\
+#else\n\
+#define HARIS_IEEE_754 0\n\
+#endif\n\
+#endif\n\
+\n\
 /* The _init_ deallocation factor. If you initialize a list to have length\n\
    N, but the list is already allocated to have length A, then the list\n\
    will be reallocated to have length N if and only if N/A is less than\n\
@@ -126,6 +174,10 @@ static CJobStatus write_header_macros(CJob *job)
    1.0; lower values will waste more memory but will not interface with the\n\
    memory allocator as much, and higher values will waste less memory but\n\
    will have to reallocate more.\n\
+\n\
+   This only applies to _init_; decoding a message into a structure never\n\
+   shrinks its lists, so that a structure can be reused for a sequence of\n\
+   messages without going back to the allocator.\n\
 */\n\n\
 #define HARIS_DEALLOC_FACTOR 0.6\n\n\
 /* The drop-in memory management functions. If you want, you can use a\n\
@@ -145,6 +197,29 @@ static CJobStatus write_header_macros(CJob *job)
       write_macros_for_child(job, strct, &strct->children[j]);
     }
   }
+  /* Structures that have no lists and no recursive children have a bounded
+     encoded size, which is computed when the schema is finalized. */
+  for (i = 0; i < job->schema->num_structs; i ++) {
+    strct = &job->schema->structs[i];
+    if (strct->meta.max_size != 0)
+      CJOB_FMT_HEADER_STRING(job, "#define %s%s_MAX_ENCODED_SIZE %lu\n",
+                             job->prefix, strct->name,
+                             (unsigned long)strct->meta.max_size);
+  }
+  /* Every child gets a bit in a field mask, which selects the children
+     that a projected decode fills in. A message has at most 63 children,
+     so the masks fit in 64 bits. */
+  CJOB_FMT_HEADER_STRING(job, 
+"\n#define HARIS_ALL_FIELDS (~(haris_uint64_t)0)\n");
+  for (i = 0; i < job->schema->num_structs; i ++) {
+    strct = &job->schema->structs[i];
+    for (j = 0; j < strct->num_children; j ++)
+      CJOB_FMT_HEADER_STRING(job, 
+                             "#define %s%s_FIELD_%s ((haris_uint64_t)1 << %d)\n",
+                             job->prefix, strct->name, 
+                             strct->children[j].name, j);
+  }
+  CJOB_FMT_HEADER_STRING(job, "\n");
   for (i = 0; i < job->schema->num_enums; i ++) {
     enm = &job->schema->enums[i];
     CJOB_FMT_HEADER_STRING(job, "/* enum %s */\n", enm->name);
@@ -250,6 +325,20 @@ static CJobStatus write_reflective_structures(CJob *job)
   void *ptr;\n\
   char has;\n\
 } HarisSubstructInfo;\n\n");
+  /* See cgenc_core.c for the details of arenas. `used` is the number of
+     bytes at the front of `buffer` that have been handed out. */
+  CJOB_FMT_HEADER_STRING(job,
+"typedef struct {\n\
+  unsigned char *buffer;\n\
+  size_t sz;\n\
+  size_t used;\n\
+} HarisArena;\n\n\
+typedef union {\n\
+  haris_uint64_t u;\n\
+  double d;\n\
+  long double ld;\n\
+  void *p;\n\
+} HarisArenaAlign;\n\n");
   CJOB_FMT_HEADER_STRING(job, 
 "typedef struct HarisStructureInfo_ HarisStructureInfo;\n\n");
   CJOB_FMT_HEADER_STRING(job, 
@@ -266,6 +355,11 @@ static CJobStatus write_reflective_structures(CJob *job)
   const HarisStructureInfo *struct_element;\n\
   HarisChildType child_type;\n\
 } HarisChild;\n\n");
+  /* `owns_memory` is 0 for structures that hold no pointers to the heap,
+     directly or through embedded structures, so destroying a list of them
+     is a single free. `fixed_size` is nonzero when every instance of the
+     structure encodes to exactly that many bytes (header included). Both
+     are computed when the code is generated. */
   CJOB_FMT_HEADER_STRING(job, 
 "struct HarisStructureInfo_ {\n\
   int num_scalars;\n\
@@ -274,7 +368,32 @@ static CJobStatus write_reflective_structures(CJob *job)
   const HarisChild *children;\n\
   int body_size;\n\
   size_t size_of;\n\
-};\n\n");
+  int owns_memory;\n\
+  haris_uint32_t fixed_size;\n");
+  /* With `-O specialize`, every structure also carries its dedicated
+     encoder and decoder, which the general stream functions dispatch to. */
+  if (job->optimizations.specialize) {
+    CJOB_FMT_HEADER_STRING(job,
+"  HarisStatus (*decode_body)(void *, void *, HarisSpanReader, HarisArena *,\n\
+                             int, int, int);\n\
+  HarisStatus (*encode_body)(void *, void *, HarisStreamWriter, int);\n");
+  }
+  CJOB_FMT_HEADER_STRING(job, "};\n\n");
+  /* The functions that walk nested structures keep their place on a stack
+     of frames rather than recursing. A frame is one structure, or each
+     element of a list of structures in turn (`elements_left` counts the
+     ones after the current one). `num_children` and `body_size` are as
+     given by the message being decoded, `child` is the next child to
+     visit, and `info` is NULL for a structure the schema doesn't know. */
+  CJOB_FMT_HEADER_STRING(job,
+"typedef struct {\n\
+  void *ptr;\n\
+  const HarisStructureInfo *info;\n\
+  int num_children;\n\
+  int body_size;\n\
+  int child;\n\
+  haris_uint32_t elements_left;\n\
+} HarisFrame;\n\n");
   return CJOB_SUCCESS;
 }
 
@@ -0,0 +1,267 @@
+#include "htest.h"
+#include "bulk.haris.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#define NUM_BYTES 100000
+#define NUM_SHORTS 3001
+#define NUM_FLOATS 2500
+#define NUM_DOUBLES 1250
+#define NUM_TICKS 200000
+
+/* 2 (header) + 2 (body) + 4 + NUM_BYTES + 4 + 2 * NUM_SHORTS 
+   + 4 + 4 * NUM_FLOATS + 4 + 8 * NUM_DOUBLES + 4 + 5 */
+#define ENCODED_SIZE (29 + NUM_BYTES + 2 * NUM_SHORTS + 4 * NUM_FLOATS + \
+                      8 * NUM_DOUBLES)
+
+static Payload *make_payload(void)
+{
+  haris_uint32_t i;
+  Payload *p = Payload_create();
+  if (!p) return NULL;
+  p->id = 0xBEEF;
+  if (Payload_init_bytes(p, NUM_BYTES) != HARIS_SUCCESS ||
+      Payload_init_shorts(p, NUM_SHORTS) != HARIS_SUCCESS ||
+      Payload_init_floats(p, NUM_FLOATS) != HARIS_SUCCESS ||
+      Payload_init_doubles(p, NUM_DOUBLES) != HARIS_SUCCESS ||
+      Payload_init_name(p, 5) != HARIS_SUCCESS) {
+    Payload_destroy(p);
+    return NULL;
+  }
+  for (i = 0; i < NUM_BYTES; i ++)
+    Payload_get_bytes(p)[i] = (haris_uint8_t)(i * 7);
+  for (i = 0; i < NUM_SHORTS; i ++)
+    Payload_get_shorts(p)[i] = (haris_int16_t)((int)i - 1500);
+  for (i = 0; i < NUM_FLOATS; i ++)
+    Payload_get_floats(p)[i] = (float)i * 0.5f - 100.0f;
+  for (i = 0; i < NUM_DOUBLES; i ++)
+    Payload_get_doubles(p)[i] = (double)i / 8.0;
+  memcpy(Payload_get_name(p), "bulky", 5);
+  return p;
+}
+
+static int check_payload(Payload *p)
+{
+  haris_uint32_t i;
+  HTEST_ASSERT(p->id == 0xBEEF);
+  HTEST_ASSERT(Payload_len_bytes(p) == NUM_BYTES);
+  HTEST_ASSERT(Payload_len_shorts(p) == NUM_SHORTS);
+  HTEST_ASSERT(Payload_len_floats(p) == NUM_FLOATS);
+  HTEST_ASSERT(Payload_len_doubles(p) == NUM_DOUBLES);
+  for (i = 0; i < NUM_BYTES; i ++)
+    HTEST_ASSERT(Payload_get_bytes(p)[i] == (haris_uint8_t)(i * 7));
+  for (i = 0; i < NUM_SHORTS; i ++)
+    HTEST_ASSERT(Payload_get_shorts(p)[i] == (haris_int16_t)((int)i - 1500));
+  for (i = 0; i < NUM_FLOATS; i ++)
+    HTEST_ASSERT(Payload_get_floats(p)[i] == (float)i * 0.5f - 100.0f);
+  for (i = 0; i < NUM_DOUBLES; i ++)
+    HTEST_ASSERT(Payload_get_doubles(p)[i] == (double)i / 8.0);
+  HTEST_ASSERT(Payload_len_name(p) == 5);
+  HTEST_ASSERT(memcmp(Payload_get_name(p), "bulky", 5) == 0);
+  return 1;
+}
+
+/* Spot-check the wire format: each list is little-endian regardless of
+   how it was copied into the buffer */
+static int check_encoding(const unsigned char *buf)
+{
+  const unsigned char *shorts = buf + 4 + 4 + NUM_BYTES,
+    *floats = shorts + 4 + 2 * NUM_SHORTS;
+  HTEST_ASSERT(buf[0] == 0x45 && buf[1] == 2);
+  HTEST_ASSERT(buf[2] == 0xEF && buf[3] == 0xBE);
+  HTEST_ASSERT(buf[4] == 0x80 && buf[5] == 0xA0 && buf[6] == 0x86 && 
+               buf[7] == 0x01);
+  HTEST_ASSERT(buf[8 + 1] == 7 && buf[8 + 37] == (unsigned char)(37 * 7));
+  HTEST_ASSERT(shorts[0] == 0x81 && shorts[1] == 0xB9 && shorts[2] == 0x0B);
+  /* -1500 == 0xFA24 */
+  HTEST_ASSERT(shorts[4] == 0x24 && shorts[5] == 0xFA);
+  /* -100.0f == 0xC2C80000 */
+  HTEST_ASSERT(floats[0] == 0x82);
+  HTEST_ASSERT(floats[4] == 0 && floats[5] == 0 && floats[6] == 0xC8 &&
+               floats[7] == 0xC2);
+  HTEST_ASSERT(buf[ENCODED_SIZE - 9] == 0x80 && 
+               buf[ENCODED_SIZE - 5] == 'b');
+  return 1;
+}
+
+/* A list of leaf structures is sized with a single multiply; the result
+   has to agree with what is actually written */
+static int leaf_list_test(void)
+{
+  unsigned char *buffer, *out_addr;
+  haris_uint32_t sz, i;
+  Series *in = Series_create(), *out = Series_create();
+  HTEST_ASSERT(in && out);
+  HTEST_ASSERT(Tick_MAX_ENCODED_SIZE == 8);
+  in->id = 12;
+  HTEST_ASSERT(Series_init_ticks(in, NUM_TICKS) == HARIS_SUCCESS);
+  for (i = 0; i < NUM_TICKS; i ++) {
+    Series_get_ticks(in)[i].t = i;
+    Series_get_ticks(in)[i].v = (haris_int16_t)(i % 1000 - 500);
+  }
+  HTEST_ASSERT(Series_to_buffer_a(in, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == 2 + 2 + 6 + 6 * NUM_TICKS);
+  HTEST_ASSERT(Series_from_buffer(out, buffer, sz, &out_addr) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == (ptrdiff_t)sz);
+  HTEST_ASSERT(Series_len_ticks(out) == NUM_TICKS);
+  for (i = 0; i < NUM_TICKS; i += 997) {
+    HTEST_ASSERT(Series_get_ticks(out)[i].t == i);
+    HTEST_ASSERT(Series_get_ticks(out)[i].v == (haris_int16_t)(i % 1000 - 500));
+  }
+  /* Shrinking the list drops the tail without visiting it */
+  HTEST_ASSERT(Series_init_ticks(in, 3) == HARIS_SUCCESS);
+  free(buffer);
+  HTEST_ASSERT(Series_to_buffer_a(in, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == 2 + 2 + 6 + 6 * 3);
+  HTEST_ASSERT(Series_from_buffer(out, buffer, sz, &out_addr) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(Series_len_ticks(out) == 3 && 
+               Series_get_ticks(out)[2].t == 2);
+  free(buffer);
+  Series_destroy(in);
+  Series_destroy(out);
+  return 1;
+}
+
+static int buffer_test(void)
+{
+  unsigned char *buffer, *out_addr;
+  haris_uint32_t sz;
+  Payload *in = make_payload(), *out = Payload_create();
+  HTEST_ASSERT(in && out);
+  HTEST_ASSERT(Payload_to_buffer_a(in, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == ENCODED_SIZE);
+  HTEST_ASSERT(check_encoding(buffer));
+  HTEST_ASSERT(Payload_from_buffer(out, buffer, sz, &out_addr) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == ENCODED_SIZE);
+  HTEST_ASSERT(check_payload(out));
+  /* Truncating the message anywhere in a list is an error */
+  HTEST_ASSERT(Payload_from_buffer(out, buffer, 8 + NUM_BYTES / 2, &out_addr) 
+               == HARIS_INPUT_ERROR);
+  HTEST_ASSERT(Payload_from_buffer(out, buffer, 12 + NUM_BYTES + 3, 
+                                   &out_addr) == HARIS_INPUT_ERROR);
+  free(buffer);
+  Payload_destroy(in);
+  Payload_destroy(out);
+  return 1;
+}
+
+static int file_test(void)
+{
+  unsigned char *buffer;
+  haris_uint32_t sz;
+  FILE *f = tmpfile();
+  Payload *in = make_payload(), *out = Payload_create();
+  HTEST_ASSERT(in && out && f);
+  HTEST_ASSERT(Payload_to_file(in, f, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == ENCODED_SIZE);
+  rewind(f);
+  buffer = (unsigned char*)malloc(ENCODED_SIZE);
+  HTEST_ASSERT(buffer);
+  HTEST_ASSERT(fread(buffer, 1, ENCODED_SIZE, f) == ENCODED_SIZE);
+  HTEST_ASSERT(fgetc(f) == EOF);
+  HTEST_ASSERT(check_encoding(buffer));
+  rewind(f);
+  HTEST_ASSERT(Payload_from_file(out, f, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == ENCODED_SIZE);
+  HTEST_ASSERT(check_payload(out));
+  free(buffer);
+  fclose(f);
+  Payload_destroy(in);
+  Payload_destroy(out);
+  return 1;
+}
+
+static int file_sequence_test(void)
+{
+  /* Reads take no more from the file than the message they're decoding */
+  haris_uint32_t sz;
+  FILE *f = tmpfile();
+  Payload *in = make_payload(), *out = Payload_create();
+  HTEST_ASSERT(in && out && f);
+  HTEST_ASSERT(Payload_to_file(in, f, &sz) == HARIS_SUCCESS);
+  in->id = 0x4321;
+  HTEST_ASSERT(Payload_to_file(in, f, &sz) == HARIS_SUCCESS);
+  rewind(f);
+  HTEST_ASSERT(Payload_from_file(out, f, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == ENCODED_SIZE);
+  HTEST_ASSERT(check_payload(out));
+  HTEST_ASSERT(Payload_from_file(out, f, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(out->id == 0x4321);
+  HTEST_ASSERT(fgetc(f) == EOF);
+  fclose(f);
+  Payload_destroy(in);
+  Payload_destroy(out);
+  return 1;
+}
+
+static int file_stream_test(void)
+{
+  /* A stream with the smallest buffer allowed still handles large lists */
+  unsigned char buffer[256];
+  haris_uint32_t sz;
+  HarisFileStream stream;
+  FILE *f = tmpfile();
+  Payload *in = make_payload(), *out = Payload_create();
+  HTEST_ASSERT(in && out && f);
+  haris_file_stream_init(&stream, f, buffer, sizeof buffer);
+  HTEST_ASSERT(Payload_to_file_stream(in, &stream, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == ENCODED_SIZE);
+  HTEST_ASSERT(Payload_to_file_stream(in, &stream, &sz) == HARIS_SUCCESS);
+  rewind(f);
+  HTEST_ASSERT(Payload_from_file_stream(out, &stream, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == ENCODED_SIZE);
+  HTEST_ASSERT(check_payload(out));
+  HTEST_ASSERT(Payload_from_file(out, f, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(check_payload(out));
+  HTEST_ASSERT(fgetc(f) == EOF);
+  fclose(f);
+  Payload_destroy(in);
+  Payload_destroy(out);
+  return 1;
+}
+
+static int small_buffer_test(void)
+{
+  /* A buffer too small to hold a body is an error, not an endless loop */
+  unsigned char buffer[1];
+  haris_uint32_t sz;
+  HarisFileStream stream;
+  FILE *f = tmpfile();
+  Payload *in = make_payload(), *out = Payload_create();
+  HTEST_ASSERT(in && out && f);
+  HTEST_ASSERT(Payload_to_file(in, f, &sz) == HARIS_SUCCESS);
+  rewind(f);
+  haris_file_stream_init(&stream, f, buffer, sizeof buffer);
+  HTEST_ASSERT(Payload_from_file_stream(out, &stream, &sz) 
+               == HARIS_INPUT_ERROR);
+  fclose(f);
+  Payload_destroy(in);
+  Payload_destroy(out);
+  return 1;
+}
+
+static int all_tests(void)
+{
+  HTEST_RUN(buffer_test);
+  HTEST_RUN(file_test);
+  HTEST_RUN(file_sequence_test);
+  HTEST_RUN(file_stream_test);
+  HTEST_RUN(small_buffer_test);
+  HTEST_RUN(leaf_list_test);
+  return 1;
+}
+
+int main(void)
+{
+  if (!all_tests()) return -1;
+  else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
@@ -0,0 +1,106 @@
+#include "htest.h"
+#include "compact.haris.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+static int type_test(void)
+{
+  HTEST_ASSERT(sizeof(haris_uint8_t) == sizeof(uint_least8_t));
+  HTEST_ASSERT(sizeof(haris_int16_t) == sizeof(int_least16_t));
+  HTEST_ASSERT(sizeof(haris_uint32_t) == sizeof(uint_least32_t));
+  HTEST_ASSERT(sizeof(haris_int64_t) == sizeof(int_least64_t));
+  return 1;
+}
+
+static int encoding_test_1(void)
+{
+  unsigned char buffer[44], *out_addr,
+    test_buffer[44] = { 0x43, 0x1E,
+                        0xFF, 0x80, 0xFF, 0xFF, 0, 0x80, 
+                        0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0x80,
+                        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                        0, 0, 0, 0, 0, 0, 0, 0x80,
+                        0x81, 0, 0, 0, 0x82, 0, 0, 0, 0x83, 0, 0, 0 };
+  Compact *compact = Compact_create();
+  HTEST_ASSERT(compact);
+  compact->a = UINT8_MAX;
+  compact->b = INT8_MIN;
+  compact->c = UINT16_MAX;
+  compact->d = INT16_MIN;
+  compact->e = UINT32_MAX;
+  compact->f = INT32_MIN;
+  compact->g = UINT64_MAX;
+  compact->h = INT64_MIN;
+  HTEST_ASSERT(Compact_init_us(compact, 0) == HARIS_SUCCESS);
+  HTEST_ASSERT(Compact_init_is(compact, 0) == HARIS_SUCCESS);
+  HTEST_ASSERT(Compact_init_ls(compact, 0) == HARIS_SUCCESS);
+  HTEST_ASSERT(Compact_to_buffer(compact, buffer, sizeof buffer, &out_addr)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == 44);
+  HTEST_ASSERT(buffer_equal(buffer, test_buffer, 44));
+  Compact_destroy(compact);
+  return 1;
+}
+
+static int round_trip_test(void)
+{
+  static const haris_int32_t ints[] = { 
+    0, 1, -1, 127, -128, 32767, -32768, INT32_MAX, INT32_MIN 
+  };
+  static const haris_int64_t longs[] = { 
+    0, -1, INT32_MIN, (haris_int64_t)INT32_MIN - 1, INT64_MAX, INT64_MIN 
+  };
+  unsigned char *buffer, *out_addr;
+  haris_uint32_t sz, i;
+  Compact *in = Compact_create(), *out = Compact_create();
+  HTEST_ASSERT(in && out);
+  in->a = 1; in->b = -1; in->c = 0x1234; in->d = -2; in->e = 0xDEADBEEF;
+  in->f = -3; in->g = 0x0123456789ABCDEF; in->h = -4;
+  HTEST_ASSERT(Compact_init_us(in, 1000) == HARIS_SUCCESS);
+  for (i = 0; i < 1000; i ++)
+    Compact_get_us(in)[i] = (haris_uint16_t)(i * 61);
+  HTEST_ASSERT(Compact_init_is(in, sizeof ints / sizeof ints[0]) 
+               == HARIS_SUCCESS);
+  memcpy(Compact_get_is(in), ints, sizeof ints);
+  HTEST_ASSERT(Compact_init_ls(in, sizeof longs / sizeof longs[0]) 
+               == HARIS_SUCCESS);
+  memcpy(Compact_get_ls(in), longs, sizeof longs);
+  HTEST_ASSERT(Compact_to_buffer_a(in, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(Compact_from_buffer(out, buffer, sz, &out_addr) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == (ptrdiff_t)sz);
+  HTEST_ASSERT(out->a == 1 && out->b == -1 && out->c == 0x1234 && 
+               out->d == -2 && out->e == 0xDEADBEEF && out->f == -3 &&
+               out->g == 0x0123456789ABCDEF && out->h == -4);
+  HTEST_ASSERT(Compact_len_us(out) == 1000);
+  for (i = 0; i < 1000; i ++)
+    HTEST_ASSERT(Compact_get_us(out)[i] == (haris_uint16_t)(i * 61));
+  HTEST_ASSERT(Compact_len_is(out) == sizeof ints / sizeof ints[0]);
+  HTEST_ASSERT(memcmp(Compact_get_is(out), ints, sizeof ints) == 0);
+  HTEST_ASSERT(Compact_len_ls(out) == sizeof longs / sizeof longs[0]);
+  HTEST_ASSERT(memcmp(Compact_get_ls(out), longs, sizeof longs) == 0);
+  free(buffer);
+  Compact_destroy(in);
+  Compact_destroy(out);
+  return 1;
+}
+
+static int all_tests(void)
+{
+  HTEST_RUN(type_test);
+  HTEST_RUN(encoding_test_1);
+  HTEST_RUN(round_trip_test);
+  return 1;
+}
+
+int main(void)
+{
+  if (!all_tests()) return -1;
+  else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
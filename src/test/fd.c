@@ -0,0 +1,218 @@
+#define _POSIX_C_SOURCE 200112L
+#include "htest.h"
+#include "fd.haris.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#define NUM_TICKS 200
+
+static HarisFdSession session;
+
+static int fill_tick(Tick *t, haris_uint32_t seq)
+{
+  haris_uint32_t i;
+  t->seq = seq;
+  t->price = -(haris_int64_t)seq * 1000;
+  HTEST_ASSERT(Tick_init_venue(t, 4) == HARIS_SUCCESS);
+  memcpy(Tick_get_venue(t), "XNYS", 4);
+  HTEST_ASSERT(Tick_init_sizes(t, seq % 7) == HARIS_SUCCESS);
+  for (i = 0; i < seq % 7; i ++)
+    Tick_get_sizes(t)[i] = (haris_uint16_t)(seq + i);
+  return 1;
+}
+
+static int check_tick(Tick *t, haris_uint32_t seq)
+{
+  haris_uint32_t i;
+  HTEST_ASSERT(t->seq == seq);
+  HTEST_ASSERT(t->price == -(haris_int64_t)seq * 1000);
+  HTEST_ASSERT(Tick_len_venue(t) == 4);
+  HTEST_ASSERT(memcmp(Tick_get_venue(t), "XNYS", 4) == 0);
+  HTEST_ASSERT(Tick_len_sizes(t) == seq % 7);
+  for (i = 0; i < seq % 7; i ++)
+    HTEST_ASSERT(Tick_get_sizes(t)[i] == (haris_uint16_t)(seq + i));
+  return 1;
+}
+
+/* Writes NUM_TICKS messages into a pipe and returns its read end */
+static int write_ticks(void)
+{
+  int fds[2];
+  haris_uint32_t i;
+  Tick *t = Tick_create();
+  if (!t || pipe(fds) != 0) return -1;
+  for (i = 0; i < NUM_TICKS; i ++) {
+    if (!fill_tick(t, i) || Tick_to_fd(t, fds[1], NULL) != HARIS_SUCCESS)
+      return -1;
+  }
+  close(fds[1]);
+  Tick_destroy(t);
+  return fds[0];
+}
+
+static int session_test(void)
+{
+  haris_uint32_t i, sz;
+  int fd = write_ticks();
+  Tick *t = Tick_create();
+  HTEST_ASSERT(fd >= 0 && t);
+  haris_fd_session_init(&session, fd);
+  for (i = 0; i < NUM_TICKS; i ++) {
+    HTEST_ASSERT(Tick_from_fd_session(t, &session, &sz) == HARIS_SUCCESS);
+    HTEST_ASSERT(sz == 26 + 2 * (i % 7));
+    HTEST_ASSERT(check_tick(t, i));
+  }
+  HTEST_ASSERT(Tick_from_fd_session(t, &session, &sz) == HARIS_INPUT_ERROR);
+  HTEST_ASSERT(session.eof);
+  close(fd);
+  Tick_destroy(t);
+  return 1;
+}
+
+static int plain_fd_test(void)
+{
+  haris_uint32_t i, sz;
+  int fd = write_ticks();
+  Tick *t = Tick_create();
+  HTEST_ASSERT(fd >= 0 && t);
+  for (i = 0; i < NUM_TICKS; i ++) {
+    HTEST_ASSERT(Tick_from_fd(t, fd, &sz) == HARIS_SUCCESS);
+    HTEST_ASSERT(check_tick(t, i));
+  }
+  HTEST_ASSERT(Tick_from_fd(t, fd, &sz) == HARIS_INPUT_ERROR);
+  close(fd);
+  Tick_destroy(t);
+  return 1;
+}
+
+static int large_payload_test(void)
+{
+  /* Enough large payloads that the writer has to flush several times in
+     the middle of the message */
+  haris_uint32_t i, j, sz, expected_sz = 2 + 4 + 6;
+  FILE *f = tmpfile();
+  Batch *in = Batch_create(), *out = Batch_create();
+  HTEST_ASSERT(f && in && out);
+  in->id = 99;
+  HTEST_ASSERT(Batch_init_ticks(in, 150) == HARIS_SUCCESS);
+  for (i = 0; i < 150; i ++) {
+    Tick *t = &Batch_get_ticks(in)[i];
+    HTEST_ASSERT(fill_tick(t, i));
+    HTEST_ASSERT(Tick_init_venue(t, 300 + i) == HARIS_SUCCESS);
+    for (j = 0; j < 300 + i; j ++)
+      Tick_get_venue(t)[j] = (char)(i + j);
+    expected_sz += 12 + 4 + 300 + i + 4 + 2 * (i % 7);
+  }
+  HTEST_ASSERT(Batch_to_fd(in, fileno(f), &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == expected_sz);
+  HTEST_ASSERT(lseek(fileno(f), 0, SEEK_SET) == 0);
+  haris_fd_session_init(&session, fileno(f));
+  HTEST_ASSERT(Batch_from_fd_session(out, &session, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == expected_sz);
+  HTEST_ASSERT(out->id == 99 && Batch_len_ticks(out) == 150);
+  for (i = 0; i < 150; i ++) {
+    Tick *t = &Batch_get_ticks(out)[i];
+    HTEST_ASSERT(t->seq == i && Tick_len_venue(t) == 300 + i);
+    for (j = 0; j < 300 + i; j ++)
+      HTEST_ASSERT(Tick_get_venue(t)[j] == (char)(i + j));
+  }
+  fclose(f);
+  Batch_destroy(in);
+  Batch_destroy(out);
+  return 1;
+}
+
+typedef struct {
+  haris_uint32_t next;
+  haris_uint32_t fail_at;
+} TickProducer;
+
+/* Refills the same scratch Tick every time, with venues large enough that
+   the fd writer points at them rather than copying them */
+static HarisStatus next_tick(void *ctx, Tick *t)
+{
+  TickProducer *producer = (TickProducer*)ctx;
+  haris_uint32_t i = producer->next ++, j;
+  if (i == producer->fail_at) return HARIS_INPUT_ERROR;
+  if (!fill_tick(t, i) || Tick_init_venue(t, 300 + i) != HARIS_SUCCESS)
+    return HARIS_MEM_ERROR;
+  for (j = 0; j < 300 + i; j ++)
+    Tick_get_venue(t)[j] = (char)(i + j);
+  return HARIS_SUCCESS;
+}
+
+static int same_contents(FILE *f, const unsigned char *expected,
+                         haris_uint32_t sz)
+{
+  unsigned char *contents = (unsigned char*)malloc(sz + 1);
+  HTEST_ASSERT(contents);
+  rewind(f);
+  HTEST_ASSERT(fread(contents, 1, sz + 1, f) == sz);
+  HTEST_ASSERT(memcmp(contents, expected, sz) == 0);
+  free(contents);
+  return 1;
+}
+
+/* A produced list encodes to the same bytes as the list in memory */
+static int producing_test(void)
+{
+  TickProducer producer = { 0, (haris_uint32_t)-1 };
+  unsigned char *expected;
+  haris_uint32_t i, sz, expected_sz;
+  FILE *f = tmpfile(), *g = tmpfile();
+  Batch *in = Batch_create(), *empty = Batch_create();
+  HTEST_ASSERT(f && g && in && empty);
+  in->id = empty->id = 99;
+  HTEST_ASSERT(Batch_init_ticks(in, 150) == HARIS_SUCCESS);
+  for (i = 0; i < 150; i ++)
+    HTEST_ASSERT(next_tick(&producer, &Batch_get_ticks(in)[i]) 
+                 == HARIS_SUCCESS);
+  HTEST_ASSERT(Batch_to_buffer_a(in, &expected, &expected_sz) 
+               == HARIS_SUCCESS);
+  producer.next = 0;
+  HTEST_ASSERT(Batch_to_fd_producing_ticks(empty, 150, next_tick, &producer,
+                                           fileno(f), &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == expected_sz && producer.next == 150);
+  HTEST_ASSERT(same_contents(f, expected, sz));
+  producer.next = 0;
+  HTEST_ASSERT(Batch_to_file_producing_ticks(empty, 150, next_tick,
+                                             &producer, g, &sz) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == expected_sz && producer.next == 150);
+  HTEST_ASSERT(same_contents(g, expected, sz));
+  /* An error from the producer stops the encoder */
+  producer.next = 0;
+  producer.fail_at = 10;
+  HTEST_ASSERT(Batch_to_fd_producing_ticks(empty, 150, next_tick, &producer,
+                                           fileno(f), &sz) 
+               == HARIS_INPUT_ERROR);
+  HTEST_ASSERT(producer.next == 11);
+  fclose(f);
+  fclose(g);
+  free(expected);
+  Batch_destroy(in);
+  Batch_destroy(empty);
+  return 1;
+}
+
+static int all_tests(void)
+{
+  HTEST_RUN(session_test);
+  HTEST_RUN(plain_fd_test);
+  HTEST_RUN(large_payload_test);
+  HTEST_RUN(producing_test);
+  return 1;
+}
+
+int main(void)
+{
+  if (!all_tests()) return -1;
+  else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
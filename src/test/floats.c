@@ -0,0 +1,136 @@
+#include "htest.h"
+#include "floats.haris.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <float.h>
+#include <math.h>
+
+/* Floats are compared by their bits, so that -0.0 and NaN payloads must
+   survive the round trip intact */
+static int same_float32(haris_float32 a, haris_float32 b)
+{
+  return memcmp(&a, &b, sizeof a) == 0;
+}
+
+static int same_float64(haris_float64 a, haris_float64 b)
+{
+  return memcmp(&a, &b, sizeof a) == 0;
+}
+
+static const haris_float32 special_float32s[] = {
+  0.0f, -0.0f, 1.0f, -1.0f, 0.1f, -3.5e-5f, 123456.789f,
+  FLT_MAX, -FLT_MAX, FLT_MIN, -FLT_MIN, FLT_MIN / 2.0f, FLT_MIN / 4096.0f,
+  FLT_EPSILON, HUGE_VALF, -HUGE_VALF, NAN
+};
+
+static const haris_float64 special_float64s[] = {
+  0.0, -0.0, 1.0, -1.0, 0.1, -3.5e-300, 1.0e300,
+  DBL_MAX, -DBL_MAX, DBL_MIN, -DBL_MIN, DBL_MIN / 2.0, DBL_MIN / 1.0e10,
+  DBL_EPSILON, HUGE_VAL, -HUGE_VAL, NAN
+};
+
+#define NUM_FLOAT32S (sizeof special_float32s / sizeof special_float32s[0])
+#define NUM_FLOAT64S (sizeof special_float64s / sizeof special_float64s[0])
+
+static int encoding_test_1(void)
+{
+  /* 1.0f == 0x3F800000, -2.5 == 0xC004000000000000 */
+  unsigned char buffer[22], *out_addr,
+    test_buffer[22] = { 0x42, 0xC, 0, 0, 0x80, 0x3F, 
+                        0, 0, 0, 0, 0, 0, 0x4, 0xC0,
+                        0x82, 0, 0, 0, 0x83, 0, 0, 0 };
+  Floats *floats = Floats_create();
+  HTEST_ASSERT(floats);
+  floats->f = 1.0f;
+  floats->d = -2.5;
+  HTEST_ASSERT(Floats_init_fs(floats, 0) == HARIS_SUCCESS);
+  HTEST_ASSERT(Floats_init_ds(floats, 0) == HARIS_SUCCESS);
+  HTEST_ASSERT(Floats_to_buffer(floats, buffer, sizeof buffer, &out_addr)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == 22);
+  HTEST_ASSERT(buffer_equal(buffer, test_buffer, 22));
+  Floats_destroy(floats);
+  return 1;
+}
+
+static int encoding_test_2(void)
+{
+  /* Infinity, NaN and the subnormals have exact encodings */
+  unsigned char buffer[22], *out_addr;
+  Floats *floats = Floats_create();
+  HTEST_ASSERT(floats);
+  floats->f = -HUGE_VALF;
+  floats->d = DBL_MIN / 2.0;
+  HTEST_ASSERT(Floats_init_fs(floats, 0) == HARIS_SUCCESS);
+  HTEST_ASSERT(Floats_init_ds(floats, 0) == HARIS_SUCCESS);
+  HTEST_ASSERT(Floats_to_buffer(floats, buffer, sizeof buffer, &out_addr)
+               == HARIS_SUCCESS);
+  /* -inf == 0xFF800000 */
+  HTEST_ASSERT(buffer[2] == 0 && buffer[3] == 0 && buffer[4] == 0x80 &&
+               buffer[5] == 0xFF);
+  /* DBL_MIN / 2 == 0x0008000000000000 */
+  HTEST_ASSERT(buffer[6] == 0 && buffer[11] == 0 && buffer[12] == 0x8 && 
+               buffer[13] == 0);
+  floats->f = NAN;
+  HTEST_ASSERT(Floats_to_buffer(floats, buffer, sizeof buffer, &out_addr)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT((buffer[5] & 0x7F) == 0x7F && (buffer[4] & 0x80) &&
+               (buffer[2] || buffer[3] || (buffer[4] & 0x7F)));
+  Floats_destroy(floats);
+  return 1;
+}
+
+static int round_trip_test(void)
+{
+  unsigned char *buffer, *out_addr;
+  haris_uint32_t sz, i, j;
+  Floats *in = Floats_create(), *out = Floats_create();
+  HTEST_ASSERT(in && out);
+  HTEST_ASSERT(Floats_init_fs(in, NUM_FLOAT32S) == HARIS_SUCCESS);
+  HTEST_ASSERT(Floats_init_ds(in, NUM_FLOAT64S) == HARIS_SUCCESS);
+  for (i = 0; i < NUM_FLOAT32S; i ++)
+    Floats_get_fs(in)[i] = special_float32s[i];
+  for (i = 0; i < NUM_FLOAT64S; i ++)
+    Floats_get_ds(in)[i] = special_float64s[i];
+  for (i = 0; i < NUM_FLOAT32S; i ++) {
+    j = i % NUM_FLOAT64S;
+    in->f = special_float32s[i];
+    in->d = special_float64s[j];
+    HTEST_ASSERT(Floats_to_buffer_a(in, &buffer, &sz) == HARIS_SUCCESS);
+    HTEST_ASSERT(Floats_from_buffer(out, buffer, sz, &out_addr) 
+                 == HARIS_SUCCESS);
+    HTEST_ASSERT(out_addr - buffer == (ptrdiff_t)sz);
+    HTEST_ASSERT(same_float32(out->f, special_float32s[i]));
+    HTEST_ASSERT(same_float64(out->d, special_float64s[j]));
+    free(buffer);
+  }
+  HTEST_ASSERT(Floats_len_fs(out) == NUM_FLOAT32S);
+  HTEST_ASSERT(Floats_len_ds(out) == NUM_FLOAT64S);
+  for (i = 0; i < NUM_FLOAT32S; i ++)
+    HTEST_ASSERT(same_float32(Floats_get_fs(out)[i], special_float32s[i]));
+  for (i = 0; i < NUM_FLOAT64S; i ++)
+    HTEST_ASSERT(same_float64(Floats_get_ds(out)[i], special_float64s[i]));
+  Floats_destroy(in);
+  Floats_destroy(out);
+  return 1;
+}
+
+static int all_tests(void)
+{
+  HTEST_RUN(encoding_test_1);
+  HTEST_RUN(encoding_test_2);
+  HTEST_RUN(round_trip_test);
+  return 1;
+}
+
+int main(void)
+{
+  if (!all_tests()) return -1;
+  else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
@@ -0,0 +1,153 @@
+#define _POSIX_C_SOURCE 200809L
+#include "htest.h"
+#include "mmap.haris.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#define NUM_QUOTES 500
+
+static char path[] = "/tmp/haris_mmap_XXXXXX";
+
+static int fill_quote(Quote *q, haris_uint32_t seq)
+{
+  haris_uint32_t i;
+  q->seq = seq;
+  HTEST_ASSERT(Quote_init_symbol(q, 1 + seq % 5) == HARIS_SUCCESS);
+  memcpy(Quote_get_symbol(q), "ABCDE", 1 + seq % 5);
+  HTEST_ASSERT(Quote_init_levels(q, seq % 9) == HARIS_SUCCESS);
+  for (i = 0; i < seq % 9; i ++) {
+    Quote_get_levels(q)[i].price = (haris_int32_t)(seq * 10 + i);
+    Quote_get_levels(q)[i].size = i;
+  }
+  if (seq % 2) {
+    HTEST_ASSERT(Quote_init_best(q) == HARIS_SUCCESS);
+    Quote_get_best(q)->price = -(haris_int32_t)seq;
+    Quote_get_best(q)->size = seq;
+  } else {
+    Quote_clear_best(q);
+  }
+  return 1;
+}
+
+static int check_quote(Quote *q, haris_uint32_t seq)
+{
+  haris_uint32_t i;
+  HTEST_ASSERT(q->seq == seq);
+  HTEST_ASSERT(Quote_len_symbol(q) == 1 + seq % 5);
+  HTEST_ASSERT(memcmp(Quote_get_symbol(q), "ABCDE", 1 + seq % 5) == 0);
+  HTEST_ASSERT(Quote_len_levels(q) == seq % 9);
+  for (i = 0; i < seq % 9; i ++) {
+    HTEST_ASSERT(Quote_get_levels(q)[i].price == (haris_int32_t)(seq * 10 + i));
+    HTEST_ASSERT(Quote_get_levels(q)[i].size == i);
+  }
+  if (seq % 2) {
+    HTEST_ASSERT(Quote_has_best(q));
+    HTEST_ASSERT(Quote_get_best(q)->price == -(haris_int32_t)seq);
+    HTEST_ASSERT(Quote_get_best(q)->size == seq);
+  } else {
+    HTEST_ASSERT(!Quote_has_best(q));
+  }
+  return 1;
+}
+
+/* Writes `n` quotes to the file at `path`, then `extra` bytes of the 
+   next one */
+static int write_quotes(haris_uint32_t n, haris_uint32_t extra)
+{
+  haris_uint32_t i;
+  unsigned char buf[512];
+  unsigned char *end;
+  Quote *q = Quote_create();
+  FILE *f = fopen(path, "wb");
+  HTEST_ASSERT(q && f);
+  for (i = 0; i < n; i ++) {
+    HTEST_ASSERT(fill_quote(q, i));
+    HTEST_ASSERT(Quote_to_file(q, f, NULL) == HARIS_SUCCESS);
+  }
+  if (extra) {
+    HTEST_ASSERT(fill_quote(q, n));
+    HTEST_ASSERT(Quote_to_buffer(q, buf, sizeof buf, &end) == HARIS_SUCCESS);
+    HTEST_ASSERT(extra < (haris_uint32_t)(end - buf));
+    HTEST_ASSERT(fwrite(buf, 1, extra, f) == extra);
+  }
+  fclose(f);
+  Quote_destroy(q);
+  return 1;
+}
+
+static int iterate_test(void)
+{
+  haris_uint32_t i;
+  HarisMmapIter iter;
+  Quote *q = Quote_create();
+  HTEST_ASSERT(q);
+  HTEST_ASSERT(write_quotes(NUM_QUOTES, 0));
+  HTEST_ASSERT(haris_mmap_open(&iter, path) == HARIS_SUCCESS);
+  for (i = 0; !haris_mmap_at_end(&iter); i ++) {
+    HTEST_ASSERT(Quote_mmap_next(&iter, q) == HARIS_SUCCESS);
+    HTEST_ASSERT(check_quote(q, i));
+  }
+  HTEST_ASSERT(i == NUM_QUOTES);
+  HTEST_ASSERT(Quote_mmap_next(&iter, q) == HARIS_INPUT_ERROR);
+  haris_mmap_close(&iter);
+  Quote_destroy(q);
+  return 1;
+}
+
+static int truncated_test(void)
+{
+  haris_uint32_t i;
+  size_t pos;
+  HarisMmapIter iter;
+  Quote *q = Quote_create();
+  HTEST_ASSERT(q);
+  HTEST_ASSERT(write_quotes(10, 9));
+  HTEST_ASSERT(haris_mmap_open(&iter, path) == HARIS_SUCCESS);
+  for (i = 0; i < 10; i ++)
+    HTEST_ASSERT(Quote_mmap_next(&iter, q) == HARIS_SUCCESS);
+  pos = iter.pos;
+  HTEST_ASSERT(!haris_mmap_at_end(&iter));
+  HTEST_ASSERT(Quote_mmap_next(&iter, q) == HARIS_INPUT_ERROR);
+  HTEST_ASSERT(iter.pos == pos && iter.sz == pos + 9);
+  haris_mmap_close(&iter);
+  Quote_destroy(q);
+  return 1;
+}
+
+static int empty_test(void)
+{
+  HarisMmapIter iter;
+  HTEST_ASSERT(write_quotes(0, 0));
+  HTEST_ASSERT(haris_mmap_open(&iter, path) == HARIS_SUCCESS);
+  HTEST_ASSERT(haris_mmap_at_end(&iter));
+  haris_mmap_close(&iter);
+  HTEST_ASSERT(unlink(path) == 0);
+  HTEST_ASSERT(haris_mmap_open(&iter, path) == HARIS_INPUT_ERROR);
+  return 1;
+}
+
+static int all_tests(void)
+{
+  int fd = mkstemp(path);
+  HTEST_ASSERT(fd >= 0);
+  close(fd);
+  HTEST_RUN(iterate_test);
+  HTEST_RUN(truncated_test);
+  HTEST_RUN(empty_test);
+  return 1;
+}
+
+int main(void)
+{
+  if (!all_tests()) {
+    unlink(path);
+    return -1;
+  } else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
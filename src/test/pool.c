@@ -0,0 +1,96 @@
+#include "htest.h"
+#include "pool.haris.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+static int reuse_test(void)
+{
+  Flag *a, *b;
+  HarisPoolStats stats;
+  a = Flag_create();
+  HTEST_ASSERT(a);
+  a->value = 7;
+  Flag_destroy(a);
+  b = Flag_create();
+  /* The block comes back off the free list, cleared */
+  HTEST_ASSERT(b == a && b->value == 0);
+  Flag_destroy(b);
+  Flag_pool_stats(&stats);
+  HTEST_ASSERT(stats.hits == 1 && stats.misses == 1);
+  HTEST_ASSERT(stats.returns == 2 && stats.overflows == 0);
+  return 1;
+}
+
+static int nested_test(void)
+{
+  /* Destroying a chain puts every Node in it, and their Flags, in the 
+     pools; building the same chain again doesn't need any new memory */
+  int i, round;
+  Node *head, *n;
+  HarisPoolStats before, after;
+  for (round = 0; round < 2; round ++) {
+    Node_pool_stats(&before);
+    HTEST_ASSERT((head = Node_create()) != NULL);
+    for (i = 0, n = head; i < 10; i ++, n = Node_get_next(n)) {
+      n->id = (haris_uint32_t)i;
+      HTEST_ASSERT(Node_init_label(n, 3) == HARIS_SUCCESS);
+      memcpy(Node_get_label(n), "abc", 3);
+      HTEST_ASSERT(Node_init_flag(n) == HARIS_SUCCESS);
+      HTEST_ASSERT(Node_get_flag(n)->value == 0);
+      HTEST_ASSERT(Node_init_next(n) == HARIS_SUCCESS);
+    }
+    Node_destroy(head);
+    Node_pool_stats(&after);
+    HTEST_ASSERT(after.returns - before.returns == 11);
+    if (round == 1) {
+      HTEST_ASSERT(after.hits - before.hits == 11);
+      HTEST_ASSERT(after.misses == before.misses);
+    }
+  }
+  return 1;
+}
+
+static int high_water_test(void)
+{
+  int i;
+  Flag *flags[8];
+  HarisPoolStats before, after;
+  Flag_pool_set_high_water(3);
+  Flag_pool_stats(&before);
+  for (i = 0; i < 8; i ++)
+    HTEST_ASSERT((flags[i] = Flag_create()) != NULL);
+  for (i = 0; i < 8; i ++)
+    Flag_destroy(flags[i]);
+  Flag_pool_stats(&after);
+  HTEST_ASSERT(after.returns - before.returns == 3);
+  HTEST_ASSERT(after.overflows - before.overflows == 5);
+  Flag_pool_set_high_water(0);
+  HTEST_ASSERT((flags[0] = Flag_create()) != NULL);
+  Flag_destroy(flags[0]);
+  Flag_pool_stats(&before);
+  HTEST_ASSERT(before.misses - after.misses == 1);
+  HTEST_ASSERT(before.overflows - after.overflows == 1);
+  return 1;
+}
+
+static int all_tests(void)
+{
+  HTEST_RUN(reuse_test);
+  HTEST_RUN(nested_test);
+  HTEST_RUN(high_water_test);
+  return 1;
+}
+
+int main(void)
+{
+  int result = all_tests();
+  haris_pool_drain();
+  if (!result) return -1;
+  else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
@@ -0,0 +1,456 @@
+#define _POSIX_C_SOURCE 200112L
+#include "htest.h"
+#include "shapes.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Feeds the message in pieces of the given size and checks that the
+   structure that comes out encodes to the same message */
+static int feed_in_pieces(const unsigned char *buffer, haris_uint32_t sz,
+                          haris_uint32_t piece)
+{
+  HarisDecoder dec;
+  HarisStatus result = HARIS_NEED_MORE;
+  haris_uint32_t pos = 0, n, out_sz;
+  size_t used;
+  unsigned char *out_buffer;
+  Shape *out = Shape_create();
+  HTEST_ASSERT(out);
+  Shape_decoder_init(&dec, out);
+  while (pos < sz) {
+    HTEST_ASSERT(result == HARIS_NEED_MORE);
+    n = (piece < sz - pos ? piece : sz - pos);
+    result = Shape_decoder_feed(&dec, buffer + pos, n, &used);
+    HTEST_ASSERT(used == n);
+    pos += n;
+  }
+  HTEST_ASSERT(result == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_to_buffer_a(out, &out_buffer, &out_sz) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_sz == sz && buffer_equal(buffer, out_buffer, sz));
+  free(out_buffer);
+  Shape_destroy(out);
+  return 1;
+}
+
+static int pieces_test(void)
+{
+  static const haris_uint32_t pieces[] = { 1, 2, 3, 5, 7, 64, 1000 };
+  unsigned char *buffer;
+  haris_uint32_t sz;
+  size_t i;
+  Shape *s = Shape_create();
+  HTEST_ASSERT(s && fill_shape(s, 3));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  for (i = 0; i < sizeof pieces / sizeof pieces[0]; i ++)
+    HTEST_ASSERT(feed_in_pieces(buffer, sz, pieces[i]));
+  free(buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+/* Pieces of random sizes, so that every kind of header and every scalar
+   gets split in every possible place sooner or later */
+static int random_pieces_test(void)
+{
+  unsigned char *buffer, *out_buffer;
+  haris_uint32_t sz, pos, n, out_sz;
+  size_t used;
+  int i;
+  HarisDecoder dec;
+  HarisStatus result;
+  Shape *s = Shape_create(), *out;
+  HTEST_ASSERT(s && fill_shape(s, 3));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  srand(12345);
+  for (i = 0; i < 200; i ++) {
+    out = Shape_create();
+    HTEST_ASSERT(out);
+    Shape_decoder_init(&dec, out);
+    result = HARIS_NEED_MORE;
+    for (pos = 0; pos < sz; pos += n) {
+      HTEST_ASSERT(result == HARIS_NEED_MORE);
+      n = (haris_uint32_t)(rand() % 12);
+      if (n > sz - pos) n = sz - pos;
+      result = Shape_decoder_feed(&dec, buffer + pos, n, &used);
+      HTEST_ASSERT(used == n);
+    }
+    HTEST_ASSERT(result == HARIS_SUCCESS);
+    HTEST_ASSERT(Shape_to_buffer_a(out, &out_buffer, &out_sz) 
+                 == HARIS_SUCCESS);
+    HTEST_ASSERT(out_sz == sz && buffer_equal(buffer, out_buffer, sz));
+    free(out_buffer);
+    Shape_destroy(out);
+  }
+  free(buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+/* The decoder stops at the end of the message, even if there's more
+   input; once it's done, it stays done */
+static int back_to_back_test(void)
+{
+  unsigned char *first, *second, *both;
+  haris_uint32_t sz1, sz2;
+  size_t used;
+  HarisDecoder dec;
+  Shape *s = Shape_create(), *out = Shape_create();
+  HTEST_ASSERT(s && out && fill_shape(s, 1));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &first, &sz1) == HARIS_SUCCESS);
+  s->k = Kind_SQUARE;
+  HTEST_ASSERT(Shape_init_parts(s, 0) == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_to_buffer_a(s, &second, &sz2) == HARIS_SUCCESS);
+  both = (unsigned char *)malloc(sz1 + sz2);
+  HTEST_ASSERT(both);
+  memcpy(both, first, sz1);
+  memcpy(both + sz1, second, sz2);
+  Shape_decoder_init(&dec, out);
+  HTEST_ASSERT(Shape_decoder_feed(&dec, both, sz1 + sz2, &used) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(used == sz1);
+  HTEST_ASSERT(out->k == Kind_CIRCLE && Shape_len_parts(out) == 1);
+  HTEST_ASSERT(Shape_decoder_feed(&dec, both + used, sz2, &used)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(used == 0);
+  /* The same structure can be reused for the next message */
+  Shape_decoder_init(&dec, out);
+  HTEST_ASSERT(Shape_decoder_feed(&dec, both + sz1, sz2, &used) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(used == sz2);
+  HTEST_ASSERT(out->k == Kind_SQUARE && Shape_len_parts(out) == 0);
+  free(first);
+  free(second);
+  free(both);
+  Shape_destroy(s);
+  Shape_destroy(out);
+  return 1;
+}
+
+/* Every proper prefix of a message needs more; none of them is an error */
+static int prefix_test(void)
+{
+  unsigned char *buffer;
+  haris_uint32_t sz, i;
+  size_t used;
+  HarisDecoder dec;
+  Shape *s = Shape_create(), *out;
+  HTEST_ASSERT(s && fill_shape(s, 1));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  for (i = 0; i < sz; i ++) {
+    out = Shape_create();
+    HTEST_ASSERT(out);
+    Shape_decoder_init(&dec, out);
+    HTEST_ASSERT(Shape_decoder_feed(&dec, buffer, i, &used) 
+                 == HARIS_NEED_MORE);
+    HTEST_ASSERT(used == i);
+    Shape_destroy(out);
+  }
+  free(buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+static int error_test(void)
+{
+  unsigned char *buffer;
+  haris_uint32_t sz;
+  size_t used;
+  HarisDecoder dec;
+  Shape *s = Shape_create(), *out = Shape_create();
+  Link *l = Link_create();
+  HTEST_ASSERT(s && out && l && fill_shape(s, 0));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  /* A Shape is not a Link: its first child is text */
+  Link_decoder_init(&dec, l);
+  HTEST_ASSERT(Link_decoder_feed(&dec, buffer, sz, &used) 
+               == HARIS_STRUCTURE_ERROR);
+  /* The error sticks */
+  HTEST_ASSERT(Link_decoder_feed(&dec, buffer, sz, &used) 
+               == HARIS_STRUCTURE_ERROR);
+  HTEST_ASSERT(used == 0);
+  /* The decoder has to be fed the type it was set up for */
+  Shape_decoder_init(&dec, out);
+  HTEST_ASSERT(Link_decoder_feed(&dec, buffer, sz, &used) 
+               == HARIS_STRUCTURE_ERROR);
+  /* The name is text, not a list of structures; the error is found as
+     soon as its header is complete, even if that takes two pieces */
+  buffer[2 + 9] = 0xC0;
+  Shape_decoder_init(&dec, out);
+  HTEST_ASSERT(Shape_decoder_feed(&dec, buffer, 14, &used) 
+               == HARIS_NEED_MORE);
+  HTEST_ASSERT(Shape_decoder_feed(&dec, buffer + 14, sz - 14, &used) 
+               == HARIS_STRUCTURE_ERROR);
+  free(buffer);
+  Shape_destroy(s);
+  Shape_destroy(out);
+  Link_destroy(l);
+  return 1;
+}
+
+static int depth_test(void)
+{
+  /* As in validate.c, the message is put together by hand: every link is
+     a header, a one-byte body, and then the next link */
+  unsigned char *buffer, *out_addr;
+  haris_uint32_t sz = 3 * (HARIS_DEPTH_LIMIT + 5) + 1, i;
+  size_t used;
+  HarisDecoder dec;
+  Link *out = Link_create();
+  buffer = (unsigned char *)malloc(sz);
+  HTEST_ASSERT(out && buffer);
+  for (i = 0; i < HARIS_DEPTH_LIMIT + 5; i ++) {
+    buffer[3 * i] = 0x41;
+    buffer[3 * i + 1] = 1;
+    buffer[3 * i + 2] = (unsigned char)i;
+  }
+  buffer[sz - 1] = 0;
+  /* The push decoder allows exactly as much nesting as the others */
+  for (i = 0; i < 10; i ++) {
+    HarisStatus expected = Link_from_buffer(out, buffer + 3 * i, sz - 3 * i,
+                                            &out_addr);
+    Link_decoder_init(&dec, out);
+    HTEST_ASSERT(Link_decoder_feed(&dec, buffer + 3 * i, sz - 3 * i, &used)
+                 == expected);
+  }
+  HTEST_ASSERT(Link_decoder_feed(&dec, buffer, sz, &used) == HARIS_SUCCESS);
+  Link_decoder_init(&dec, out);
+  HTEST_ASSERT(Link_decoder_feed(&dec, buffer, sz, &used) 
+               == HARIS_DEPTH_ERROR);
+  free(buffer);
+  Link_destroy(out);
+  return 1;
+}
+
+/* An older reader throws away the children it doesn't know about, and
+   gets the same structure as it would have from the buffer decoder */
+static int unknown_children_test(void)
+{
+  unsigned char *buffer, *out_addr;
+  haris_uint32_t sz, i;
+  size_t used;
+  HarisDecoder dec;
+  Shape *s = Shape_create();
+  Small *expected = Small_create(), *out = Small_create();
+  HTEST_ASSERT(s && expected && out && fill_shape(s, 2));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(Small_from_buffer(expected, buffer, sz, &out_addr)
+               == HARIS_SUCCESS);
+  Small_decoder_init(&dec, out);
+  for (i = 0; i < sz - 1; i ++) {
+    HTEST_ASSERT(Small_decoder_feed(&dec, buffer + i, 1, &used) 
+                 == HARIS_NEED_MORE);
+  }
+  HTEST_ASSERT(Small_decoder_feed(&dec, buffer + i, 1, &used) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out->k == expected->k && out->weight == expected->weight);
+  HTEST_ASSERT(Small_len_name(out) == 3 && 
+               memcmp(Small_get_name(out), "abc", 3) == 0);
+  free(buffer);
+  Shape_destroy(s);
+  Small_destroy(expected);
+  Small_destroy(out);
+  return 1;
+}
+
+/* Pulls the message in pieces of the given size and checks that they add
+   up to what the buffer encoder writes */
+static int pull_in_pieces(Shape *s, const unsigned char *buffer,
+                          haris_uint32_t sz, size_t piece)
+{
+  HarisEncoder enc;
+  HarisStatus result = HARIS_NEED_MORE;
+  haris_uint32_t size;
+  size_t pos = 0, n;
+  unsigned char *out = (unsigned char *)malloc(sz + piece);
+  HTEST_ASSERT(out);
+  HTEST_ASSERT(Shape_encoder_begin(&enc, s, &size) == HARIS_SUCCESS);
+  HTEST_ASSERT(size == sz);
+  while (result == HARIS_NEED_MORE) {
+    HTEST_ASSERT(pos < sz);
+    result = Shape_encoder_pull(&enc, out + pos, piece, &n);
+    HTEST_ASSERT(n == piece || (result == HARIS_SUCCESS && n < piece));
+    pos += n;
+  }
+  HTEST_ASSERT(result == HARIS_SUCCESS);
+  HTEST_ASSERT(pos == sz && buffer_equal(buffer, out, sz));
+  /* Once it's done, there's nothing more to pull */
+  HTEST_ASSERT(Shape_encoder_pull(&enc, out, piece, &n) == HARIS_SUCCESS);
+  HTEST_ASSERT(n == 0);
+  free(out);
+  return 1;
+}
+
+static int pull_test(void)
+{
+  static const size_t pieces[] = { 1, 2, 3, 5, 7, 64, 1000 };
+  unsigned char *buffer;
+  haris_uint32_t sz;
+  size_t i;
+  Shape *s = Shape_create();
+  HTEST_ASSERT(s && fill_shape(s, 3));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  for (i = 0; i < sizeof pieces / sizeof pieces[0]; i ++)
+    HTEST_ASSERT(pull_in_pieces(s, buffer, sz, pieces[i]));
+  HTEST_ASSERT(pull_in_pieces(s, buffer, sz, sz));
+  free(buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+/* Both ends of a pipe done incrementally: the writer sends whatever the
+   encoder gives it, a few bytes at a time, and the decoder takes whatever
+   the non-blocking reader finds */
+static int pull_pipe_test(void)
+{
+  unsigned char *buffer, *out_buffer, chunk[16], window[5];
+  haris_uint32_t sz, written = 0, out_sz;
+  ssize_t got;
+  size_t used, n;
+  int fds[2];
+  HarisDecoder dec;
+  HarisEncoder enc;
+  HarisStatus result = HARIS_NEED_MORE, pulled;
+  Shape *s = Shape_create(), *out = Shape_create();
+  HTEST_ASSERT(s && out && fill_shape(s, 2));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(pipe(fds) == 0);
+  HTEST_ASSERT(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+  Shape_decoder_init(&dec, out);
+  HTEST_ASSERT(Shape_encoder_begin(&enc, s, NULL) == HARIS_SUCCESS);
+  while (result == HARIS_NEED_MORE) {
+    got = read(fds[0], chunk, sizeof chunk);
+    if (got < 0) {
+      HTEST_ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
+      /* Nothing there yet; the writer catches up a few bytes at a time */
+      HTEST_ASSERT(written < sz);
+      pulled = Shape_encoder_pull(&enc, window, sizeof window, &n);
+      HTEST_ASSERT(pulled == HARIS_SUCCESS || pulled == HARIS_NEED_MORE);
+      HTEST_ASSERT(write(fds[1], window, n) == (ssize_t)n);
+      written += (haris_uint32_t)n;
+      continue;
+    }
+    result = Shape_decoder_feed(&dec, chunk, (size_t)got, &used);
+    HTEST_ASSERT(used == (size_t)got);
+  }
+  HTEST_ASSERT(result == HARIS_SUCCESS && written == sz);
+  HTEST_ASSERT(Shape_to_buffer_a(out, &out_buffer, &out_sz) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_sz == sz && buffer_equal(buffer, out_buffer, sz));
+  close(fds[0]);
+  close(fds[1]);
+  free(buffer);
+  free(out_buffer);
+  Shape_destroy(s);
+  Shape_destroy(out);
+  return 1;
+}
+
+static int pull_error_test(void)
+{
+  HarisEncoder enc;
+  unsigned char out[16];
+  size_t n;
+  haris_uint32_t i;
+  Shape *s = Shape_create(), *empty = Shape_create();
+  Link *l = Link_create(), *curr;
+  HTEST_ASSERT(s && empty && l && fill_shape(s, 0));
+  /* A structure without its text can't be encoded, and the encoder
+     says so before anything is written */
+  HTEST_ASSERT(Shape_encoder_begin(&enc, empty, NULL) 
+               == HARIS_STRUCTURE_ERROR);
+  HTEST_ASSERT(Shape_encoder_pull(&enc, out, sizeof out, &n) 
+               == HARIS_STRUCTURE_ERROR);
+  HTEST_ASSERT(n == 0);
+  /* The encoder has to be pulled as the type it was begun with */
+  HTEST_ASSERT(Shape_encoder_begin(&enc, s, NULL) == HARIS_SUCCESS);
+  HTEST_ASSERT(Link_encoder_pull(&enc, out, sizeof out, &n) 
+               == HARIS_STRUCTURE_ERROR);
+  /* Nor can a structure that's too deep */
+  for (i = 0, curr = l; i < HARIS_DEPTH_LIMIT + 5; i ++) {
+    HTEST_ASSERT(Link_init_next(curr) == HARIS_SUCCESS);
+    curr = Link_get_next(curr);
+    Link_clear_next(curr);
+  }
+  HTEST_ASSERT(Link_encoder_begin(&enc, l, NULL) == HARIS_DEPTH_ERROR);
+  Shape_destroy(s);
+  Shape_destroy(empty);
+  Link_destroy(l);
+  return 1;
+}
+
+/* The way the decoder is meant to be used: read whatever a non-blocking
+   descriptor has, hand it over, and go back to waiting */
+static int nonblocking_test(void)
+{
+  unsigned char *buffer, *out_buffer, chunk[16];
+  haris_uint32_t sz, written = 0, out_sz;
+  ssize_t got;
+  size_t used;
+  int fds[2];
+  HarisDecoder dec;
+  HarisStatus result = HARIS_NEED_MORE;
+  Shape *s = Shape_create(), *out = Shape_create();
+  HTEST_ASSERT(s && out && fill_shape(s, 2));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(pipe(fds) == 0);
+  HTEST_ASSERT(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+  Shape_decoder_init(&dec, out);
+  while (result == HARIS_NEED_MORE) {
+    got = read(fds[0], chunk, sizeof chunk);
+    if (got < 0) {
+      HTEST_ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
+      /* Nothing there yet; the writer catches up a few bytes at a time */
+      HTEST_ASSERT(written < sz);
+      got = write(fds[1], buffer + written, 
+                  (sz - written < 5 ? sz - written : 5));
+      HTEST_ASSERT(got > 0);
+      written += (haris_uint32_t)got;
+      continue;
+    }
+    result = Shape_decoder_feed(&dec, chunk, (size_t)got, &used);
+    HTEST_ASSERT(used == (size_t)got);
+  }
+  HTEST_ASSERT(result == HARIS_SUCCESS && written == sz);
+  HTEST_ASSERT(Shape_to_buffer_a(out, &out_buffer, &out_sz) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_sz == sz && buffer_equal(buffer, out_buffer, sz));
+  close(fds[0]);
+  close(fds[1]);
+  free(buffer);
+  free(out_buffer);
+  Shape_destroy(s);
+  Shape_destroy(out);
+  return 1;
+}
+
+static int all_tests(void)
+{
+  HTEST_RUN(pieces_test);
+  HTEST_RUN(random_pieces_test);
+  HTEST_RUN(back_to_back_test);
+  HTEST_RUN(prefix_test);
+  HTEST_RUN(error_test);
+  HTEST_RUN(depth_test);
+  HTEST_RUN(unknown_children_test);
+  HTEST_RUN(pull_test);
+  HTEST_RUN(pull_pipe_test);
+  HTEST_RUN(pull_error_test);
+  HTEST_RUN(nonblocking_test);
+  return 1;
+}
+
+int main(void)
+{
+  if (!all_tests()) return -1;
+  else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
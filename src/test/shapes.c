@@ -0,0 +1,35 @@
+#include "htest.h"
+#include "shapes.h"
+#include <stdio.h>
+#include <string.h>
+
+int fill_shape(Shape *s, int parts)
+{
+  int i;
+  s->k = Kind_CIRCLE;
+  s->weight = 2.5;
+  HTEST_ASSERT(Shape_init_name(s, 3) == HARIS_SUCCESS);
+  memcpy(Shape_get_name(s), "abc", 3);
+  HTEST_ASSERT(Shape_init_values(s, 5) == HARIS_SUCCESS);
+  for (i = 0; i < 5; i ++)
+    Shape_get_values(s)[i] = (haris_int16_t)(-300 * i);
+  HTEST_ASSERT(Shape_init_ids(s, 4) == HARIS_SUCCESS);
+  for (i = 0; i < 4; i ++)
+    Shape_get_ids(s)[i] = 0x0102030405060708ULL * (haris_uint64_t)i;
+  HTEST_ASSERT(Shape_init_points(s, 3) == HARIS_SUCCESS);
+  for (i = 0; i < 3; i ++) {
+    Shape_get_points(s)[i].x = i;
+    Shape_get_points(s)[i].y = -i;
+  }
+  HTEST_ASSERT(Shape_init_origin(s) == HARIS_SUCCESS);
+  Shape_clear_extra(s);
+  HTEST_ASSERT(Shape_init_chain(s) == HARIS_SUCCESS);
+  Shape_get_chain(s)->id = 1;
+  HTEST_ASSERT(Link_init_next(Shape_get_chain(s)) == HARIS_SUCCESS);
+  Link_get_next(Shape_get_chain(s))->id = 2;
+  Link_clear_next(Link_get_next(Shape_get_chain(s)));
+  HTEST_ASSERT(Shape_init_parts(s, (haris_uint32_t)parts) == HARIS_SUCCESS);
+  for (i = 0; i < parts; i ++)
+    HTEST_ASSERT(fill_shape(&Shape_get_parts(s)[i], 0));
+  return 1;
+}
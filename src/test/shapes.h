@@ -0,0 +1,11 @@
+#ifndef SHAPES_H_
+#define SHAPES_H_
+
+#include "validate.haris.h"
+
+/* The Shape that the tests built on validate.haris work with. Each of its
+   `parts` is filled in the same way, with no parts of its own. */
+
+int fill_shape(Shape *, int parts);
+
+#endif
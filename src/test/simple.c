@@ -431,10 +431,141 @@ static int decoding_tests(void)
   return 1;
 }
 
+static int signed_encoding_test(void)
+{
+  unsigned char *buffer,
+    test_buffer[16] = { 0x40, 0xE, 0xFE, 0xFF, 0x90, 0xEE, 0xFE, 0xFF,
+                        0, 0xE, 0xFA, 0xD5, 0xFE, 0xFF, 0xFF, 0xFF };
+  haris_uint32_t sz;
+  Pair *pair = Pair_create();
+  HTEST_ASSERT(pair);
+  pair->a = -2;
+  pair->b = -70000;
+  pair->c = -5000000000LL;
+  HTEST_ASSERT(Pair_to_buffer_a(pair, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == 16);
+  HTEST_ASSERT(buffer_equal(buffer, test_buffer, 16));
+  free(buffer);
+  Pair_destroy(pair);
+  return 1;
+}
+
+static int signed_decoding_test(void)
+{
+  unsigned char buffer[16] = { 0x40, 0xE, 0xFE, 0xFF, 0x90, 0xEE, 0xFE, 0xFF,
+                               0, 0xE, 0xFA, 0xD5, 0xFE, 0xFF, 0xFF, 0xFF },
+    *out_addr;
+  Pair *pair = Pair_create();
+  HTEST_ASSERT(pair);
+  HTEST_ASSERT(Pair_from_buffer(pair, buffer, sizeof buffer, &out_addr)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == 16);
+  HTEST_ASSERT(pair->a == -2);
+  HTEST_ASSERT(pair->b == -70000);
+  HTEST_ASSERT(pair->c == -5000000000LL);
+  Pair_destroy(pair);
+  return 1;
+}
+
+/* A Holder whose embedded `inner` is all zeroes, with `other` and one
+   level of `next` present */
+static int fill_holder(Holder *holder)
+{
+  Holder *next;
+  HTEST_ASSERT(Holder_init_inner(holder) == HARIS_SUCCESS);
+  HTEST_ASSERT(Holder_init_other(holder) == HARIS_SUCCESS);
+  Holder_get_other(holder)->a = -1;
+  Holder_get_other(holder)->b = 2;
+  Holder_get_other(holder)->c = -3;
+  HTEST_ASSERT(Holder_init_next(holder) == HARIS_SUCCESS);
+  next = Holder_get_next(holder);
+  HTEST_ASSERT(Holder_init_inner(next) == HARIS_SUCCESS);
+  Holder_get_inner(next)->b = 7;
+  Holder_clear_other(next);
+  Holder_clear_next(next);
+  return 1;
+}
+
+static int holder_round_trip_test(void)
+{
+  unsigned char *buffer, *out_addr;
+  haris_uint32_t sz;
+  Holder *holder = Holder_create(), *out = Holder_create(), *next;
+  HTEST_ASSERT(holder && out && fill_holder(holder));
+  HTEST_ASSERT(Holder_to_buffer_a(holder, &buffer, &sz) == HARIS_SUCCESS);
+  /* Holder, inner, other, and next with its inner and two null children;
+     none of the Holders have a body */
+  HTEST_ASSERT(sz == 2 + 16 + 16 + 2 + 16 + 2);
+  HTEST_ASSERT(Holder_from_buffer(out, buffer, sz, &out_addr) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == (ptrdiff_t)sz);
+  HTEST_ASSERT(Holder_get_inner(out)->a == 0);
+  HTEST_ASSERT(Holder_has_other(out));
+  HTEST_ASSERT(Holder_get_other(out)->a == -1);
+  HTEST_ASSERT(Holder_get_other(out)->b == 2);
+  HTEST_ASSERT(Holder_get_other(out)->c == -3);
+  HTEST_ASSERT(Holder_has_next(out));
+  next = Holder_get_next(out);
+  HTEST_ASSERT(Holder_get_inner(next)->b == 7);
+  HTEST_ASSERT(!Holder_has_other(next) && !Holder_has_next(next));
+  free(buffer);
+  Holder_destroy(holder);
+  Holder_destroy(out);
+  return 1;
+}
+
+static int holder_missing_inner_test(void)
+{
+  unsigned char *buffer;
+  haris_uint32_t sz;
+  Holder *holder = Holder_create();
+  HTEST_ASSERT(holder);
+  Holder_clear_other(holder);
+  Holder_clear_next(holder);
+  /* `inner` isn't nullable, so a Holder without it can't be encoded */
+  HTEST_ASSERT(Holder_to_buffer_a(holder, &buffer, &sz) 
+               == HARIS_STRUCTURE_ERROR);
+  /* Nothing was ever allocated for `next` */
+  Holder_destroy(holder);
+  return 1;
+}
+
+static int batch_short_element_test(void)
+{
+  /* The element claims a 2-byte body, but a Pair needs 14 */
+  unsigned char buffer[12] = { 0x41, 0, 0xC0, 0x1, 0, 0, 0x40, 0x2, 
+                               0, 0, 0, 0 },
+    *out_addr;
+  Batch *batch = Batch_create();
+  HTEST_ASSERT(batch);
+  HTEST_ASSERT(Batch_from_buffer(batch, buffer, sizeof buffer, &out_addr)
+               == HARIS_STRUCTURE_ERROR);
+  Batch_destroy(batch);
+  return 1;
+}
+
+static int (* const child_test_functions[])(void) = {
+  signed_encoding_test, signed_decoding_test,
+  holder_round_trip_test, holder_missing_inner_test,
+  batch_short_element_test
+};
+
+static int child_tests(void)
+{
+  unsigned i;
+  for (i = 0; 
+       i < sizeof child_test_functions /
+           sizeof child_test_functions[0];
+       i++)
+    HTEST_RUN(child_test_functions[i]);
+  return 1;
+}
+
 static int all_tests(void)
 {
   HTEST_RUN(encoding_tests);
   HTEST_RUN(decoding_tests);
+  HTEST_RUN(child_tests);
   return 1;
 }
 
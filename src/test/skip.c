@@ -0,0 +1,300 @@
+#define _POSIX_C_SOURCE 200112L
+#include "htest.h"
+#include "skip.haris.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+
+/* Small enough that two messages fit in a pipe without blocking */
+#define NUM_ELEMENTS 1500
+
+static HarisFdSession session;
+
+static New *make_new(haris_uint32_t id)
+{
+  haris_uint32_t i;
+  New *n = New_create();
+  if (!n) return NULL;
+  n->id = id;
+  if (New_init_name(n, 5) != HARIS_SUCCESS ||
+      New_init_big(n, NUM_ELEMENTS) != HARIS_SUCCESS ||
+      New_init_points(n, NUM_ELEMENTS) != HARIS_SUCCESS ||
+      New_init_where(n) != HARIS_SUCCESS ||
+      New_init_next(n) != HARIS_SUCCESS ||
+      New_init_name(New_get_next(n), 0) != HARIS_SUCCESS ||
+      New_init_big(New_get_next(n), 1) != HARIS_SUCCESS ||
+      New_init_points(New_get_next(n), 0) != HARIS_SUCCESS) {
+    New_destroy(n);
+    return NULL;
+  }
+  memcpy(New_get_name(n), "fresh", 5);
+  for (i = 0; i < NUM_ELEMENTS; i ++) {
+    New_get_big(n)[i] = (haris_uint64_t)i << 40;
+    New_get_points(n)[i].x = (haris_int32_t)i;
+    New_get_points(n)[i].y = -(haris_int32_t)i;
+  }
+  return n;
+}
+
+static int check_old(Old *o, haris_uint32_t id)
+{
+  HTEST_ASSERT(o->id == id);
+  HTEST_ASSERT(Old_len_name(o) == 5);
+  HTEST_ASSERT(memcmp(Old_get_name(o), "fresh", 5) == 0);
+  return 1;
+}
+
+/* Writes two New messages and then a short Old one, so that the reader
+   has to land exactly on the start of each message */
+static int write_messages(FILE *f)
+{
+  New *n = make_new(1);
+  Old *o = Old_create();
+  HTEST_ASSERT(n && o);
+  HTEST_ASSERT(Old_init_name(o, 5) == HARIS_SUCCESS);
+  memcpy(Old_get_name(o), "fresh", 5);
+  o->id = 3;
+  HTEST_ASSERT(New_to_file(n, f, NULL) == HARIS_SUCCESS);
+  n->id = 2;
+  HTEST_ASSERT(New_to_file(n, f, NULL) == HARIS_SUCCESS);
+  HTEST_ASSERT(Old_to_file(o, f, NULL) == HARIS_SUCCESS);
+  HTEST_ASSERT(fflush(f) == 0);
+  rewind(f);
+  New_destroy(n);
+  Old_destroy(o);
+  return 1;
+}
+
+static int buffer_test(void)
+{
+  unsigned char *buffer, *out_addr;
+  haris_uint32_t sz;
+  New *n = make_new(1);
+  Old *o = Old_create();
+  HTEST_ASSERT(n && o);
+  HTEST_ASSERT(New_to_buffer_a(n, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(Old_from_buffer(o, buffer, sz, &out_addr) == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == (ptrdiff_t)sz);
+  HTEST_ASSERT(check_old(o, 1));
+  /* Running out of input in the middle of a skipped list is still an 
+     error */
+  HTEST_ASSERT(Old_from_buffer(o, buffer, sz - 100, &out_addr) 
+               == HARIS_INPUT_ERROR);
+  free(buffer);
+  New_destroy(n);
+  Old_destroy(o);
+  return 1;
+}
+
+static int file_test(void)
+{
+  haris_uint32_t sz, total;
+  FILE *f = tmpfile();
+  Old *o = Old_create();
+  HTEST_ASSERT(f && o && write_messages(f));
+  HTEST_ASSERT(Old_from_file(o, f, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(check_old(o, 1));
+  total = sz;
+  HTEST_ASSERT(Old_from_file(o, f, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(check_old(o, 2));
+  total += sz;
+  HTEST_ASSERT(ftell(f) == (long)total);
+  HTEST_ASSERT(Old_from_file(o, f, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(check_old(o, 3));
+  HTEST_ASSERT(Old_from_file(o, f, &sz) == HARIS_INPUT_ERROR);
+  fclose(f);
+  Old_destroy(o);
+  return 1;
+}
+
+/* A projected decode of the new message skips the big lists, and never
+   allocates memory for them */
+static int projected_test(void)
+{
+  unsigned char *buffer, *out_addr;
+  haris_uint32_t sz;
+  New *in = make_new(1), *out = New_create();
+  HTEST_ASSERT(in && out);
+  HTEST_ASSERT(New_to_buffer_a(in, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(New_from_buffer_projected(out, New_FIELD_name | New_FIELD_next,
+                                         buffer, sz, &out_addr)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == (ptrdiff_t)sz);
+  HTEST_ASSERT(out->id == 1 && New_len_name(out) == 5);
+  HTEST_ASSERT(!out->_big_info.has && !out->_big_info.ptr);
+  HTEST_ASSERT(!out->_points_info.has && !out->_points_info.ptr);
+  HTEST_ASSERT(!New_has_where(out));
+  /* Nested structures are decoded in full */
+  HTEST_ASSERT(New_has_next(out) && New_len_big(New_get_next(out)) == 1);
+  /* Projecting nothing still checks the whole message */
+  HTEST_ASSERT(New_from_buffer_projected(out, 0, buffer, sz - 1, &out_addr)
+               == HARIS_INPUT_ERROR);
+  free(buffer);
+  New_destroy(in);
+  New_destroy(out);
+  return 1;
+}
+
+/* A seek that goes past the end of the file doesn't count as a skip */
+static int truncated_file_test(void)
+{
+  FILE *f = tmpfile(), *g = tmpfile();
+  Old *o = Old_create();
+  int c;
+  long i;
+  HTEST_ASSERT(f && g && o && write_messages(f));
+  for (i = 0; i < 2 + 4 + 4 + 5 + 4 + 8 * NUM_ELEMENTS - 1; i ++) {
+    HTEST_ASSERT((c = getc(f)) != EOF);
+    HTEST_ASSERT(putc(c, g) != EOF);
+  }
+  rewind(g);
+  HTEST_ASSERT(Old_from_file(o, g, NULL) == HARIS_INPUT_ERROR);
+  fclose(f);
+  fclose(g);
+  Old_destroy(o);
+  return 1;
+}
+
+/* The same messages are read from a regular file, which can seek, and
+   from a pipe, which has to be drained */
+static int fd_test(void)
+{
+  haris_uint32_t sz;
+  int fds[2];
+  unsigned char *buffer;
+  FILE *f = tmpfile();
+  New *n = make_new(1);
+  Old *o = Old_create();
+  HTEST_ASSERT(f && n && o && write_messages(f));
+  HTEST_ASSERT(Old_from_fd(o, fileno(f), &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(check_old(o, 1));
+  HTEST_ASSERT(lseek(fileno(f), 0, SEEK_CUR) == (off_t)sz);
+  haris_fd_session_init(&session, fileno(f));
+  HTEST_ASSERT(Old_from_fd_session(o, &session, NULL) == HARIS_SUCCESS);
+  HTEST_ASSERT(check_old(o, 2));
+  HTEST_ASSERT(Old_from_fd_session(o, &session, NULL) == HARIS_SUCCESS);
+  HTEST_ASSERT(check_old(o, 3));
+  HTEST_ASSERT(Old_from_fd_session(o, &session, NULL) == HARIS_INPUT_ERROR);
+  HTEST_ASSERT(New_to_buffer_a(n, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(pipe(fds) == 0);
+  HTEST_ASSERT(write(fds[1], buffer, sz) == (ssize_t)sz);
+  HTEST_ASSERT(write(fds[1], buffer, sz) == (ssize_t)sz);
+  close(fds[1]);
+  HTEST_ASSERT(Old_from_fd(o, fds[0], NULL) == HARIS_SUCCESS);
+  HTEST_ASSERT(check_old(o, 1));
+  haris_fd_session_init(&session, fds[0]);
+  HTEST_ASSERT(Old_from_fd_session(o, &session, NULL) == HARIS_SUCCESS);
+  HTEST_ASSERT(check_old(o, 1));
+  HTEST_ASSERT(Old_from_fd_session(o, &session, NULL) == HARIS_INPUT_ERROR);
+  close(fds[0]);
+  free(buffer);
+  fclose(f);
+  New_destroy(n);
+  Old_destroy(o);
+  return 1;
+}
+
+/* A chain of `next`s exactly as deep as the limit allows is encoded,
+   decoded and skipped over; one more is too deep */
+static int nesting_test(void)
+{
+  unsigned char *buffer, *again, *out_addr;
+  haris_uint32_t sz, again_sz, i;
+  New *n = New_create(), *curr = n, *out = New_create();
+  Old *o = Old_create();
+  HTEST_ASSERT(n && out && o);
+  for (i = 0; i <= HARIS_DEPTH_LIMIT; i ++) {
+    curr->id = i;
+    HTEST_ASSERT(New_init_name(curr, 5) == HARIS_SUCCESS);
+    memcpy(New_get_name(curr), "fresh", 5);
+    HTEST_ASSERT(New_init_big(curr, 1) == HARIS_SUCCESS);
+    New_get_big(curr)[0] = i;
+    /* The last New's own children would be deeper still */
+    if (i == HARIS_DEPTH_LIMIT) {
+      HTEST_ASSERT(New_init_points(curr, 0) == HARIS_SUCCESS);
+      New_clear_where(curr);
+      New_clear_next(curr);
+    } else {
+      HTEST_ASSERT(New_init_points(curr, 2) == HARIS_SUCCESS);
+      HTEST_ASSERT(New_init_where(curr) == HARIS_SUCCESS);
+      HTEST_ASSERT(New_init_next(curr) == HARIS_SUCCESS);
+      curr = New_get_next(curr);
+    }
+  }
+  HTEST_ASSERT(New_to_buffer_a(n, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(Old_from_buffer(o, buffer, sz, &out_addr) == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == (ptrdiff_t)sz);
+  HTEST_ASSERT(check_old(o, 0));
+  HTEST_ASSERT(New_from_buffer(out, buffer, sz, &out_addr) == HARIS_SUCCESS);
+  HTEST_ASSERT(New_to_buffer_a(out, &again, &again_sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(again_sz == sz && buffer_equal(buffer, again, sz));
+  HTEST_ASSERT(New_init_where(curr) == HARIS_SUCCESS);
+  HTEST_ASSERT(New_to_buffer_a(n, &again, &again_sz) == HARIS_DEPTH_ERROR);
+  free(buffer);
+  free(again);
+  New_destroy(n);
+  New_destroy(out);
+  Old_destroy(o);
+  return 1;
+}
+
+static HarisStatus next_point(void *ctx, Point *p)
+{
+  haris_uint32_t *i = (haris_uint32_t*)ctx;
+  p->x = (haris_int32_t)*i;
+  p->y = -(haris_int32_t)*i;
+  (*i) ++;
+  return HARIS_SUCCESS;
+}
+
+/* The children on both sides of a produced list are written as usual */
+static int producing_test(void)
+{
+  haris_uint32_t sz, produced_sz, produced = 0;
+  long len;
+  unsigned char *expected, *contents;
+  FILE *f = tmpfile();
+  New *n = make_new(1);
+  HTEST_ASSERT(f && n);
+  HTEST_ASSERT(New_to_buffer_a(n, &expected, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(New_init_points(n, 0) == HARIS_SUCCESS);
+  HTEST_ASSERT(New_to_file_producing_points(n, NUM_ELEMENTS, next_point,
+                                            &produced, f, &produced_sz)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(produced == NUM_ELEMENTS && produced_sz == sz);
+  HTEST_ASSERT((len = ftell(f)) >= 0 && (haris_uint32_t)len == sz);
+  contents = (unsigned char*)malloc(sz);
+  HTEST_ASSERT(contents);
+  rewind(f);
+  HTEST_ASSERT(fread(contents, 1, sz, f) == sz);
+  HTEST_ASSERT(memcmp(contents, expected, sz) == 0);
+  free(contents);
+  free(expected);
+  fclose(f);
+  New_destroy(n);
+  return 1;
+}
+
+static int all_tests(void)
+{
+  HTEST_RUN(buffer_test);
+  HTEST_RUN(projected_test);
+  HTEST_RUN(file_test);
+  HTEST_RUN(truncated_file_test);
+  HTEST_RUN(fd_test);
+  HTEST_RUN(nesting_test);
+  HTEST_RUN(producing_test);
+  return 1;
+}
+
+int main(void)
+{
+  if (!all_tests()) return -1;
+  else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
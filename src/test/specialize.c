@@ -0,0 +1,360 @@
+#include "htest.h"
+#include "specialize.haris.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+/* The encoding of the structure built by fill_everything() */
+static unsigned char everything_buffer[54] = {
+  0x47, 0x3, 0x12, 0xFE, 0x2,                       /* header, body */
+  0x80, 0x2, 0, 0, 'h', 'i',                        /* name */
+  0x81, 0x2, 0, 0, 0x1, 0, 0xFF, 0xFF,              /* shorts */
+  0xC0, 0x1, 0, 0, 0x40, 0x8, 1, 0, 0, 0, 2, 0, 0, 0, /* points */
+  0x40, 0x8, 3, 0, 0, 0, 4, 0, 0, 0,                /* origin */
+  0,                                                /* maybe */
+  0x41, 0x2, 0x5, 0, 0x41, 0x2, 0x6, 0, 0,          /* chain */
+  0                                                 /* nothing */
+};
+
+static int fill_everything(Everything *e)
+{
+  Node *next;
+  e->u8 = 0x12;
+  e->i8 = -2;
+  e->c = Color_BLUE;
+  HTEST_ASSERT(Everything_init_name(e, 2) == HARIS_SUCCESS);
+  memcpy(Everything_get_name(e), "hi", 2);
+  HTEST_ASSERT(Everything_init_shorts(e, 2) == HARIS_SUCCESS);
+  Everything_get_shorts(e)[0] = 1;
+  Everything_get_shorts(e)[1] = -1;
+  HTEST_ASSERT(Everything_init_points(e, 1) == HARIS_SUCCESS);
+  Everything_get_points(e)[0].x = 1;
+  Everything_get_points(e)[0].y = 2;
+  HTEST_ASSERT(Everything_init_origin(e) == HARIS_SUCCESS);
+  Everything_get_origin(e)->x = 3;
+  Everything_get_origin(e)->y = 4;
+  Everything_clear_maybe(e);
+  HTEST_ASSERT(Everything_init_chain(e) == HARIS_SUCCESS);
+  Everything_get_chain(e)->id = 5;
+  HTEST_ASSERT(Node_init_next(Everything_get_chain(e)) == HARIS_SUCCESS);
+  next = Node_get_next(Everything_get_chain(e));
+  next->id = 6;
+  Node_clear_next(next);
+  Everything_clear_nothing(e);
+  return 1;
+}
+
+static int check_everything(Everything *e)
+{
+  Node *chain;
+  HTEST_ASSERT(e->u8 == 0x12 && e->i8 == -2 && e->c == Color_BLUE);
+  HTEST_ASSERT(Everything_len_name(e) == 2);
+  HTEST_ASSERT(memcmp(Everything_get_name(e), "hi", 2) == 0);
+  HTEST_ASSERT(Everything_len_shorts(e) == 2);
+  HTEST_ASSERT(Everything_get_shorts(e)[0] == 1);
+  HTEST_ASSERT(Everything_get_shorts(e)[1] == -1);
+  HTEST_ASSERT(Everything_len_points(e) == 1);
+  HTEST_ASSERT(Everything_get_points(e)[0].x == 1);
+  HTEST_ASSERT(Everything_get_points(e)[0].y == 2);
+  HTEST_ASSERT(Everything_get_origin(e)->x == 3);
+  HTEST_ASSERT(Everything_get_origin(e)->y == 4);
+  HTEST_ASSERT(!Everything_has_maybe(e));
+  HTEST_ASSERT(Everything_has_chain(e));
+  chain = Everything_get_chain(e);
+  HTEST_ASSERT(chain->id == 5 && Node_has_next(chain));
+  HTEST_ASSERT(Node_get_next(chain)->id == 6);
+  HTEST_ASSERT(!Node_has_next(Node_get_next(chain)));
+  HTEST_ASSERT(!Everything_has_nothing(e));
+  return 1;
+}
+
+static int encoding_test_1(void)
+{
+  unsigned char buffer[sizeof everything_buffer], *out_addr;
+  Everything *e = Everything_create();
+  HTEST_ASSERT(e);
+  HTEST_ASSERT(fill_everything(e));
+  HTEST_ASSERT(Everything_to_buffer(e, buffer, sizeof buffer, &out_addr)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == sizeof everything_buffer);
+  HTEST_ASSERT(buffer_equal(buffer, everything_buffer, 
+                            sizeof everything_buffer));
+  Everything_destroy(e);
+  return 1;
+}
+
+static int encoding_test_2(void)
+{
+  unsigned char *buffer;
+  haris_uint32_t sz;
+  Everything *e = Everything_create();
+  HTEST_ASSERT(e);
+  HTEST_ASSERT(fill_everything(e));
+  HTEST_ASSERT(Everything_to_buffer_a(e, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == sizeof everything_buffer);
+  HTEST_ASSERT(buffer_equal(buffer, everything_buffer, sz));
+  free(buffer);
+  Everything_destroy(e);
+  return 1;
+}
+
+static int encoding_test_3(void)
+{
+  /* A missing non-nullable child is rejected before anything is written */
+  unsigned char buffer[sizeof everything_buffer], *out_addr;
+  Everything *e = Everything_create();
+  HTEST_ASSERT(e);
+  HTEST_ASSERT(fill_everything(e));
+  e->_name_info.has = 0;
+  HTEST_ASSERT(Everything_to_buffer(e, buffer, sizeof buffer, &out_addr)
+               == HARIS_STRUCTURE_ERROR);
+  Everything_destroy(e);
+  return 1;
+}
+
+static int encoding_test_4(void)
+{
+  /* S_to_buffer_a validates the structure as it encodes it */
+  unsigned char *buffer;
+  haris_uint32_t sz;
+  Everything *e = Everything_create();
+  HTEST_ASSERT(e);
+  HTEST_ASSERT(fill_everything(e));
+  e->_origin_has = 0;
+  HTEST_ASSERT(Everything_to_buffer_a(e, &buffer, &sz) 
+               == HARIS_STRUCTURE_ERROR);
+  Everything_destroy(e);
+  return 1;
+}
+
+static int encoding_test_5(void)
+{
+  /* Chains longer than HARIS_DEPTH_LIMIT can't be encoded */
+  unsigned char *buffer;
+  haris_uint32_t sz;
+  int i;
+  Node *head = Node_create(), *node = head;
+  HTEST_ASSERT(head);
+  for (i = 0; i <= HARIS_DEPTH_LIMIT; i ++) {
+    HTEST_ASSERT(Node_init_next(node) == HARIS_SUCCESS);
+    node = Node_get_next(node);
+  }
+  HTEST_ASSERT(Node_to_buffer_a(head, &buffer, &sz) == HARIS_DEPTH_ERROR);
+  Node_destroy(head);
+  return 1;
+}
+
+static int encoding_test_6(void)
+{
+  /* A long structure list grows the output buffer many times over */
+  unsigned char *buffer, *fixed, *out_addr;
+  haris_uint32_t sz, i;
+  Everything *e = Everything_create(), *out = Everything_create();
+  HTEST_ASSERT(e && out);
+  HTEST_ASSERT(fill_everything(e));
+  HTEST_ASSERT(Everything_init_points(e, 50000) == HARIS_SUCCESS);
+  for (i = 0; i < 50000; i ++) {
+    Everything_get_points(e)[i].x = (haris_int32_t)i;
+    Everything_get_points(e)[i].y = -(haris_int32_t)i;
+  }
+  HTEST_ASSERT(Everything_to_buffer_a(e, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(sz == sizeof everything_buffer + 49999 * 8);
+  fixed = (unsigned char *)malloc(sz);
+  HTEST_ASSERT(fixed);
+  HTEST_ASSERT(Everything_to_buffer(e, fixed, sz, &out_addr) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(buffer_equal(buffer, fixed, sz));
+  HTEST_ASSERT(Everything_from_buffer(out, buffer, sz, &out_addr)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out->_points_info.len == 50000);
+  HTEST_ASSERT(Everything_get_points(out)[49999].y == -49999);
+  free(buffer);
+  free(fixed);
+  Everything_destroy(e);
+  Everything_destroy(out);
+  return 1;
+}
+
+static int encoding_test_7(void)
+{
+  /* Bounded structures can be encoded into a stack buffer of exactly
+     S_MAX_ENCODED_SIZE bytes */
+  unsigned char buffer[Segment_MAX_ENCODED_SIZE], *out_addr,
+    test_buffer[13] = { 0x42, 0, 0x40, 0x8, 1, 0, 0, 0, 0xFF, 0xFF, 0xFF, 
+                        0xFF, 0 };
+  Segment *s = Segment_create();
+  HTEST_ASSERT(Point_MAX_ENCODED_SIZE == 10);
+  HTEST_ASSERT(Segment_MAX_ENCODED_SIZE == 22);
+  HTEST_ASSERT(s);
+  HTEST_ASSERT(Segment_init_a(s) == HARIS_SUCCESS);
+  Segment_get_a(s)->x = 1;
+  Segment_get_a(s)->y = -1;
+  HTEST_ASSERT(Segment_to_buffer_fixed(s, buffer, &out_addr) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == 13);
+  HTEST_ASSERT(buffer_equal(buffer, test_buffer, 13));
+  HTEST_ASSERT(Segment_init_b(s) == HARIS_SUCCESS);
+  HTEST_ASSERT(Segment_to_buffer_fixed(s, buffer, &out_addr) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == Segment_MAX_ENCODED_SIZE);
+  s->_a_has = 0;
+  HTEST_ASSERT(Segment_to_buffer_fixed(s, buffer, &out_addr) 
+               == HARIS_STRUCTURE_ERROR);
+  Segment_destroy(s);
+  return 1;
+}
+
+static int decoding_test_1(void)
+{
+  unsigned char *out_addr;
+  Everything *e = Everything_create();
+  HTEST_ASSERT(e);
+  HTEST_ASSERT(Everything_from_buffer(e, everything_buffer, 
+                                      sizeof everything_buffer, &out_addr)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - everything_buffer == sizeof everything_buffer);
+  HTEST_ASSERT(check_everything(e));
+  Everything_destroy(e);
+  return 1;
+}
+
+static int decoding_test_2(void)
+{
+  /* A Point with a larger body and an extra child, as a newer version of
+     the schema might produce */
+  unsigned char buffer[16] = { 0x41, 0x9, 0xFF, 0xFF, 0xFF, 0xFF, 
+                               0x2, 0, 0, 0, 0xAB, 0x80, 0x1, 0, 0, 0x7 },
+    *out_addr;
+  Point *p = Point_create();
+  HTEST_ASSERT(p);
+  HTEST_ASSERT(Point_from_buffer(p, buffer, sizeof buffer, &out_addr)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - buffer == 16);
+  HTEST_ASSERT(p->x == -1 && p->y == 2);
+  Point_destroy(p);
+  return 1;
+}
+
+static int decoding_test_3(void)
+{
+  /* origin is not nullable */
+  unsigned char buffer[sizeof everything_buffer], *out_addr;
+  Everything *e = Everything_create();
+  HTEST_ASSERT(e);
+  memcpy(buffer, everything_buffer, sizeof buffer);
+  buffer[33] = 0;
+  HTEST_ASSERT(Everything_from_buffer(e, buffer, sizeof buffer, &out_addr)
+               == HARIS_STRUCTURE_ERROR);
+  Everything_destroy(e);
+  return 1;
+}
+
+static int decoding_test_4(void)
+{
+  /* Truncated messages are rejected */
+  unsigned char *out_addr;
+  Everything *e = Everything_create();
+  HTEST_ASSERT(e);
+  HTEST_ASSERT(Everything_from_buffer(e, everything_buffer, 
+                                      sizeof everything_buffer - 1, &out_addr)
+               == HARIS_INPUT_ERROR);
+  Everything_destroy(e);
+  return 1;
+}
+
+static int decoding_test_5(void)
+{
+  /* Decoding into a structure that already has longer lists reuses 
+     their memory */
+  unsigned char *out_addr;
+  Point *points;
+  haris_int16_t *shorts;
+  Everything *e = Everything_create();
+  HTEST_ASSERT(e);
+  HTEST_ASSERT(Everything_init_shorts(e, 10) == HARIS_SUCCESS);
+  HTEST_ASSERT(Everything_init_points(e, 10) == HARIS_SUCCESS);
+  shorts = Everything_get_shorts(e);
+  points = Everything_get_points(e);
+  HTEST_ASSERT(Everything_from_buffer(e, everything_buffer, 
+                                      sizeof everything_buffer, &out_addr)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(check_everything(e));
+  HTEST_ASSERT(Everything_get_shorts(e) == shorts);
+  HTEST_ASSERT(Everything_get_points(e) == points);
+  Everything_destroy(e);
+  return 1;
+}
+
+static int decoding_test_6(void)
+{
+  /* Everything decoded into an arena, down to the Nodes in the chain, 
+     comes out of the arena's memory */
+  unsigned char *out_addr, memory[1024];
+  Everything *e;
+  HarisArena arena;
+  haris_arena_init(&arena, memory, sizeof memory);
+  HTEST_ASSERT(Everything_from_buffer_arena(&arena, &e, everything_buffer, 
+                                            sizeof everything_buffer, 
+                                            &out_addr) == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - everything_buffer == sizeof everything_buffer);
+  HTEST_ASSERT(check_everything(e));
+  HTEST_ASSERT((unsigned char*)e >= memory &&
+               (unsigned char*)Node_get_next(Everything_get_chain(e)) <
+               memory + arena.used);
+  haris_arena_reset(&arena);
+  HTEST_ASSERT(arena.used == 0);
+  return 1;
+}
+
+static int decoding_test_7(void)
+{
+  /* A projected decode falls back on the general decoder, and leaves out
+     everything that wasn't asked for */
+  unsigned char *out_addr;
+  Everything *e = Everything_create();
+  HTEST_ASSERT(e);
+  HTEST_ASSERT(Everything_from_buffer_projected(e, Everything_FIELD_name |
+                                                Everything_FIELD_origin |
+                                                Everything_FIELD_chain,
+                                                everything_buffer,
+                                                sizeof everything_buffer,
+                                                &out_addr) == HARIS_SUCCESS);
+  HTEST_ASSERT(out_addr - everything_buffer == sizeof everything_buffer);
+  HTEST_ASSERT(e->u8 == 0x12 && e->c == Color_BLUE);
+  HTEST_ASSERT(Everything_len_name(e) == 2);
+  HTEST_ASSERT(memcmp(Everything_get_name(e), "hi", 2) == 0);
+  HTEST_ASSERT(!e->_shorts_info.has && !e->_shorts_info.ptr);
+  HTEST_ASSERT(!e->_points_info.has && !e->_points_info.ptr);
+  HTEST_ASSERT(Everything_get_origin(e)->y == 4);
+  HTEST_ASSERT(Node_has_next(Everything_get_chain(e)));
+  Everything_destroy(e);
+  return 1;
+}
+
+static int (* const test_functions[])(void) = {
+  encoding_test_1, encoding_test_2, encoding_test_3, encoding_test_4,
+  encoding_test_5, encoding_test_6, encoding_test_7,
+  decoding_test_1, decoding_test_2, decoding_test_3, decoding_test_4,
+  decoding_test_5, decoding_test_6, decoding_test_7
+};
+
+static int all_tests(void)
+{
+  unsigned i;
+  for (i = 0; 
+       i < sizeof test_functions / sizeof test_functions[0];
+       i++)
+    HTEST_RUN(test_functions[i]);
+  return 1;
+}
+
+int main(void)
+{
+  if (!all_tests()) return -1;
+  else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
@@ -0,0 +1,278 @@
+#define _POSIX_C_SOURCE 200112L
+#include "htest.h"
+#include "stream.haris.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#define NUM_ORDERS 60
+#define BUFFER_SIZE 32768
+
+static HarisFdSession session;
+
+/* Order 0 has the longest lists of any order, so once it has been decoded
+   none of the others should need any more memory */
+static haris_uint32_t num_legs(haris_uint32_t id)
+{
+  return id == 0 ? 5 : id % 5;
+}
+
+static haris_uint32_t num_fills(haris_uint32_t id, haris_uint32_t leg)
+{
+  return id == 0 ? 7 : (id + leg) % 7;
+}
+
+static int fill_leg(Leg *leg, haris_uint32_t id, haris_uint32_t n)
+{
+  haris_uint32_t i, fills = num_fills(id, n);
+  leg->qty = id * 100 + n;
+  HTEST_ASSERT(Leg_init_venue(leg, 4) == HARIS_SUCCESS);
+  memcpy(Leg_get_venue(leg), id % 2 ? "XNAS" : "ARCX", 4);
+  HTEST_ASSERT(Leg_init_fills(leg, fills) == HARIS_SUCCESS);
+  for (i = 0; i < fills; i ++)
+    Leg_get_fills(leg)[i] = (haris_int32_t)(id * n - i);
+  return 1;
+}
+
+static int check_leg(Leg *leg, haris_uint32_t id, haris_uint32_t n)
+{
+  haris_uint32_t i, fills = num_fills(id, n);
+  HTEST_ASSERT(leg->qty == id * 100 + n);
+  HTEST_ASSERT(Leg_len_venue(leg) == 4);
+  HTEST_ASSERT(memcmp(Leg_get_venue(leg), id % 2 ? "XNAS" : "ARCX", 4) == 0);
+  HTEST_ASSERT(Leg_len_fills(leg) == fills);
+  for (i = 0; i < fills; i ++)
+    HTEST_ASSERT(Leg_get_fills(leg)[i] == (haris_int32_t)(id * n - i));
+  return 1;
+}
+
+static int fill_order(Order *o, haris_uint32_t id)
+{
+  haris_uint32_t i;
+  o->id = id;
+  HTEST_ASSERT(Order_init_legs(o, num_legs(id)) == HARIS_SUCCESS);
+  for (i = 0; i < num_legs(id); i ++)
+    HTEST_ASSERT(fill_leg(&Order_get_legs(o)[i], id, i));
+  if (id % 3 == 0) {
+    HTEST_ASSERT(Order_init_hedge(o) == HARIS_SUCCESS);
+    HTEST_ASSERT(fill_leg(Order_get_hedge(o), id, 10));
+  } else {
+    Order_clear_hedge(o);
+  }
+  HTEST_ASSERT(Order_init_main(o) == HARIS_SUCCESS);
+  HTEST_ASSERT(fill_leg(Order_get_main(o), id, 20));
+  return 1;
+}
+
+static int check_order(Order *o, haris_uint32_t id)
+{
+  haris_uint32_t i;
+  HTEST_ASSERT(o->id == id);
+  HTEST_ASSERT(Order_len_legs(o) == num_legs(id));
+  for (i = 0; i < num_legs(id); i ++)
+    HTEST_ASSERT(check_leg(&Order_get_legs(o)[i], id, i));
+  if (id % 3 == 0) {
+    HTEST_ASSERT(Order_has_hedge(o));
+    HTEST_ASSERT(check_leg(Order_get_hedge(o), id, 10));
+  } else {
+    HTEST_ASSERT(!Order_has_hedge(o));
+  }
+  HTEST_ASSERT(check_leg(Order_get_main(o), id, 20));
+  return 1;
+}
+
+/* Records every pointer that the decoder could have had to allocate */
+static void snapshot(Order *o, void **ptrs)
+{
+  haris_uint32_t i;
+  Leg *legs = (Leg*)o->_legs_info.ptr;
+  ptrs[0] = o->_legs_info.ptr;
+  ptrs[1] = Order_get_hedge(o)->_fills_info.ptr;
+  ptrs[2] = Order_get_main(o)->_fills_info.ptr;
+  for (i = 0; i < num_legs(0); i ++)
+    ptrs[3 + i] = legs[i]._fills_info.ptr;
+}
+
+static int decode_all(HarisMessageStream *stream)
+{
+  haris_uint32_t i, sz;
+  void *before[8], *after[8];
+  Order *o = Order_create();
+  HTEST_ASSERT(o);
+  for (i = 0; !haris_stream_at_end(stream); i ++) {
+    HTEST_ASSERT(i < NUM_ORDERS);
+    HTEST_ASSERT(Order_stream_next(stream, o, &sz) == HARIS_SUCCESS);
+    HTEST_ASSERT(check_order(o, i));
+    if (i == 0) {
+      snapshot(o, before);
+    } else {
+      snapshot(o, after);
+      HTEST_ASSERT(memcmp(before, after, sizeof before) == 0);
+    }
+  }
+  HTEST_ASSERT(i == NUM_ORDERS);
+  /* Asking again doesn't change the answer */
+  HTEST_ASSERT(haris_stream_at_end(stream));
+  HTEST_ASSERT(Order_stream_next(stream, o, &sz) == HARIS_INPUT_ERROR);
+  Order_destroy(o);
+  return 1;
+}
+
+static int buffer_stream_test(void)
+{
+  haris_uint32_t i;
+  unsigned char *buf = (unsigned char *)malloc(BUFFER_SIZE), *curr;
+  Order *o = Order_create();
+  HarisBufferStream buffer_stream;
+  HarisMessageStream stream;
+  HTEST_ASSERT(buf && o);
+  for (i = 0, curr = buf; i < NUM_ORDERS; i ++) {
+    HTEST_ASSERT(fill_order(o, i));
+    HTEST_ASSERT(Order_to_buffer(o, curr, 
+                                 (haris_uint32_t)(BUFFER_SIZE - (curr - buf)),
+                                 &curr) == HARIS_SUCCESS);
+  }
+  haris_stream_open_buffer(&stream, &buffer_stream, buf, 
+                           (haris_uint32_t)(curr - buf));
+  HTEST_ASSERT(decode_all(&stream));
+  HTEST_ASSERT(buffer_stream.buffer == curr && buffer_stream.curr == 0);
+  /* A message that's cut short isn't the end of the stream */
+  haris_stream_open_buffer(&stream, &buffer_stream, buf, 10);
+  HTEST_ASSERT(!haris_stream_at_end(&stream));
+  HTEST_ASSERT(Order_stream_next(&stream, o, NULL) == HARIS_INPUT_ERROR);
+  free(buf);
+  Order_destroy(o);
+  return 1;
+}
+
+static int file_stream_test(void)
+{
+  haris_uint32_t i;
+  unsigned char buffer[512];
+  FILE *f = tmpfile();
+  Order *o = Order_create();
+  HarisFileStream file_stream;
+  HarisMessageStream stream;
+  HTEST_ASSERT(f && o);
+  for (i = 0; i < NUM_ORDERS; i ++) {
+    HTEST_ASSERT(fill_order(o, i));
+    HTEST_ASSERT(Order_to_file(o, f, NULL) == HARIS_SUCCESS);
+  }
+  rewind(f);
+  haris_file_stream_init(&file_stream, f, buffer, sizeof buffer);
+  haris_stream_open_file(&stream, &file_stream);
+  HTEST_ASSERT(decode_all(&stream));
+  fclose(f);
+  Order_destroy(o);
+  return 1;
+}
+
+static int fd_stream_test(void)
+{
+  haris_uint32_t i;
+  FILE *f = tmpfile();
+  Order *o = Order_create();
+  HarisMessageStream stream;
+  HTEST_ASSERT(f && o);
+  for (i = 0; i < NUM_ORDERS; i ++) {
+    HTEST_ASSERT(fill_order(o, i));
+    HTEST_ASSERT(Order_to_fd(o, fileno(f), NULL) == HARIS_SUCCESS);
+  }
+  HTEST_ASSERT(lseek(fileno(f), 0, SEEK_SET) == 0);
+  haris_fd_session_init(&session, fileno(f));
+  haris_stream_open_fd(&stream, &session);
+  HTEST_ASSERT(decode_all(&stream));
+  HTEST_ASSERT(session.eof);
+  fclose(f);
+  Order_destroy(o);
+  return 1;
+}
+
+static int in_arena(HarisArena *arena, void *ptr)
+{
+  return (unsigned char*)ptr >= arena->buffer &&
+         (unsigned char*)ptr < arena->buffer + arena->used;
+}
+
+static int arena_test(void)
+{
+  haris_uint32_t i, sz;
+  unsigned char *buf = (unsigned char *)malloc(BUFFER_SIZE), *curr, *next;
+  void *memory = malloc(4096);
+  Order *o = Order_create(), *decoded;
+  HarisArena arena;
+  HTEST_ASSERT(buf && memory && o);
+  for (i = 0, curr = buf; i < NUM_ORDERS; i ++) {
+    HTEST_ASSERT(fill_order(o, i));
+    HTEST_ASSERT(Order_to_buffer(o, curr, 
+                                 (haris_uint32_t)(BUFFER_SIZE - (curr - buf)),
+                                 &curr) == HARIS_SUCCESS);
+  }
+  sz = (haris_uint32_t)(curr - buf);
+  haris_arena_init(&arena, memory, 4096);
+  for (i = 0, curr = buf; i < NUM_ORDERS; i ++, curr = next) {
+    haris_arena_reset(&arena);
+    HTEST_ASSERT(Order_from_buffer_arena(&arena, &decoded, curr, 
+                                         sz - (haris_uint32_t)(curr - buf), 
+                                         &next) == HARIS_SUCCESS);
+    HTEST_ASSERT(check_order(decoded, i));
+    HTEST_ASSERT(in_arena(&arena, decoded));
+    if (num_legs(i) > 0) {
+      HTEST_ASSERT(in_arena(&arena, Order_get_legs(decoded)));
+      HTEST_ASSERT(in_arena(&arena, 
+                            Leg_get_venue(&Order_get_legs(decoded)[0])));
+    }
+    HTEST_ASSERT(in_arena(&arena, Leg_get_venue(Order_get_main(decoded))));
+  }
+  /* An arena that runs out of room is left as it was */
+  haris_arena_init(&arena, memory, 200);
+  HTEST_ASSERT(Order_from_buffer_arena(&arena, &decoded, buf, sz, &next)
+               == HARIS_MEM_ERROR);
+  HTEST_ASSERT(arena.used == 0);
+  free(memory);
+  free(buf);
+  Order_destroy(o);
+  return 1;
+}
+
+/* Shrinking a list of structures with _init_ has to free whatever the
+   elements that are cut off were holding on to */
+static int shrink_test(void)
+{
+  haris_uint32_t i;
+  Order *o = Order_create();
+  HTEST_ASSERT(o);
+  HTEST_ASSERT(fill_order(o, 0));
+  HTEST_ASSERT(Order_init_legs(o, 1) == HARIS_SUCCESS);
+  HTEST_ASSERT(o->_legs_info.alloc == 1);
+  HTEST_ASSERT(check_leg(&Order_get_legs(o)[0], 0, 0));
+  HTEST_ASSERT(Order_init_legs(o, 3) == HARIS_SUCCESS);
+  for (i = 1; i < 3; i ++)
+    HTEST_ASSERT(Leg_len_fills(&Order_get_legs(o)[i]) == 0 &&
+                 Order_get_legs(o)[i]._fills_info.ptr == NULL);
+  HTEST_ASSERT(check_leg(&Order_get_legs(o)[0], 0, 0));
+  Order_destroy(o);
+  return 1;
+}
+
+static int all_tests(void)
+{
+  HTEST_RUN(buffer_stream_test);
+  HTEST_RUN(file_stream_test);
+  HTEST_RUN(fd_stream_test);
+  HTEST_RUN(arena_test);
+  HTEST_RUN(shrink_test);
+  return 1;
+}
+
+int main(void)
+{
+  if (!all_tests()) return -1;
+  else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
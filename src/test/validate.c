@@ -0,0 +1,387 @@
+#include "htest.h"
+#include "shapes.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+static int valid_test(void)
+{
+  unsigned char *buffer, *bigger;
+  haris_uint32_t sz, consumed;
+  Shape *s = Shape_create();
+  HTEST_ASSERT(s && fill_shape(s, 2));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_validate_buffer(buffer, sz, &consumed) == HARIS_SUCCESS);
+  HTEST_ASSERT(consumed == sz);
+  /* Whatever follows the message isn't part of it */
+  bigger = (unsigned char *)malloc(sz + 10);
+  HTEST_ASSERT(bigger);
+  memcpy(bigger, buffer, sz);
+  memset(bigger + sz, 0xFF, 10);
+  HTEST_ASSERT(Shape_validate_buffer(bigger, sz + 10, &consumed) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(consumed == sz);
+  /* A Shape is not a Link: its first child is text, not a structure */
+  HTEST_ASSERT(Link_validate_buffer(buffer, sz, &consumed) 
+               == HARIS_STRUCTURE_ERROR);
+  free(bigger);
+  free(buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+/* Every prefix of the message and every one of a handful of corruptions
+   of each byte is judged the same way by the validator and the decoder.
+   A corrupted length can make the decoder try to allocate a huge list
+   before it finds out the input is too short, so it decodes out of an
+   arena that is just big enough for the real message. */
+static int agreement_test(void)
+{
+  static const unsigned char replacements[] = { 0, 0x01, 0x40, 0x41, 0x80,
+                                                0x81, 0xC0, 0xFF };
+  unsigned char *buffer;
+  haris_uint32_t sz, i, j, consumed;
+  size_t len;
+  unsigned char original, *out_addr, memory[4096];
+  HarisStatus validated, decoded;
+  HarisArena arena;
+  Shape *s = Shape_create(), *out;
+  HTEST_ASSERT(s && fill_shape(s, 2));
+  haris_arena_init(&arena, memory, sizeof memory);
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_from_buffer_arena(&arena, &out, buffer, sz, &out_addr)
+               == HARIS_SUCCESS);
+  haris_arena_reset(&arena);
+  for (i = 0; i < sz; i ++) {
+    HTEST_ASSERT(Shape_validate_buffer(buffer, i, &consumed) 
+                 == HARIS_INPUT_ERROR);
+    HTEST_ASSERT(Shape_from_buffer_arena(&arena, &out, buffer, i, &out_addr)
+                 == HARIS_INPUT_ERROR);
+  }
+  for (i = 0; i < sz; i ++) {
+    original = buffer[i];
+    for (j = 0; j < sizeof replacements; j ++) {
+      buffer[i] = replacements[j];
+      validated = Shape_validate_buffer(buffer, sz, &consumed);
+      decoded = Shape_from_buffer_arena(&arena, &out, buffer, sz, &out_addr);
+      haris_arena_reset(&arena);
+      HTEST_ASSERT((validated == HARIS_SUCCESS) == (decoded == HARIS_SUCCESS));
+      if (validated == HARIS_SUCCESS) {
+        HTEST_ASSERT(buffer + consumed == out_addr);
+        HTEST_ASSERT(haris_scan_length(buffer, sz, &len) == HARIS_SUCCESS);
+        HTEST_ASSERT(len == consumed);
+      }
+    }
+    buffer[i] = original;
+  }
+  free(buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+static int depth_test(void)
+{
+  /* The encoder won't produce a message this deep, so put it together by
+     hand: every link is a header, a one-byte body, and then the next 
+     link. The last link's `next` is null. */
+  unsigned char *buffer, *out_addr;
+  haris_uint32_t sz = 3 * (HARIS_DEPTH_LIMIT + 5) + 1, consumed, i;
+  size_t len;
+  Link *out = Link_create();
+  buffer = (unsigned char *)malloc(sz);
+  HTEST_ASSERT(out && buffer);
+  for (i = 0; i < HARIS_DEPTH_LIMIT + 5; i ++) {
+    buffer[3 * i] = 0x41;
+    buffer[3 * i + 1] = 1;
+    buffer[3 * i + 2] = (unsigned char)i;
+  }
+  buffer[sz - 1] = 0;
+  HTEST_ASSERT(Link_validate_buffer(buffer, sz, &consumed) 
+               == HARIS_DEPTH_ERROR);
+  HTEST_ASSERT(Link_from_buffer(out, buffer, sz, &out_addr) 
+               == HARIS_DEPTH_ERROR);
+  HTEST_ASSERT(haris_scan_length(buffer, sz, &len) == HARIS_DEPTH_ERROR);
+  /* ... but a shallower one is fine */
+  HTEST_ASSERT(Link_validate_buffer(buffer + 3 * 10, sz - 3 * 10, &consumed) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(consumed == sz - 3 * 10);
+  HTEST_ASSERT(haris_scan_length(buffer + 3 * 10, sz - 3 * 10, &len) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(len == consumed);
+  free(buffer);
+  Link_destroy(out);
+  return 1;
+}
+
+/* Several messages of different types, back to back, are split apart
+   without knowing what they are */
+static int scan_test(void)
+{
+  unsigned char *shape_buffer, *stream, point_buffer[Point_MAX_ENCODED_SIZE],
+    *out_addr;
+  haris_uint32_t shape_sz, point_sz;
+  size_t sz, len;
+  Shape *s = Shape_create();
+  Point p;
+  HTEST_ASSERT(s && fill_shape(s, 3));
+  p.x = 1;
+  p.y = 2;
+  HTEST_ASSERT(Shape_to_buffer_a(s, &shape_buffer, &shape_sz) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(Point_to_buffer_fixed(&p, point_buffer, &out_addr)
+               == HARIS_SUCCESS);
+  point_sz = (haris_uint32_t)(out_addr - point_buffer);
+  sz = 2 * shape_sz + point_sz;
+  stream = (unsigned char *)malloc(sz);
+  HTEST_ASSERT(stream);
+  memcpy(stream, shape_buffer, shape_sz);
+  memcpy(stream + shape_sz, point_buffer, point_sz);
+  memcpy(stream + shape_sz + point_sz, shape_buffer, shape_sz);
+  HTEST_ASSERT(haris_scan_length(stream, sz, &len) == HARIS_SUCCESS);
+  HTEST_ASSERT(len == shape_sz);
+  HTEST_ASSERT(haris_scan_length(stream + len, sz - len, &len) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(len == point_sz);
+  HTEST_ASSERT(haris_scan_length(stream + shape_sz + point_sz, shape_sz,
+                                 &len) == HARIS_SUCCESS);
+  HTEST_ASSERT(len == shape_sz);
+  /* A message that has only partly arrived */
+  HTEST_ASSERT(haris_scan_length(stream, shape_sz - 1, &len) 
+               == HARIS_INPUT_ERROR);
+  HTEST_ASSERT(haris_scan_length(stream, 0, &len) == HARIS_INPUT_ERROR);
+  /* A list is not a message: the name follows the header and the 9-byte
+     body */
+  HTEST_ASSERT(stream[11] == 0x80);
+  HTEST_ASSERT(haris_scan_length(stream + 11, sz - 11, &len) 
+               == HARIS_STRUCTURE_ERROR);
+  free(stream);
+  free(shape_buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+static int unknown_children_test(void)
+{
+  /* A Point with a larger body and two extra children, a list of bytes 
+     and a list of bodiless structures, as a newer schema might produce */
+  unsigned char buffer[] = { 0x42, 0x9, 0xFF, 0xFF, 0xFF, 0xFF, 
+                             0x2, 0, 0, 0, 0xAB, 0x80, 0x1, 0, 0, 0x7, 
+                             0xC0, 0x3, 0, 0, 0x40, 0x2, 1, 2, 3, 4, 5, 6 };
+  haris_uint32_t consumed;
+  size_t len;
+  HTEST_ASSERT(Point_validate_buffer(buffer, sizeof buffer, &consumed)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(consumed == sizeof buffer);
+  HTEST_ASSERT(haris_scan_length(buffer, sizeof buffer, &len) 
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(len == sizeof buffer);
+  HTEST_ASSERT(Point_validate_buffer(buffer, sizeof buffer - 1, &consumed)
+               == HARIS_INPUT_ERROR);
+  return 1;
+}
+
+/* The tracing visitors write down every callback they get, so that a
+   whole walk can be checked against a single string */
+typedef struct {
+  char log[1024];
+  size_t len;
+} Trace;
+
+static void trace(void *ctx, const char *fmt, ...)
+{
+  Trace *t = (Trace *)ctx;
+  va_list args;
+  va_start(args, fmt);
+  t->len += (size_t)vsnprintf(t->log + t->len, sizeof t->log - t->len, 
+                              fmt, args);
+  va_end(args);
+}
+
+static void shape_begin(void *ctx) { trace(ctx, "S{"); }
+static void shape_end(void *ctx) { trace(ctx, "}"); }
+static void shape_k(void *ctx, haris_uint8_t k) { trace(ctx, "k%d", k); }
+static void shape_weight(void *ctx, haris_float64 w) { trace(ctx, "w%g", w); }
+static void shape_name(void *ctx, const char *text, haris_uint32_t len)
+{
+  trace(ctx, "n%.*s", (int)len, text);
+}
+static void shape_values_begin(void *ctx, haris_uint32_t len)
+{
+  trace(ctx, "v%u:", (unsigned)len);
+}
+static void shape_values_element(void *ctx, haris_uint32_t i, 
+                                 haris_int16_t value)
+{
+  trace(ctx, "%u=%d,", (unsigned)i, value);
+}
+static void shape_ids_begin(void *ctx, haris_uint32_t len)
+{
+  trace(ctx, "i%u:", (unsigned)len);
+}
+static void shape_points_begin(void *ctx, haris_uint32_t len)
+{
+  trace(ctx, "p%u:", (unsigned)len);
+}
+static void shape_parts_begin(void *ctx, haris_uint32_t len)
+{
+  trace(ctx, "s%u:", (unsigned)len);
+}
+static void point_begin(void *ctx) { trace(ctx, "P("); }
+static void point_end(void *ctx) { trace(ctx, ")"); }
+static void point_x(void *ctx, haris_int32_t x) { trace(ctx, "%d", x); }
+static void point_y(void *ctx, haris_int32_t y) { trace(ctx, ",%d", y); }
+static void link_begin(void *ctx) { trace(ctx, "["); }
+static void link_end(void *ctx) { trace(ctx, "]"); }
+static void link_id(void *ctx, haris_uint8_t id) { trace(ctx, "L%d", id); }
+
+static const Point_visitor point_visitor = {
+  point_begin, point_end, point_x, point_y
+};
+
+static const Link_visitor link_visitor = {
+  link_begin, link_end, link_id, &link_visitor
+};
+
+static const Shape_visitor shape_visitor = {
+  shape_begin, shape_end, shape_k, shape_weight, shape_name,
+  shape_values_begin, shape_values_element, shape_ids_begin, NULL,
+  shape_points_begin, &point_visitor, &point_visitor, &point_visitor,
+  &link_visitor,
+  shape_parts_begin, &shape_visitor
+};
+
+static int visit_order_test(void)
+{
+  unsigned char *buffer;
+  haris_uint32_t sz, consumed;
+  Trace t = { "", 0 };
+  Shape *s = Shape_create();
+  HTEST_ASSERT(s && fill_shape(s, 1));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_visit_buffer(buffer, sz, &shape_visitor, &t, &consumed)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(consumed == sz);
+  HTEST_ASSERT(!strcmp(t.log, 
+"S{k1w2.5nabcv5:0=0,1=-300,2=-600,3=-900,4=-1200,i4:p3:P(0,0)P(1,-1)\
+P(2,-2)P(0,0)[L1[L2]]s1:S{k1w2.5nabcv5:0=0,1=-300,2=-600,3=-900,4=-1200,\
+i4:p3:P(0,0)P(1,-1)P(2,-2)P(0,0)[L1[L2]]s0:}}"));
+  free(buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+/* Fields without callbacks are skipped, nested structures included */
+static int visit_partial_test(void)
+{
+  static const Link_visitor ids = { NULL, NULL, link_id, &ids };
+  static const Shape_visitor visitor = {
+    NULL, shape_end, NULL, NULL, shape_name, NULL, shape_values_element,
+    NULL, NULL, NULL, NULL, NULL, NULL, &ids, NULL, NULL
+  };
+  unsigned char *buffer;
+  haris_uint32_t sz, consumed;
+  Trace t = { "", 0 };
+  Shape *s = Shape_create();
+  HTEST_ASSERT(s && fill_shape(s, 1));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_visit_buffer(buffer, sz, &visitor, &t, &consumed)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(consumed == sz);
+  HTEST_ASSERT(!strcmp(t.log, "nabc0=0,1=-300,2=-600,3=-900,4=-1200,L1L2}"));
+  free(buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+typedef struct {
+  haris_int64_t x, y;
+  haris_uint32_t points;
+} Sums;
+
+static void sum_begin(void *ctx) { ((Sums *)ctx)->points ++; }
+static void sum_x(void *ctx, haris_int32_t x) { ((Sums *)ctx)->x += x; }
+static void sum_y(void *ctx, haris_int32_t y) { ((Sums *)ctx)->y += y; }
+
+/* A long list of structures is summed without decoding it */
+static int visit_sum_test(void)
+{
+  static const Point_visitor point = { sum_begin, NULL, sum_x, sum_y };
+  static const Shape_visitor visitor = {
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &point,
+    NULL, NULL, NULL, NULL, NULL
+  };
+  const haris_int64_t n = 100000;
+  unsigned char *buffer;
+  haris_uint32_t sz, i;
+  Sums sums = { 0, 0, 0 };
+  Shape *s = Shape_create();
+  HTEST_ASSERT(s && fill_shape(s, 0));
+  HTEST_ASSERT(Shape_init_points(s, (haris_uint32_t)n) == HARIS_SUCCESS);
+  for (i = 0; i < (haris_uint32_t)n; i ++) {
+    Shape_get_points(s)[i].x = (haris_int32_t)i;
+    Shape_get_points(s)[i].y = -2 * (haris_int32_t)i;
+  }
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_visit_buffer(buffer, sz, &visitor, &sums, NULL)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(sums.points == (haris_uint32_t)n);
+  HTEST_ASSERT(sums.x == n * (n - 1) / 2);
+  HTEST_ASSERT(sums.y == -n * (n - 1));
+  free(buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+/* Bad messages are turned away before any callback fires, and messages
+   from a newer schema have what the visitor doesn't know skipped */
+static int visit_error_test(void)
+{
+  unsigned char *buffer;
+  haris_uint32_t sz, consumed;
+  Trace t = { "", 0 };
+  Shape *s = Shape_create();
+  HTEST_ASSERT(s && fill_shape(s, 1));
+  HTEST_ASSERT(Shape_to_buffer_a(s, &buffer, &sz) == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_visit_buffer(buffer, sz - 1, &shape_visitor, &t, 
+                                  &consumed) == HARIS_INPUT_ERROR);
+  HTEST_ASSERT(t.len == 0);
+  HTEST_ASSERT(Link_visit_buffer(buffer, sz, &link_visitor, &t, &consumed)
+               == HARIS_STRUCTURE_ERROR);
+  HTEST_ASSERT(t.len == 0);
+  /* A Shape's body starts with a body big enough for a Point, and all of
+     its children are unknown to one */
+  HTEST_ASSERT(Point_visit_buffer(buffer, sz, &point_visitor, &t, &consumed)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(consumed == sz);
+  HTEST_ASSERT(t.log[0] == 'P' && t.log[t.len - 1] == ')' &&
+               !strchr(t.log + 1, 'P'));
+  free(buffer);
+  Shape_destroy(s);
+  return 1;
+}
+
+static int all_tests(void)
+{
+  HTEST_RUN(valid_test);
+  HTEST_RUN(agreement_test);
+  HTEST_RUN(depth_test);
+  HTEST_RUN(scan_test);
+  HTEST_RUN(unknown_children_test);
+  HTEST_RUN(visit_order_test);
+  HTEST_RUN(visit_partial_test);
+  HTEST_RUN(visit_sum_test);
+  HTEST_RUN(visit_error_test);
+  return 1;
+}
+
+int main(void)
+{
+  if (!all_tests()) return -1;
+  else {
+    printf("All tests succeeded.\n");
+    return 0;
+  }
+}
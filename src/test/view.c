@@ -0,0 +1,164 @@
+#include "htest.h"
+#include "view.haris.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+static unsigned char *shape_buffer;
+static haris_uint32_t shape_sz;
+
+static int encode_shape(void)
+{
+  Shape *shape = Shape_create();
+  haris_uint32_t i;
+  HTEST_ASSERT(shape);
+  shape->c = Color_GREEN;
+  shape->weight = -300;
+  HTEST_ASSERT(Shape_init_name(shape, 5) == HARIS_SUCCESS);
+  memcpy(Shape_get_name(shape), "hello", 5);
+  HTEST_ASSERT(Shape_init_ids(shape, 3) == HARIS_SUCCESS);
+  for (i = 0; i < 3; i ++)
+    Shape_get_ids(shape)[i] = 0xDEAD0000U + i;
+  HTEST_ASSERT(Shape_init_points(shape, 4) == HARIS_SUCCESS);
+  for (i = 0; i < 4; i ++) {
+    Shape_get_points(shape)[i].x = (haris_int32_t)i;
+    Shape_get_points(shape)[i].y = -(haris_int32_t)i;
+  }
+  HTEST_ASSERT(Shape_init_origin(shape) == HARIS_SUCCESS);
+  Shape_get_origin(shape)->x = 10;
+  Shape_get_origin(shape)->y = 20;
+  HTEST_ASSERT(Shape_init_chain(shape) == HARIS_SUCCESS);
+  Shape_get_chain(shape)->id = 7;
+  HTEST_ASSERT(Node_init_next(Shape_get_chain(shape)) == HARIS_SUCCESS);
+  Node_get_next(Shape_get_chain(shape))->id = 8;
+  Shape_clear_nothing(shape);
+  HTEST_ASSERT(Shape_to_buffer_a(shape, &shape_buffer, &shape_sz)
+               == HARIS_SUCCESS);
+  Shape_destroy(shape);
+  return 1;
+}
+
+static int scalar_test(void)
+{
+  Shape_view view;
+  HTEST_ASSERT(Shape_view_from_buffer(&view, shape_buffer, shape_sz)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_view_get_c(&view) == Color_GREEN);
+  HTEST_ASSERT(Shape_view_get_weight(&view) == -300);
+  return 1;
+}
+
+static int list_test(void)
+{
+  Shape_view view;
+  HarisListView list;
+  Point_view point;
+  haris_uint32_t i, id;
+  HTEST_ASSERT(Shape_view_from_buffer(&view, shape_buffer, shape_sz)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_view_get_name(&view, &list) == HARIS_SUCCESS);
+  HTEST_ASSERT(list.len == 5);
+  HTEST_ASSERT(memcmp(list.ptr, "hello", 5) == 0);
+  HTEST_ASSERT(Shape_view_get_ids(&view, &list) == HARIS_SUCCESS);
+  HTEST_ASSERT(list.len == 3);
+  for (i = 0; i < 3; i ++) {
+    HTEST_ASSERT(Shape_view_ids_at(&list, i, &id) == HARIS_SUCCESS);
+    HTEST_ASSERT(id == 0xDEAD0000U + i);
+  }
+  HTEST_ASSERT(Shape_view_ids_at(&list, 3, &id) == HARIS_INPUT_ERROR);
+  HTEST_ASSERT(Shape_view_get_points(&view, &list) == HARIS_SUCCESS);
+  HTEST_ASSERT(list.len == 4);
+  for (i = 0; i < 4; i ++) {
+    HTEST_ASSERT(Shape_view_points_at(&list, i, &point) == HARIS_SUCCESS);
+    HTEST_ASSERT(Point_view_get_x(&point) == (haris_int32_t)i);
+    HTEST_ASSERT(Point_view_get_y(&point) == -(haris_int32_t)i);
+  }
+  HTEST_ASSERT(Shape_view_points_at(&list, 4, &point) == HARIS_INPUT_ERROR);
+  /* Reading the list in order uses up the list view */
+  for (i = 0; i < 4; i ++) {
+    HTEST_ASSERT(Shape_view_points_next(&list, &point) == HARIS_SUCCESS);
+    HTEST_ASSERT(Point_view_get_x(&point) == (haris_int32_t)i);
+    HTEST_ASSERT(Point_view_get_y(&point) == -(haris_int32_t)i);
+  }
+  HTEST_ASSERT(list.len == 0);
+  HTEST_ASSERT(Shape_view_points_next(&list, &point) == HARIS_INPUT_ERROR);
+  return 1;
+}
+
+static int struct_test(void)
+{
+  Shape_view view;
+  Point_view point;
+  Node_view node, next;
+  HTEST_ASSERT(Shape_view_from_buffer(&view, shape_buffer, shape_sz)
+               == HARIS_SUCCESS);
+  HTEST_ASSERT(Shape_view_get_origin(&view, &point) == HARIS_SUCCESS);
+  HTEST_ASSERT(Point_view_get_x(&point) == 10);
+  HTEST_ASSERT(Point_view_get_y(&point) == 20);
+  HTEST_ASSERT(Shape_view_get_chain(&view, &node) == HARIS_SUCCESS);
+  HTEST_ASSERT(Node_view_get_id(&node) == 7);
+  HTEST_ASSERT(Node_view_get_next(&node, &next) == HARIS_SUCCESS);
+  HTEST_ASSERT(Node_view_get_id(&next) == 8);
+  HTEST_ASSERT(Node_view_get_next(&next, &node) == HARIS_SUCCESS);
+  HTEST_ASSERT(HARIS_VIEW_IS_NULL(&node));
+  HTEST_ASSERT(Node_view_get_next(&node, &next) == HARIS_STRUCTURE_ERROR);
+  HTEST_ASSERT(Shape_view_get_nothing(&view, &point) == HARIS_SUCCESS);
+  HTEST_ASSERT(HARIS_VIEW_IS_NULL(&point));
+  return 1;
+}
+
+static int truncation_test(void)
+{
+  Shape_view view;
+  Point_view point;
+  HarisListView list;
+  haris_uint32_t sz;
+  /* Every truncation of the message should be caught by some accessor,
+     and none of them should read past the end of the buffer */
+  for (sz = 0; sz < shape_sz; sz ++) {
+    unsigned char *copy = (unsigned char *)malloc(sz ? sz : 1);
+    HTEST_ASSERT(copy);
+    memcpy(copy, shape_buffer, sz);
+    if (Shape_view_from_buffer(&view, copy, sz) == HARIS_SUCCESS &&
+        Shape_view_get_name(&view, &list) == HARIS_SUCCESS &&
+        Shape_view_get_ids(&view, &list) == HARIS_SUCCESS &&
+        Shape_view_get_points(&view, &list) == HARIS_SUCCESS &&
+        Shape_view_points_at(&list, 3, &point) == HARIS_SUCCESS &&
+        Shape_view_get_origin(&view, &point) == HARIS_SUCCESS &&
+        Shape_view_get_nothing(&view, &point) == HARIS_SUCCESS) {
+      free(copy);
+      HTEST_ASSERT(0);
+    }
+    free(copy);
+  }
+  return 1;
+}
+
+static int structure_test(void)
+{
+  Point_view point;
+  Shape_view view;
+  unsigned char short_point[] = { 0x40, 0x4, 0, 0, 0, 0 };
+  unsigned char null_shape[] = { 0 };
+  HTEST_ASSERT(Point_view_from_buffer(&point, short_point, 
+                                      sizeof short_point)
+               == HARIS_STRUCTURE_ERROR);
+  HTEST_ASSERT(Shape_view_from_buffer(&view, null_shape, sizeof null_shape)
+               == HARIS_STRUCTURE_ERROR);
+  return 1;
+}
+
+int main(void)
+{
+  HTEST_RUN(encode_shape);
+  HTEST_RUN(scalar_test);
+  HTEST_RUN(list_test);
+  HTEST_RUN(struct_test);
+  HTEST_RUN(truncation_test);
+  HTEST_RUN(structure_test);
+  free(shape_buffer);
+  printf("All tests succeeded.\n");
+  return 0;
+}